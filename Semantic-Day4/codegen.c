@@ -0,0 +1,970 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "reader.h"
+#include "codegen.h"
+#include "optimize.h"
+#include "error.h"
+
+extern SymTab *symtab;
+extern Token *currentToken;
+extern Type *intType;
+
+CodeBlock *codeBlock;
+
+static int optimizeLevel = 0;
+static int foldedOperations = 0;
+
+static void emitted(int ok)
+{
+  if (!ok)
+  {
+    printf("Out of memory for the code!\n");
+    exit(-1);
+  }
+}
+
+void initCodeBuffer(void)
+{
+  codeBlock = createCodeBlock(CODE_SIZE);
+}
+
+void cleanCodeBuffer(void)
+{
+  freeCodeBlock(codeBlock);
+}
+
+void printCodeBuffer(void)
+{
+  printCodeBlock(codeBlock);
+}
+
+// Constants are folded as the code is generated from -O1 on
+void setOptimizeLevel(int level)
+{
+  optimizeLevel = level;
+}
+
+void optimizeCodeBuffer(void)
+{
+  optimize(codeBlock, optimizeLevel);
+}
+
+int serialize(char *fileName)
+{
+  FILE *f;
+
+  f = fopen(fileName, "wb");
+  if (f == NULL)
+    return IO_ERROR;
+  saveCode(codeBlock, f);
+  fclose(f);
+  return IO_SUCCESS;
+}
+
+/******************* Addresses ******************************/
+
+// The code may move as it grows, so jumps are patched by address
+CodeAddress getCurrentCodeAddress(void)
+{
+  return codeBlock->codeSize;
+}
+
+// How many static links lead from the current block to the given scope
+int computeNestedLevel(Scope *scope)
+{
+  Scope *tmp = symtab->currentScope;
+  int level = 0;
+
+  while (tmp != scope)
+  {
+    tmp = tmp->outer;
+    level++;
+  }
+  return level;
+}
+
+int isPredefinedFunction(Object *func)
+{
+  return findObject(symtab->globalObjectList, func->name) == func;
+}
+
+int isPredefinedProcedure(Object *proc)
+{
+  return findObject(symtab->globalObjectList, proc->name) == proc;
+}
+
+static Scope *parameterScope(Object *param)
+{
+  Object *owner = param->paramAttrs->function;
+
+  if (owner->kind == OBJ_FUNCTION)
+    return owner->funcAttrs->scope;
+  else
+    return owner->procAttrs->scope;
+}
+
+void genVariableAddress(Object *var)
+{
+  genLA(computeNestedLevel(var->varAttrs->scope), var->varAttrs->localOffset);
+}
+
+void genVariableValue(Object *var)
+{
+  genValue(var->varAttrs->type, computeNestedLevel(var->varAttrs->scope), var->varAttrs->localOffset);
+}
+
+// A reference parameter holds the address of its argument
+void genParameterAddress(Object *param)
+{
+  int level = computeNestedLevel(parameterScope(param));
+
+  if (param->paramAttrs->kind == PARAM_REFERENCE)
+    genLV(level, param->paramAttrs->localOffset);
+  else
+    genLA(level, param->paramAttrs->localOffset);
+}
+
+void genParameterValue(Object *param)
+{
+  int level = computeNestedLevel(parameterScope(param));
+
+  if (param->paramAttrs->kind == PARAM_REFERENCE)
+  {
+    genLV(level, param->paramAttrs->localOffset);
+    genLoad(param->paramAttrs->type);
+  }
+  else
+  {
+    genValue(param->paramAttrs->type, level, param->paramAttrs->localOffset);
+  }
+}
+
+// An int or char result is the first word of the frame; a DOUBLE one is a local
+void genReturnValueAddress(Object *func)
+{
+  int level = computeNestedLevel(func->funcAttrs->scope);
+
+  if (func->funcAttrs->returnType->typeClass == TP_FLOAT)
+    genLA(level, func->funcAttrs->resultOffset);
+  else
+    genLA(level, 0);
+}
+
+// The value of the word(s) at (level, offset); an array stands for its address
+void genValue(Type *type, int level, int offset)
+{
+  switch (type->typeClass)
+  {
+  case TP_FLOAT:
+    emitted(emitLVF(codeBlock, level, offset));
+    break;
+  case TP_ARRAY:
+    genLA(level, offset);
+    break;
+  default:
+    genLV(level, offset);
+    break;
+  }
+}
+
+void genConstant(ConstantValue *value)
+{
+  switch (value->type)
+  {
+  case TP_INT:
+    genLC(value->intValue);
+    break;
+  case TP_CHAR:
+    genLC(value->charValue);
+    break;
+  case TP_FLOAT:
+    genLCF(value->floatValue);
+    break;
+  default:
+    error(ERR_NOT_SUPPORTED, currentToken->lineNo, currentToken->colNo);
+    break;
+  }
+}
+
+/******************* Calls ******************************/
+
+void genPredefinedProcedureCall(Object *proc)
+{
+  if (strcmp(proc->name, "WRITEI") == 0)
+    emitted(emitWRI(codeBlock));
+  else if (strcmp(proc->name, "WRITEC") == 0)
+    emitted(emitWRC(codeBlock));
+  else if (strcmp(proc->name, "WRITEF") == 0)
+    emitted(emitWRF(codeBlock));
+  else if (strcmp(proc->name, "WRITELN") == 0)
+    emitted(emitWLN(codeBlock));
+  else if (strcmp(proc->name, "CHECKPOINT") == 0)
+    emitted(emitBP(codeBlock));
+  else
+    error(ERR_NOT_SUPPORTED, currentToken->lineNo, currentToken->colNo);
+}
+
+void genPredefinedFunctionCall(Object *func)
+{
+  if (strcmp(func->name, "READI") == 0)
+    emitted(emitRI(codeBlock));
+  else if (strcmp(func->name, "READC") == 0)
+    emitted(emitRC(codeBlock));
+  else if (strcmp(func->name, "READF") == 0)
+    emitted(emitRF(codeBlock));
+  else
+    error(ERR_NOT_SUPPORTED, currentToken->lineNo, currentToken->colNo);
+}
+
+// The callee is declared in the scope that encloses its own
+void genProcedureCall(Object *proc)
+{
+  genCALL(computeNestedLevel(proc->procAttrs->scope->outer), proc->procAttrs->codeAddress);
+}
+
+void genFunctionCall(Object *func)
+{
+  genCALL(computeNestedLevel(func->funcAttrs->scope->outer), func->funcAttrs->codeAddress);
+}
+
+// There are no string values at run time; a literal is written a char at a time
+void genWriteString(char *str)
+{
+  while (*str != '\0')
+  {
+    genLC((unsigned char)*str);
+    emitted(emitWRC(codeBlock));
+    str++;
+  }
+}
+
+/******************* Typed instructions ******************************/
+
+// Loads the value at the address on the top of the stack
+void genLoad(Type *type)
+{
+  switch (type->typeClass)
+  {
+  case TP_FLOAT:
+    emitted(emitLIF(codeBlock));
+    break;
+  case TP_ARRAY:
+    break;
+  default:
+    genLI();
+    break;
+  }
+}
+
+// Stores the value on the top into the address below it; arrays are copied whole
+void genStore(Type *type)
+{
+  switch (type->typeClass)
+  {
+  case TP_FLOAT:
+    emitted(emitSTF(codeBlock));
+    break;
+  case TP_ARRAY:
+    emitted(emitMVB(codeBlock, sizeOfType(type)));
+    break;
+  default:
+    genST();
+    break;
+  }
+}
+
+// An int on the top becomes a DOUBLE where one is expected
+void genConvert(Type *to, Type *from)
+{
+  if ((to->typeClass == TP_FLOAT) && (from->typeClass == TP_INT))
+    emitted(emitCVIF(codeBlock, 0));
+}
+
+// Promotes the int operand when the other one is a DOUBLE; returns the type of the result
+static Type *promote(Type *left, Type *right)
+{
+  if ((left->typeClass == TP_FLOAT) && (right->typeClass == TP_INT))
+  {
+    emitted(emitCVIF(codeBlock, 0));
+    return left;
+  }
+  if ((left->typeClass == TP_INT) && (right->typeClass == TP_FLOAT))
+  {
+    emitted(emitCVIF(codeBlock, DOUBLE_SIZE));
+    return right;
+  }
+  return left;
+}
+
+static Type *resultType(Type *left, Type *right)
+{
+  return (right->typeClass == TP_FLOAT) ? right : left;
+}
+
+static void emitArith(TokenType op, int isFloat)
+{
+  switch (op)
+  {
+  case SB_PLUS:
+    emitted(isFloat ? emitADF(codeBlock) : emitAD(codeBlock));
+    break;
+  case SB_MINUS:
+    emitted(isFloat ? emitSBF(codeBlock) : emitSB(codeBlock));
+    break;
+  case SB_TIMES:
+    emitted(isFloat ? emitMLF(codeBlock) : emitML(codeBlock));
+    break;
+  case SB_SLASH:
+    emitted(isFloat ? emitDVF(codeBlock) : emitDV(codeBlock));
+    break;
+  default:
+    break;
+  }
+}
+
+static void emitCompare(TokenType op, int isFloat)
+{
+  switch (op)
+  {
+  case SB_EQ:
+    emitted(isFloat ? emitEQF(codeBlock) : emitEQ(codeBlock));
+    break;
+  case SB_NEQ:
+    emitted(isFloat ? emitNEF(codeBlock) : emitNE(codeBlock));
+    break;
+  case SB_LE:
+    emitted(isFloat ? emitLEF(codeBlock) : emitLE(codeBlock));
+    break;
+  case SB_LT:
+    emitted(isFloat ? emitLTF(codeBlock) : emitLT(codeBlock));
+    break;
+  case SB_GE:
+    emitted(isFloat ? emitGEF(codeBlock) : emitGE(codeBlock));
+    break;
+  case SB_GT:
+    emitted(isFloat ? emitGTF(codeBlock) : emitGT(codeBlock));
+    break;
+  default:
+    break;
+  }
+}
+
+/******************* Constant folding ******************************/
+
+/*
+ * An operand is given by the address its code starts at; it ends where the
+ * next one starts, or at the current address for the last one. An operand
+ * whose code is a single LC or LCF, a literal or a CONST, is a constant,
+ * and an operation on constants is done here instead of at run time.
+ */
+
+static ConstantValue *constantOperand(CodeAddress start, CodeAddress end)
+{
+  Instruction *inst = &codeBlock->code[start];
+  WORD words[DOUBLE_SIZE];
+  double value;
+
+  if ((optimizeLevel == 0) || (end - start != 1))
+    return NULL;
+  if (inst->op == OP_LC)
+    return makeIntConstant(inst->q);
+  if (inst->op == OP_LCF)
+  {
+    words[0] = inst->p;
+    words[1] = inst->q;
+    memcpy(&value, words, sizeof(value));
+    return makeFloatConstant(value);
+  }
+  return NULL;
+}
+
+static double floatOf(ConstantValue *value)
+{
+  return (value->type == TP_FLOAT) ? value->floatValue : value->intValue;
+}
+
+// The code of the operands is dropped, their value will be emitted instead
+static void truncateCode(CodeAddress address)
+{
+  codeBlock->codeSize = address;
+}
+
+// Only for code without jumps, whose targets would move
+static void removeCode(CodeAddress address, int count)
+{
+  memmove(codeBlock->code + address, codeBlock->code + address + count,
+          (codeBlock->codeSize - address - count) * sizeof(Instruction));
+  codeBlock->codeSize -= count;
+}
+
+static int hasJumps(CodeAddress start, CodeAddress end)
+{
+  for (; start < end; start++)
+    if ((codeBlock->code[start].op == OP_J) || (codeBlock->code[start].op == OP_FJ))
+      return 1;
+  return 0;
+}
+
+// Code that can be dropped unseen: it reads variables and computes, but cannot fail or write
+static int isPure(CodeAddress start, CodeAddress end)
+{
+  for (; start < end; start++)
+    switch (codeBlock->code[start].op)
+    {
+    case OP_LA:
+    case OP_LV:
+    case OP_LC:
+    case OP_CV:
+    case OP_AD:
+    case OP_SB:
+    case OP_ML:
+    case OP_NEG:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GT:
+    case OP_LT:
+    case OP_GE:
+    case OP_LE:
+    case OP_LCF:
+    case OP_LVF:
+    case OP_ADF:
+    case OP_SBF:
+    case OP_MLF:
+    case OP_DVF:
+    case OP_NEGF:
+    case OP_CVIF:
+    case OP_PWF:
+      break;
+    default:
+      return 0;
+    }
+  return 1;
+}
+
+// NULL when the operation is left to run time: an int division by zero or overflow fails there
+static ConstantValue *foldArith(TokenType op, ConstantValue *a, ConstantValue *b, int isFloat)
+{
+  double x, y;
+
+  if (isFloat)
+  {
+    x = floatOf(a);
+    y = floatOf(b);
+    switch (op)
+    {
+    case SB_PLUS:
+      return makeFloatConstant(x + y);
+    case SB_MINUS:
+      return makeFloatConstant(x - y);
+    case SB_TIMES:
+      return makeFloatConstant(x * y);
+    case SB_SLASH:
+      return makeFloatConstant(x / y);
+    default:
+      return NULL;
+    }
+  }
+
+  switch (op)
+  {
+  case SB_PLUS:
+    return makeIntConstant((WORD)((unsigned)a->intValue + (unsigned)b->intValue));
+  case SB_MINUS:
+    return makeIntConstant((WORD)((unsigned)a->intValue - (unsigned)b->intValue));
+  case SB_TIMES:
+    return makeIntConstant((WORD)((unsigned)a->intValue * (unsigned)b->intValue));
+  case SB_SLASH:
+    if ((b->intValue == 0) || ((a->intValue == INT_MIN) && (b->intValue == -1)))
+      return NULL;
+    return makeIntConstant(a->intValue / b->intValue);
+  default:
+    return NULL;
+  }
+}
+
+static ConstantValue *foldCompare(TokenType op, ConstantValue *a, ConstantValue *b)
+{
+  double x = floatOf(a);
+  double y = floatOf(b);
+
+  switch (op)
+  {
+  case SB_EQ:
+    return makeIntConstant(x == y);
+  case SB_NEQ:
+    return makeIntConstant(x != y);
+  case SB_LE:
+    return makeIntConstant(x <= y);
+  case SB_LT:
+    return makeIntConstant(x < y);
+  case SB_GE:
+    return makeIntConstant(x >= y);
+  case SB_GT:
+    return makeIntConstant(x > y);
+  default:
+    return NULL;
+  }
+}
+
+static int isValue(ConstantValue *value, double x)
+{
+  return (value != NULL) && (floatOf(value) == x);
+}
+
+// x + 0, x - 0, x * 1, x / 1; only the exact ones for DOUBLE, where -0.0 is not 0.0
+static int isRightIdentity(TokenType op, ConstantValue *b, int isFloat)
+{
+  if ((op == SB_TIMES) || (op == SB_SLASH))
+    return isValue(b, 1);
+  if (!isValue(b, 0))
+    return 0;
+  if (!isFloat)
+    return 1;
+  return (op == SB_PLUS) ? (signbit(b->floatValue) != 0) : (signbit(b->floatValue) == 0);
+}
+
+// 0 + x, 1 * x
+static int isLeftIdentity(TokenType op, ConstantValue *a, int isFloat)
+{
+  if (op == SB_TIMES)
+    return isValue(a, 1);
+  if ((op != SB_PLUS) || !isValue(a, 0))
+    return 0;
+  return !isFloat || (signbit(a->floatValue) != 0);
+}
+
+/*
+ * Identities and annihilators on operands of the same type: x + 0 is x,
+ * 0 * x is 0 when x has no effect. Returns 0 when nothing applies.
+ */
+static int simplify(TokenType op, int isFloat, ConstantValue *a, ConstantValue *b,
+                    CodeAddress leftStart, CodeAddress rightStart)
+{
+  CodeAddress end = getCurrentCodeAddress();
+
+  if (isRightIdentity(op, b, isFloat))
+  {
+    truncateCode(rightStart);
+    return 1;
+  }
+  if (!isFloat && (op == SB_TIMES) && isValue(b, 0) && isPure(leftStart, rightStart))
+  {
+    truncateCode(leftStart);
+    genLC(0);
+    return 1;
+  }
+
+  if ((a == NULL) || hasJumps(rightStart, end))
+    return 0;
+  if (isLeftIdentity(op, a, isFloat))
+  {
+    removeCode(leftStart, 1);
+    return 1;
+  }
+  if (!isFloat && (op == SB_TIMES) && isValue(a, 0) && isPure(rightStart, end))
+  {
+    truncateCode(leftStart);
+    genLC(0);
+    return 1;
+  }
+  if (!isFloat && (op == SB_MINUS) && isValue(a, 0))
+  {
+    removeCode(leftStart, 1);
+    emitted(emitNEG(codeBlock));
+    return 1;
+  }
+  return 0;
+}
+
+Type *genArith(TokenType op, Type *left, CodeAddress leftStart, Type *right, CodeAddress rightStart)
+{
+  Type *type = resultType(left, right);
+  int isFloat = (type->typeClass == TP_FLOAT);
+  ConstantValue *a = constantOperand(leftStart, rightStart);
+  ConstantValue *b = constantOperand(rightStart, getCurrentCodeAddress());
+  ConstantValue *result = NULL;
+
+  if ((a != NULL) && (b != NULL))
+    result = foldArith(op, a, b, isFloat);
+  if (result != NULL)
+  {
+    truncateCode(leftStart);
+    genConstant(result);
+    foldedOperations++;
+  }
+  else if ((left->typeClass == right->typeClass) && simplify(op, isFloat, a, b, leftStart, rightStart))
+    foldedOperations++;
+  else
+  {
+    promote(left, right);
+    emitArith(op, isFloat);
+  }
+
+  free(a);
+  free(b);
+  free(result);
+  return type;
+}
+
+void genCompare(TokenType op, Type *left, CodeAddress leftStart, Type *right, CodeAddress rightStart)
+{
+  Type *type = resultType(left, right);
+  ConstantValue *a = constantOperand(leftStart, rightStart);
+  ConstantValue *b = constantOperand(rightStart, getCurrentCodeAddress());
+  ConstantValue *result = NULL;
+
+  if ((a != NULL) && (b != NULL))
+    result = foldCompare(op, a, b);
+  if (result != NULL)
+  {
+    truncateCode(leftStart);
+    genConstant(result);
+    foldedOperations++;
+  }
+  else
+  {
+    promote(left, right);
+    emitCompare(op, type->typeClass == TP_FLOAT);
+  }
+
+  free(a);
+  free(b);
+  free(result);
+}
+
+void genNegate(Type *type, CodeAddress start)
+{
+  ConstantValue *value = constantOperand(start, getCurrentCodeAddress());
+
+  if (value != NULL)
+  {
+    truncateCode(start);
+    if (value->type == TP_FLOAT)
+      value->floatValue = -value->floatValue;
+    else
+      value->intValue = (WORD)(0u - (unsigned)value->intValue);
+    genConstant(value);
+    foldedOperations++;
+    free(value);
+  }
+  else if (type->typeClass == TP_FLOAT)
+    emitted(emitNEGF(codeBlock));
+  else
+    emitted(emitNEG(codeBlock));
+}
+
+/******************* Powers ******************************/
+
+/*
+ * x ** n for a constant n up to POWER_CHAIN_LIMIT is a chain of CV and ML
+ * on the top of the stack. chains[n] tells how the shortest one the stack
+ * allows is made: from x ** (n - 1), from x ** (n / 2), or as a power of
+ * a power, (x ** d) ** (n / d). That is the shortest there is for every n
+ * below 23. Larger exponents, and DOUBLEs which CV cannot copy, use PW.
+ */
+
+#define POWER_CHAIN_LIMIT 32
+
+enum
+{
+  CHAIN_TIMES_X = -1,
+  CHAIN_SQUARE = -2
+};
+
+static int chainLength[POWER_CHAIN_LIMIT + 1];
+static int chains[POWER_CHAIN_LIMIT + 1]; // CHAIN_TIMES_X, CHAIN_SQUARE or d
+
+static void findChains(void)
+{
+  int n, d;
+
+  for (n = 2; n <= POWER_CHAIN_LIMIT; n++)
+  {
+    chainLength[n] = chainLength[n - 1] + 1;
+    chains[n] = CHAIN_TIMES_X;
+    if ((n % 2 == 0) && (chainLength[n / 2] + 1 < chainLength[n]))
+    {
+      chainLength[n] = chainLength[n / 2] + 1;
+      chains[n] = CHAIN_SQUARE;
+    }
+    for (d = 3; d * d <= n; d++)
+      if ((n % d == 0) && (chainLength[d] + chainLength[n / d] < chainLength[n]))
+      {
+        chainLength[n] = chainLength[d] + chainLength[n / d];
+        chains[n] = d;
+      }
+  }
+}
+
+static void genPowerChain(int n)
+{
+  if (n == 1)
+    return;
+  if (chainLength[POWER_CHAIN_LIMIT] == 0)
+    findChains();
+
+  switch (chains[n])
+  {
+  case CHAIN_TIMES_X:
+    genCV();
+    genPowerChain(n - 1);
+    genML();
+    break;
+  case CHAIN_SQUARE:
+    genPowerChain(n / 2);
+    genCV();
+    genML();
+    break;
+  default:
+    genPowerChain(chains[n]);
+    genPowerChain(n / chains[n]);
+    break;
+  }
+}
+
+// As PWF does it, so that folding does not change the result
+static double foldPowerFloat(double x, WORD n)
+{
+  double power = 1;
+  unsigned m = (n < 0) ? 0u - (unsigned)n : (unsigned)n;
+
+  for (; m > 0; m >>= 1)
+  {
+    if (m & 1)
+      power *= x;
+    x *= x;
+  }
+  return (n < 0) ? 1 / power : power;
+}
+
+void genPower(Type *type, CodeAddress baseStart, CodeAddress exponentStart)
+{
+  int isFloat = (type->typeClass == TP_FLOAT);
+  ConstantValue *base = constantOperand(baseStart, exponentStart);
+  ConstantValue *exponent = constantOperand(exponentStart, getCurrentCodeAddress());
+  WORD result;
+
+  if ((base != NULL) && (exponent != NULL) && isFloat)
+  {
+    truncateCode(baseStart);
+    genLCF(foldPowerFloat(floatOf(base), exponent->intValue));
+    foldedOperations++;
+  }
+  else if ((base != NULL) && (exponent != NULL) && foldPower(base->intValue, exponent->intValue, &result))
+  {
+    truncateCode(baseStart);
+    genLC(result);
+    foldedOperations++;
+  }
+  else if (isValue(exponent, 1))
+  {
+    truncateCode(exponentStart);
+    foldedOperations++;
+  }
+  else if (isValue(exponent, 0) && isPure(baseStart, exponentStart))
+  {
+    truncateCode(baseStart);
+    if (isFloat)
+      genLCF(1);
+    else
+      genLC(1);
+    foldedOperations++;
+  }
+  else if (!isFloat && (exponent != NULL) && (exponent->intValue >= 2) && (exponent->intValue <= POWER_CHAIN_LIMIT))
+  {
+    truncateCode(exponentStart);
+    genPowerChain(exponent->intValue);
+  }
+  else if (isFloat)
+    emitted(emitPWF(codeBlock));
+  else
+    emitted(emitPW(codeBlock));
+
+  free(base);
+  free(exponent);
+}
+
+/*
+ * Adds the index, whose code starts at index, times size to the address of
+ * an array element. A constant index goes into the LA at base when nothing
+ * has been added to it yet: a(.2.) is just an LA.
+ */
+void genArrayIndex(CodeAddress base, CodeAddress index, int size)
+{
+  ConstantValue *value;
+  CodeAddress sizeStart;
+
+  if (size != 1)
+  {
+    sizeStart = getCurrentCodeAddress();
+    genLC(size);
+    genArith(SB_TIMES, intType, index, intType, sizeStart);
+  }
+
+  value = constantOperand(index, getCurrentCodeAddress());
+  if ((value != NULL) && (index == base + 1))
+  {
+    truncateCode(index);
+    updateLA(base, value->intValue);
+    foldedOperations++;
+  }
+  else
+    genAD();
+  free(value);
+}
+
+int getFoldedOperations(void)
+{
+  return foldedOperations;
+}
+
+/******************* Instructions ******************************/
+
+void genLA(int level, int offset)
+{
+  emitted(emitLA(codeBlock, level, offset));
+}
+
+void genLV(int level, int offset)
+{
+  emitted(emitLV(codeBlock, level, offset));
+}
+
+void genLC(WORD constant)
+{
+  emitted(emitLC(codeBlock, constant));
+}
+
+void genLCF(double constant)
+{
+  emitted(emitLCF(codeBlock, constant));
+}
+
+void genLI(void)
+{
+  emitted(emitLI(codeBlock));
+}
+
+void genINT(int delta)
+{
+  emitted(emitINT(codeBlock, delta));
+}
+
+void genDCT(int delta)
+{
+  emitted(emitDCT(codeBlock, delta));
+}
+
+void genJ(CodeAddress label)
+{
+  emitted(emitJ(codeBlock, label));
+}
+
+void genFJ(CodeAddress label)
+{
+  emitted(emitFJ(codeBlock, label));
+}
+
+void genHL(void)
+{
+  emitted(emitHL(codeBlock));
+}
+
+void genST(void)
+{
+  emitted(emitST(codeBlock));
+}
+
+void genCALL(int level, CodeAddress label)
+{
+  emitted(emitCALL(codeBlock, level, label));
+}
+
+void genEP(void)
+{
+  emitted(emitEP(codeBlock));
+}
+
+void genEF(void)
+{
+  emitted(emitEF(codeBlock));
+}
+
+void genEFF(int offset)
+{
+  emitted(emitEFF(codeBlock, offset));
+}
+
+void genAD(void)
+{
+  emitted(emitAD(codeBlock));
+}
+
+void genADF(void)
+{
+  emitted(emitADF(codeBlock));
+}
+
+void genSB(void)
+{
+  emitted(emitSB(codeBlock));
+}
+
+void genML(void)
+{
+  emitted(emitML(codeBlock));
+}
+
+void genCV(void)
+{
+  emitted(emitCV(codeBlock));
+}
+
+void genEQ(void)
+{
+  emitted(emitEQ(codeBlock));
+}
+
+void updateJ(CodeAddress jmp, CodeAddress label)
+{
+  codeBlock->code[jmp].q = label;
+}
+
+// Jumps chained through their q, the last one's being -1
+void updateJChain(CodeAddress chain, CodeAddress label)
+{
+  CodeAddress next;
+
+  while (chain >= 0)
+  {
+    next = codeBlock->code[chain].q;
+    codeBlock->code[chain].q = label;
+    chain = next;
+  }
+}
+
+void updateFJ(CodeAddress jmp, CodeAddress label)
+{
+  codeBlock->code[jmp].q = label;
+}
+
+void updateINT(CodeAddress frame, int delta)
+{
+  codeBlock->code[frame].q = delta;
+}
+
+// Moves the address loaded by an LA by delta words
+void updateLA(CodeAddress address, int delta)
+{
+  codeBlock->code[address].q += delta;
+}
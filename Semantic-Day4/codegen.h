@@ -0,0 +1,83 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __CODEGEN_H__
+#define __CODEGEN_H__
+
+#include "token.h"
+#include "symtab.h"
+#include "instructions.h"
+
+#define CODE_SIZE 10000
+
+void initCodeBuffer(void);
+void cleanCodeBuffer(void);
+void printCodeBuffer(void);
+void setOptimizeLevel(int level);
+void optimizeCodeBuffer(void);
+int getFoldedOperations(void);
+int serialize(char *fileName);
+
+CodeAddress getCurrentCodeAddress(void);
+int computeNestedLevel(Scope *scope);
+
+int isPredefinedFunction(Object *func);
+int isPredefinedProcedure(Object *proc);
+
+// Addresses and values of the objects of the program
+void genVariableAddress(Object *var);
+void genVariableValue(Object *var);
+void genParameterAddress(Object *param);
+void genParameterValue(Object *param);
+void genReturnValueAddress(Object *func);
+void genValue(Type *type, int level, int offset);
+void genConstant(ConstantValue *value);
+
+void genPredefinedProcedureCall(Object *proc);
+void genPredefinedFunctionCall(Object *func);
+void genProcedureCall(Object *proc);
+void genFunctionCall(Object *func);
+void genWriteString(char *str);
+
+// The instruction that fits the type of the operands; an operand is given by where its code starts
+void genLoad(Type *type);
+void genStore(Type *type);
+void genConvert(Type *to, Type *from);
+Type *genArith(TokenType op, Type *left, CodeAddress leftStart, Type *right, CodeAddress rightStart);
+void genCompare(TokenType op, Type *left, CodeAddress leftStart, Type *right, CodeAddress rightStart);
+void genNegate(Type *type, CodeAddress start);
+void genPower(Type *type, CodeAddress baseStart, CodeAddress exponentStart);
+void genArrayIndex(CodeAddress base, CodeAddress index, int size);
+
+void genLA(int level, int offset);
+void genLV(int level, int offset);
+void genLC(WORD constant);
+void genLCF(double constant);
+void genLI(void);
+void genINT(int delta);
+void genDCT(int delta);
+void genJ(CodeAddress label);
+void genFJ(CodeAddress label);
+void genHL(void);
+void genST(void);
+void genCALL(int level, CodeAddress label);
+void genEP(void);
+void genEF(void);
+void genEFF(int offset);
+void genAD(void);
+void genADF(void);
+void genSB(void);
+void genML(void);
+void genCV(void);
+void genEQ(void);
+
+void updateJ(CodeAddress jmp, CodeAddress label);
+void updateJChain(CodeAddress chain, CodeAddress label);
+void updateFJ(CodeAddress jmp, CodeAddress label);
+void updateINT(CodeAddress frame, int delta);
+void updateLA(CodeAddress address, int delta);
+
+#endif
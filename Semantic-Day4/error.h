@@ -46,7 +46,10 @@ typedef enum
   ERR_INVALID_CONSTANT_STRING,
 
   // Loi phan tu khong bang nhau
-  ERR_NUMBER_OF_ELEMENTS
+  ERR_NUMBER_OF_ELEMENTS,
+
+  // Khong sinh ma duoc
+  ERR_NOT_SUPPORTED
 } ErrorCode;
 
 void error(ErrorCode err, int lineNo, int colNo);
@@ -0,0 +1,217 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+
+int isBranch(enum OpCode op)
+{
+  return (op == OP_J) || (op == OP_FJ);
+}
+
+int isExit(enum OpCode op)
+{
+  return (op == OP_HL) || (op == OP_EP) || (op == OP_EF) || (op == OP_EFF);
+}
+
+static int hasTarget(enum OpCode op)
+{
+  return isBranch(op) || (op == OP_CALL);
+}
+
+/*
+ * A block starts at the start of the code, at every target of a jump or a
+ * call, and after every jump or exit.
+ */
+IR *buildIR(CodeBlock *codeBlock)
+{
+  Instruction *code = codeBlock->code;
+  int codeSize = codeBlock->codeSize;
+  IR *ir = (IR *)malloc(sizeof(IR));
+  char *leader = (char *)calloc(codeSize + 1, 1);
+  int *blockOf = (int *)malloc((codeSize + 1) * sizeof(int));
+  int i, k;
+
+  leader[0] = 1;
+  for (i = 0; i < codeSize; i++)
+  {
+    if (hasTarget(code[i].op) && (code[i].q >= 0) && (code[i].q < codeSize))
+      leader[code[i].q] = 1;
+    if (isBranch(code[i].op) || isExit(code[i].op))
+      leader[i + 1] = 1;
+  }
+
+  ir->blockCount = 0;
+  for (i = 0; i < codeSize; i++)
+  {
+    if (leader[i])
+      ir->blockCount++;
+    blockOf[i] = ir->blockCount - 1;
+  }
+  blockOf[codeSize] = ir->blockCount;
+
+  ir->blocks = (BasicBlock *)calloc(ir->blockCount + 1, sizeof(BasicBlock));
+  for (i = 0; i < codeSize; i = k)
+  {
+    BasicBlock *block = &ir->blocks[blockOf[i]];
+
+    for (k = i + 1; (k < codeSize) && !leader[k]; k++)
+      ;
+    block->address = i;
+    block->codeSize = k - i;
+    block->code = (Instruction *)malloc(block->codeSize * sizeof(Instruction));
+    memcpy(block->code, code + i, block->codeSize * sizeof(Instruction));
+    block->reachable = 1;
+  }
+
+  for (i = 0; i < ir->blockCount; i++)
+    for (k = 0; k < ir->blocks[i].codeSize; k++)
+    {
+      Instruction *inst = &ir->blocks[i].code[k];
+
+      if (hasTarget(inst->op) && (inst->q >= 0) && (inst->q <= codeSize))
+        inst->q = blockOf[inst->q];
+    }
+
+  free(leader);
+  free(blockOf);
+  return ir;
+}
+
+// Lays the reachable blocks out in their order, jumps and calls get addresses again
+void lowerIR(IR *ir, CodeBlock *codeBlock)
+{
+  int address = 0;
+  int i, k;
+
+  findReachable(ir);
+  for (i = 0; i <= ir->blockCount; i++)
+  {
+    ir->blocks[i].address = address;
+    if ((i < ir->blockCount) && ir->blocks[i].reachable)
+      address += ir->blocks[i].codeSize;
+  }
+
+  codeBlock->codeSize = 0;
+  for (i = 0; i < ir->blockCount; i++)
+  {
+    if (!ir->blocks[i].reachable)
+      continue;
+    for (k = 0; k < ir->blocks[i].codeSize; k++)
+    {
+      Instruction inst = ir->blocks[i].code[k];
+
+      if (hasTarget(inst.op))
+        inst.q = ir->blocks[inst.q].address;
+      emitCode(codeBlock, inst.op, inst.p, inst.q);
+    }
+  }
+}
+
+void freeIR(IR *ir)
+{
+  int i;
+
+  for (i = 0; i < ir->blockCount; i++)
+    free(ir->blocks[i].code);
+  free(ir->blocks);
+  free(ir);
+}
+
+int countInstructions(IR *ir)
+{
+  int count = 0;
+  int i;
+
+  for (i = 0; i < ir->blockCount; i++)
+    count += ir->blocks[i].codeSize;
+  return count;
+}
+
+// Takes the deleted instructions out; returns how many there were
+int compactIR(IR *ir)
+{
+  int removed = 0;
+  int i, k, n;
+
+  for (i = 0; i < ir->blockCount; i++)
+  {
+    BasicBlock *block = &ir->blocks[i];
+
+    for (k = 0, n = 0; k < block->codeSize; k++)
+      if (block->code[k].op != OP_DELETED)
+        block->code[n++] = block->code[k];
+    removed += block->codeSize - n;
+    block->codeSize = n;
+  }
+  return removed;
+}
+
+Instruction *lastInstruction(BasicBlock *block)
+{
+  int k;
+
+  for (k = block->codeSize - 1; k >= 0; k--)
+    if (block->code[k].op != OP_DELETED)
+      return &block->code[k];
+  return NULL;
+}
+
+static void reach(IR *ir, int n, int *work, int *top)
+{
+  if ((n < ir->blockCount) && !ir->blocks[n].reachable)
+  {
+    ir->blocks[n].reachable = 1;
+    work[(*top)++] = n;
+  }
+}
+
+/*
+ * Marks the blocks that can run: from the first one, along jumps and
+ * fall-throughs, and into every routine called from a block that can run.
+ * Returns how many blocks can run.
+ */
+int findReachable(IR *ir)
+{
+  int *work = (int *)malloc((ir->blockCount + 1) * sizeof(int));
+  int count = 0;
+  int top = 0;
+  int i, k;
+
+  for (i = 0; i < ir->blockCount; i++)
+    ir->blocks[i].reachable = 0;
+
+  reach(ir, 0, work, &top);
+  while (top > 0)
+  {
+    BasicBlock *block = &ir->blocks[work[--top]];
+    Instruction *last = lastInstruction(block);
+    int next = (int)(block - ir->blocks) + 1;
+
+    count++;
+    for (k = 0; k < block->codeSize; k++)
+      if (block->code[k].op == OP_CALL)
+        reach(ir, block->code[k].q, work, &top);
+
+    if (last == NULL)
+      reach(ir, next, work, &top);
+    else if (last->op == OP_J)
+      reach(ir, last->q, work, &top);
+    else if (last->op == OP_FJ)
+    {
+      reach(ir, last->q, work, &top);
+      reach(ir, next, work, &top);
+    }
+    else if (!isExit(last->op))
+      reach(ir, next, work, &top);
+  }
+
+  free(work);
+  return count;
+}
@@ -0,0 +1,52 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __IR_H__
+#define __IR_H__
+
+#include "instructions.h"
+
+/*
+ * The program as a control flow graph of basic blocks, for the optimizer.
+ * The blocks keep the instructions of the stack machine, in the order of
+ * the code they were cut from. In a block, J, FJ and CALL hold the index
+ * of the block they go to instead of a code address; a block that does not
+ * end with a jump or an exit goes on with the next one.
+ */
+
+// An instruction taken out by a pass; blocks are compacted between passes
+#define OP_DELETED ((enum OpCode) NUM_OF_OPCODES)
+
+struct BasicBlock_
+{
+  Instruction *code;
+  int codeSize;
+  int address; // in the code the block was cut from, then in the lowered code
+  int reachable;
+};
+
+typedef struct BasicBlock_ BasicBlock;
+
+struct IR_
+{
+  BasicBlock *blocks;
+  int blockCount;
+};
+
+typedef struct IR_ IR;
+
+IR *buildIR(CodeBlock *codeBlock);
+void lowerIR(IR *ir, CodeBlock *codeBlock);
+void freeIR(IR *ir);
+
+int isBranch(enum OpCode op);
+int isExit(enum OpCode op);
+int countInstructions(IR *ir);
+int compactIR(IR *ir);
+int findReachable(IR *ir);
+Instruction *lastInstruction(BasicBlock *block);
+
+#endif
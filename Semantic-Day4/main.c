@@ -6,25 +6,85 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "reader.h"
 #include "parser.h"
+#include "codegen.h"
+#include "optimize.h"
 
 /******************************************************************/
 
+int dumpCode = 0;
+int optimizeLevel = 0;
+int printReport = 0;
+
+void printUsage(void)
+{
+  printf("Usage: kplc input [output] [-dump] [-O0|-O1|-O2] [-stat]\n");
+  printf("   input: input kpl program\n");
+  printf("   output: executable for kplrun; without it the code is printed\n");
+  printf("   -dump: print the code\n");
+  printf("   -O0: no optimization (default)\n");
+  printf("   -O1: constant propagation, unreachable branches and dead code, once\n");
+  printf("   -O2: the passes of -O1 and jump threading, until they change nothing\n");
+  printf("   -stat: print the compile report on stderr\n");
+}
+
 int main(int argc, char *argv[])
 {
-  if (argc <= 1)
+  char *inputFile = NULL;
+  char *outputFile = NULL;
+  int i;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-dump") == 0)
+      dumpCode = 1;
+    else if ((strncmp(argv[i], "-O", 2) == 0) && (argv[i][2] >= '0') && (argv[i][2] <= '2') && (argv[i][3] == '\0'))
+      optimizeLevel = argv[i][2] - '0';
+    else if (strcmp(argv[i], "-stat") == 0)
+      printReport = 1;
+    else if (inputFile == NULL)
+      inputFile = argv[i];
+    else if (outputFile == NULL)
+      outputFile = argv[i];
+    else
+    {
+      printUsage();
+      return -1;
+    }
+  }
+
+  if (inputFile == NULL)
   {
-    printf("parser: no input file.\n");
+    printf("kplc: no input file.\n");
+    printUsage();
     return -1;
   }
 
-  if (compile(argv[1]) == IO_ERROR)
+  initCodeBuffer();
+  setOptimizeLevel(optimizeLevel);
+
+  if (compile(inputFile) == IO_ERROR)
   {
     printf("Can\'t read input file!\n");
     return -1;
   }
 
+  optimizeCodeBuffer();
+  if (printReport)
+    printOptimizeReport(stderr, getFoldedOperations());
+
+  if ((outputFile == NULL) || dumpCode)
+    printCodeBuffer();
+
+  if ((outputFile != NULL) && (serialize(outputFile) == IO_ERROR))
+  {
+    printf("Can\'t write output file!\n");
+    return -1;
+  }
+
+  cleanCodeBuffer();
   return 0;
 }
@@ -0,0 +1,597 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "optimize.h"
+
+#define MAX_VALUES 256
+#define MAX_FACTS 64
+
+enum ValueKind
+{
+  VALUE_UNKNOWN,
+  VALUE_CONSTANT,
+  VALUE_ADDRESS
+};
+
+// What is known of a word of the stack, and which LC pushed it, if any
+struct StackValue_
+{
+  enum ValueKind kind;
+  WORD value;
+  WORD p;
+  WORD q;
+  int producer;
+};
+
+typedef struct StackValue_ StackValue;
+
+// The word at (p, q) holds value
+struct Fact_
+{
+  WORD p;
+  WORD q;
+  WORD value;
+};
+
+typedef struct Fact_ Fact;
+
+/*
+ * What a block knows while it is scanned. The stack starts empty: the
+ * words left by the blocks before are unknown, and so is everything below
+ * a call.
+ */
+struct BlockState_
+{
+  StackValue values[MAX_VALUES];
+  int top;
+  Fact facts[MAX_FACTS];
+  int factCount;
+};
+
+typedef struct BlockState_ BlockState;
+
+static int levelRun;
+static int sizeBefore;
+static int sizeAfter;
+
+/******************* Abstract stack ******************************/
+
+static void pushValue(BlockState *state, StackValue value)
+{
+  // Forgetting is always safe
+  if (state->top == MAX_VALUES)
+    state->top = 0;
+  state->values[state->top++] = value;
+}
+
+static void push(BlockState *state, enum ValueKind kind, WORD value, int producer)
+{
+  StackValue v = {kind, value, 0, 0, producer};
+
+  pushValue(state, v);
+}
+
+static void pushAddress(BlockState *state, WORD p, WORD q)
+{
+  StackValue v = {VALUE_ADDRESS, 0, p, q, -1};
+
+  pushValue(state, v);
+}
+
+static void pushUnknown(BlockState *state, int count)
+{
+  while (count-- > 0)
+    push(state, VALUE_UNKNOWN, 0, -1);
+}
+
+static StackValue pop(BlockState *state)
+{
+  StackValue unknown = {VALUE_UNKNOWN, 0, 0, 0, -1};
+
+  if (state->top == 0)
+    return unknown;
+  return state->values[--state->top];
+}
+
+static void popWords(BlockState *state, int count)
+{
+  while (count-- > 0)
+    pop(state);
+}
+
+static Fact *findFact(BlockState *state, WORD p, WORD q)
+{
+  int i;
+
+  for (i = 0; i < state->factCount; i++)
+    if ((state->facts[i].p == p) && (state->facts[i].q == q))
+      return &state->facts[i];
+  return NULL;
+}
+
+// Words [q, q + size) of the frame p are written
+static void killFacts(BlockState *state, WORD p, WORD q, int size)
+{
+  int i = 0;
+
+  while (i < state->factCount)
+  {
+    Fact *fact = &state->facts[i];
+
+    if ((fact->p == p) && (fact->q >= q) && (fact->q < q + size))
+      *fact = state->facts[--state->factCount];
+    else
+      i++;
+  }
+}
+
+static void addFact(BlockState *state, WORD p, WORD q, WORD value)
+{
+  if (state->factCount == MAX_FACTS)
+    return;
+  state->facts[state->factCount].p = p;
+  state->facts[state->factCount].q = q;
+  state->facts[state->factCount].value = value;
+  state->factCount++;
+}
+
+// A store to an address that is not known may write any word
+static void storeTo(BlockState *state, StackValue *address, int size)
+{
+  if (address->kind == VALUE_ADDRESS)
+    killFacts(state, address->p, address->q, size);
+  else
+    state->factCount = 0;
+}
+
+/******************* Constant propagation ******************************/
+
+// x ** n as PW does it, wrapping like n multiplications; 0 for 0 to a negative power
+int foldPower(WORD x, WORD n, WORD *result)
+{
+  unsigned base = x;
+  unsigned power = 1;
+
+  if (n < 0)
+  {
+    if (x == 0)
+      return 0;
+    if (x == -1)
+      power = (n & 1) ? base : 1;
+    else if (x != 1)
+      power = 0;
+  }
+  else
+    for (; n > 0; n >>= 1)
+    {
+      if (n & 1)
+        power *= base;
+      base *= base;
+    }
+  *result = (WORD)power;
+  return 1;
+}
+
+// Returns 0 when the operation is left to run time: division by zero and overflow trap there
+static int fold(enum OpCode op, WORD a, WORD b, WORD *result)
+{
+  switch (op)
+  {
+  case OP_AD:
+    *result = (WORD)((unsigned)a + (unsigned)b);
+    return 1;
+  case OP_SB:
+    *result = (WORD)((unsigned)a - (unsigned)b);
+    return 1;
+  case OP_ML:
+    *result = (WORD)((unsigned)a * (unsigned)b);
+    return 1;
+  case OP_DV:
+    if ((b == 0) || ((a == INT_MIN) && (b == -1)))
+      return 0;
+    *result = a / b;
+    return 1;
+  case OP_PW:
+    return foldPower(a, b, result);
+  case OP_EQ:
+    *result = (a == b);
+    return 1;
+  case OP_NE:
+    *result = (a != b);
+    return 1;
+  case OP_GT:
+    *result = (a > b);
+    return 1;
+  case OP_LT:
+    *result = (a < b);
+    return 1;
+  case OP_GE:
+    *result = (a >= b);
+    return 1;
+  case OP_LE:
+    *result = (a <= b);
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static int isFoldable(StackValue *value)
+{
+  return (value->kind == VALUE_CONSTANT) && (value->producer >= 0);
+}
+
+static void makeConstant(Instruction *inst, WORD value)
+{
+  inst->op = OP_LC;
+  inst->p = DC_VALUE;
+  inst->q = value;
+}
+
+/*
+ * Follows the values through the stack of each block. An operation on
+ * constants pushed by LC becomes one LC, and the LCs go. A variable stored
+ * with a constant is read as that constant until the block writes it again,
+ * stores through an address it does not know, or calls.
+ */
+static int propagateConstants(IR *ir)
+{
+  BlockState *state = (BlockState *)malloc(sizeof(BlockState));
+  int changes = 0;
+  int i, k;
+
+  for (i = 0; i < ir->blockCount; i++)
+  {
+    BasicBlock *block = &ir->blocks[i];
+
+    state->top = 0;
+    state->factCount = 0;
+    for (k = 0; k < block->codeSize; k++)
+    {
+      Instruction *inst = &block->code[k];
+      StackValue a, b;
+      Fact *fact;
+      WORD result;
+
+      if (inst->op == OP_DELETED)
+        continue;
+      switch (inst->op)
+      {
+      case OP_LA:
+        pushAddress(state, inst->p, inst->q);
+        break;
+      case OP_LV:
+        fact = findFact(state, inst->p, inst->q);
+        if (fact != NULL)
+        {
+          makeConstant(inst, fact->value);
+          push(state, VALUE_CONSTANT, fact->value, k);
+          changes++;
+        }
+        else
+          pushUnknown(state, 1);
+        break;
+      case OP_LC:
+        push(state, VALUE_CONSTANT, inst->q, k);
+        break;
+      case OP_CV:
+        a = pop(state);
+        pushValue(state, a);
+        if (a.kind == VALUE_CONSTANT)
+        {
+          makeConstant(inst, a.value);
+          push(state, VALUE_CONSTANT, a.value, k);
+          changes++;
+        }
+        else
+        {
+          a.producer = -1;
+          pushValue(state, a);
+        }
+        break;
+      case OP_AD:
+      case OP_SB:
+      case OP_ML:
+      case OP_DV:
+      case OP_PW:
+      case OP_EQ:
+      case OP_NE:
+      case OP_GT:
+      case OP_LT:
+      case OP_GE:
+      case OP_LE:
+        b = pop(state);
+        a = pop(state);
+        if (isFoldable(&a) && isFoldable(&b) && fold(inst->op, a.value, b.value, &result))
+        {
+          block->code[a.producer].op = OP_DELETED;
+          block->code[b.producer].op = OP_DELETED;
+          makeConstant(inst, result);
+          push(state, VALUE_CONSTANT, result, k);
+          changes++;
+        }
+        else
+          pushUnknown(state, 1);
+        break;
+      case OP_NEG:
+        a = pop(state);
+        if (isFoldable(&a))
+        {
+          block->code[a.producer].op = OP_DELETED;
+          makeConstant(inst, (WORD)(0u - (unsigned)a.value));
+          push(state, VALUE_CONSTANT, inst->q, k);
+          changes++;
+        }
+        else
+          pushUnknown(state, 1);
+        break;
+      case OP_ST:
+        b = pop(state);
+        a = pop(state);
+        storeTo(state, &a, 1);
+        if ((a.kind == VALUE_ADDRESS) && (b.kind == VALUE_CONSTANT))
+          addFact(state, a.p, a.q, b.value);
+        break;
+      case OP_STF:
+        popWords(state, DOUBLE_SIZE);
+        a = pop(state);
+        storeTo(state, &a, DOUBLE_SIZE);
+        break;
+      case OP_MVB:
+      case OP_FLB:
+        pop(state);
+        a = pop(state);
+        storeTo(state, &a, inst->q);
+        break;
+      case OP_LI:
+        popWords(state, 1);
+        pushUnknown(state, 1);
+        break;
+      case OP_LIF:
+        popWords(state, 1);
+        pushUnknown(state, DOUBLE_SIZE);
+        break;
+      case OP_INT:
+      case OP_DCT:
+        if ((inst->op == OP_INT) == (inst->q >= 0))
+          pushUnknown(state, abs(inst->q));
+        else
+          popWords(state, abs(inst->q));
+        break;
+      case OP_FJ:
+      case OP_WRC:
+      case OP_WRI:
+        popWords(state, 1);
+        break;
+      case OP_RC:
+      case OP_RI:
+        pushUnknown(state, 1);
+        break;
+      case OP_LCF:
+      case OP_LVF:
+      case OP_RF:
+        pushUnknown(state, DOUBLE_SIZE);
+        break;
+      case OP_WRF:
+        popWords(state, DOUBLE_SIZE);
+        break;
+      case OP_ADF:
+      case OP_SBF:
+      case OP_MLF:
+      case OP_DVF:
+        popWords(state, 2 * DOUBLE_SIZE);
+        pushUnknown(state, DOUBLE_SIZE);
+        break;
+      case OP_NEGF:
+        popWords(state, DOUBLE_SIZE);
+        pushUnknown(state, DOUBLE_SIZE);
+        break;
+      case OP_PWF:
+        popWords(state, DOUBLE_SIZE + 1);
+        pushUnknown(state, DOUBLE_SIZE);
+        break;
+      case OP_EQF:
+      case OP_NEF:
+      case OP_GTF:
+      case OP_LTF:
+      case OP_GEF:
+      case OP_LEF:
+        popWords(state, 2 * DOUBLE_SIZE);
+        pushUnknown(state, 1);
+        break;
+      case OP_CVIF:
+        popWords(state, inst->q + 1);
+        pushUnknown(state, inst->q + DOUBLE_SIZE);
+        break;
+      case OP_CVFI:
+        popWords(state, DOUBLE_SIZE);
+        pushUnknown(state, 1);
+        break;
+      case OP_J:
+      case OP_WLN:
+      case OP_BP:
+        break;
+      default:
+        // Calls, exits, and whatever else: nothing is known after them
+        state->top = 0;
+        state->factCount = 0;
+        break;
+      }
+    }
+  }
+  free(state);
+  return changes;
+}
+
+/******************* Unreachable branches ******************************/
+
+// LC c; FJ l is a jump when c is 0, and nothing otherwise
+static int removeConstantBranches(IR *ir)
+{
+  int changes = 0;
+  int i, k;
+
+  for (i = 0; i < ir->blockCount; i++)
+  {
+    BasicBlock *block = &ir->blocks[i];
+    Instruction *last = lastInstruction(block);
+    Instruction *condition = NULL;
+
+    if ((last == NULL) || (last->op != OP_FJ))
+      continue;
+    for (k = (int)(last - block->code) - 1; k >= 0; k--)
+      if (block->code[k].op != OP_DELETED)
+      {
+        condition = &block->code[k];
+        break;
+      }
+    if ((condition == NULL) || (condition->op != OP_LC))
+      continue;
+
+    if (condition->q == 0)
+      last->op = OP_J;
+    else
+      last->op = OP_DELETED;
+    condition->op = OP_DELETED;
+    changes++;
+  }
+  return changes;
+}
+
+/******************* Dead code ******************************/
+
+// The first block at or after n that has code and runs; blockCount if none
+static int nextLiveBlock(IR *ir, int n)
+{
+  while ((n < ir->blockCount) && (!ir->blocks[n].reachable || (ir->blocks[n].codeSize == 0)))
+    n++;
+  return n;
+}
+
+// Blocks that never run go, and so do jumps to where the code goes on anyway
+static int eliminateDeadCode(IR *ir)
+{
+  int changes = 0;
+  int i;
+
+  findReachable(ir);
+  for (i = 0; i < ir->blockCount; i++)
+    if (!ir->blocks[i].reachable)
+    {
+      changes += ir->blocks[i].codeSize;
+      ir->blocks[i].codeSize = 0;
+    }
+
+  for (i = 0; i < ir->blockCount; i++)
+  {
+    Instruction *last = lastInstruction(&ir->blocks[i]);
+
+    if ((last != NULL) && ir->blocks[i].reachable && (last->op == OP_J)
+        && (nextLiveBlock(ir, last->q) == nextLiveBlock(ir, i + 1)))
+    {
+      last->op = OP_DELETED;
+      changes++;
+    }
+  }
+  return changes;
+}
+
+/******************* Jump threading ******************************/
+
+// A jump to a J goes where that J goes
+static int threadJumps(IR *ir)
+{
+  int changes = 0;
+  int i;
+
+  findReachable(ir);
+  for (i = 0; i < ir->blockCount; i++)
+  {
+    Instruction *last = lastInstruction(&ir->blocks[i]);
+    int steps = 0;
+    int target;
+
+    if ((last == NULL) || !isBranch(last->op))
+      continue;
+    for (;;)
+    {
+      target = nextLiveBlock(ir, last->q);
+      if ((target == ir->blockCount) || (ir->blocks[target].code[0].op != OP_J)
+          || (ir->blocks[target].code[0].q == last->q) || (steps++ == ir->blockCount))
+        break;
+      last->q = ir->blocks[target].code[0].q;
+      changes++;
+    }
+  }
+  return changes;
+}
+
+/******************* Pass manager ******************************/
+
+static Pass passes[] = {
+    {"constant propagation", 1, propagateConstants, 0},
+    {"unreachable branches", 1, removeConstantBranches, 0},
+    {"dead code", 1, eliminateDeadCode, 0},
+    {"jump threading", 2, threadJumps, 0}};
+
+#define NUM_OF_PASSES (sizeof(passes) / sizeof(passes[0]))
+
+/*
+ * Optimizes the code at the given -O level: 0 leaves it as it is, 1 runs
+ * each pass once, 2 runs them again while they change something.
+ */
+void optimize(CodeBlock *codeBlock, int level)
+{
+  IR *ir;
+  int changed;
+  int rounds = 0;
+  int i;
+
+  levelRun = level;
+  sizeBefore = codeBlock->codeSize;
+  sizeAfter = codeBlock->codeSize;
+  if (level <= 0)
+    return;
+
+  ir = buildIR(codeBlock);
+  do
+  {
+    changed = 0;
+    for (i = 0; i < NUM_OF_PASSES; i++)
+    {
+      int changes;
+
+      if (passes[i].level > level)
+        continue;
+      changes = passes[i].run(ir);
+      compactIR(ir);
+      passes[i].changes += changes;
+      changed += changes;
+    }
+    rounds++;
+  } while ((level >= 2) && (changed > 0) && (rounds < MAX_ROUNDS));
+
+  lowerIR(ir, codeBlock);
+  freeIR(ir);
+  sizeAfter = codeBlock->codeSize;
+}
+
+// folded is what the code generator has already done before the passes
+void printOptimizeReport(FILE *f, int folded)
+{
+  int i;
+
+  fprintf(f, "kplc: %d instructions, %d after -O%d\n", sizeBefore, sizeAfter, levelRun);
+  if (levelRun >= 1)
+    fprintf(f, "  constant folding: %d operations removed\n", folded);
+  for (i = 0; i < NUM_OF_PASSES; i++)
+    if (passes[i].level <= levelRun)
+      fprintf(f, "  %s: %d\n", passes[i].name, passes[i].changes);
+}
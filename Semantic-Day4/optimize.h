@@ -0,0 +1,33 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __OPTIMIZE_H__
+#define __OPTIMIZE_H__
+
+#include <stdio.h>
+
+#include "ir.h"
+
+// -O2 runs the passes again while they still find something to do
+#define MAX_ROUNDS 8
+
+typedef int (*PassFunction)(IR *ir);
+
+struct Pass_
+{
+  char *name;
+  int level; // the lowest -O level that runs it
+  PassFunction run;
+  int changes;
+};
+
+typedef struct Pass_ Pass;
+
+void optimize(CodeBlock *codeBlock, int level);
+int foldPower(WORD x, WORD n, WORD *result);
+void printOptimizeReport(FILE *f, int folded);
+
+#endif
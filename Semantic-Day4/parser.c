@@ -5,13 +5,14 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "reader.h"
 #include "scanner.h"
 #include "parser.h"
 #include "semantics.h"
 #include "error.h"
-#include "debug.h"
+#include "codegen.h"
 
 Token *currentToken;
 Token *lookAhead;
@@ -60,6 +61,8 @@ void compileProgram(void)
   compileBlock();
   eat(SB_PERIOD);
 
+  genHL();
+
   exitBlock();
 }
 
@@ -158,8 +161,20 @@ void compileBlock3(void)
 
 void compileBlock4(void)
 {
+  CodeAddress jmp;
+  CodeAddress frame;
+
+  // The code of the subroutines comes first, the block jumps over it
+  jmp = getCurrentCodeAddress();
+  genJ(DC_VALUE);
   compileSubDecls();
+  updateJ(jmp, getCurrentCodeAddress());
+
+  frame = getCurrentCodeAddress();
+  genINT(symtab->currentScope->frameSize);
   compileBlock5();
+  // The statements may have added temporaries to the frame
+  updateINT(frame, symtab->currentScope->frameSize);
 }
 
 void compileBlock5(void)
@@ -199,9 +214,17 @@ void compileFuncDecl(void)
   eat(SB_COLON);
   returnType = compileBasicType();
   funcObj->funcAttrs->returnType = returnType;
+  // A DOUBLE does not fit in the result word; it is returned from a local by EFF
+  if (returnType->typeClass == TP_FLOAT)
+    funcObj->funcAttrs->resultOffset = allocateLocal(symtab->currentScope, returnType);
 
   eat(SB_SEMICOLON);
+  funcObj->funcAttrs->codeAddress = getCurrentCodeAddress();
   compileBlock();
+  if (returnType->typeClass == TP_FLOAT)
+    genEFF(funcObj->funcAttrs->resultOffset);
+  else
+    genEF();
   eat(SB_SEMICOLON);
 
   exitBlock();
@@ -223,7 +246,9 @@ void compileProcDecl(void)
   compileParams();
 
   eat(SB_SEMICOLON);
+  procObj->procAttrs->codeAddress = getCurrentCodeAddress();
   compileBlock();
+  genEP();
   eat(SB_SEMICOLON);
 
   exitBlock();
@@ -517,6 +542,7 @@ void compileStatement(void)
   case SB_SEMICOLON:
   case KW_END:
   case KW_ELSE:
+  case KW_UNTIL:
   case KW_BREAK:
     break;
     // Error occurs
@@ -538,15 +564,18 @@ Type *compileLValue(void)
   switch (var->kind)
   {
   case OBJ_VARIABLE:
+    genVariableAddress(var);
     if (var->varAttrs->type->typeClass == TP_ARRAY)
       varType = compileIndexes(var->varAttrs->type);
     else
       varType = var->varAttrs->type;
     break;
   case OBJ_PARAMETER:
+    genParameterAddress(var);
     varType = var->paramAttrs->type;
     break;
   case OBJ_FUNCTION:
+    genReturnValueAddress(var);
     varType = var->funcAttrs->returnType;
     break;
   default:
@@ -576,9 +605,11 @@ Type *compileLValue(void)
 void compileAssignSt(void)
 {
   Type *varType[100];
-  Type *expressType[100];
+  Type *expressType;
+  int temp[100];
   int i = 0;
   int j = 0;
+  int k;
   while (1)
   {
     varType[i++] = compileLValue();
@@ -589,9 +620,30 @@ void compileAssignSt(void)
   }
 
   eat(SB_ASSIGN);
+  if (i == 1)
+  {
+    expressType = compileExpression();
+    checkTypeEquality(varType[0], expressType);
+    genConvert(varType[0], expressType);
+    genStore(varType[0]);
+    if (lookAhead->tokenType == SB_COMMA)
+      error(ERR_NUMBER_OF_ELEMENTS, lookAhead->lineNo, lookAhead->colNo);
+    return;
+  }
+
+  // All the values are computed before any variable changes: x, y := y, x
+  // keeps them in temporaries while the addresses wait on the stack
   while (1)
   {
-    expressType[j++] = compileExpression();
+    if (j == i)
+      error(ERR_NUMBER_OF_ELEMENTS, currentToken->lineNo, currentToken->colNo);
+    temp[j] = allocateLocal(symtab->currentScope, varType[j]);
+    genLA(0, temp[j]);
+    expressType = compileExpression();
+    checkTypeEquality(varType[j], expressType);
+    genConvert(varType[j], expressType);
+    genStore(varType[j]);
+    j++;
     if (lookAhead->tokenType == SB_COMMA)
       eat(SB_COMMA);
     else
@@ -599,15 +651,12 @@ void compileAssignSt(void)
   }
 
   if (i != j)
-  {
     error(ERR_NUMBER_OF_ELEMENTS, currentToken->lineNo, currentToken->colNo);
-  }
-  else
+
+  for (k = i - 1; k >= 0; k--)
   {
-    for (int k = 0; k < i; k++)
-    {
-      checkTypeEquality(varType[k], expressType[k]);
-    }
+    genValue(varType[k], 0, temp[k]);
+    genStore(varType[k]);
   }
 }
 
@@ -622,7 +671,50 @@ void compileCallSt(void)
 
   proc = checkDeclaredProcedure(currentToken->string);
 
-  compileArguments(proc->procAttrs->paramList);
+  if (isPredefinedProcedure(proc))
+  {
+    if (strcmp(proc->name, "WRITES") == 0)
+      compileStringArgument();
+    else
+    {
+      compileArguments(proc->procAttrs->paramList);
+      genPredefinedProcedureCall(proc);
+    }
+  }
+  else
+  {
+    genINT(RESERVED_WORDS);
+    compileArguments(proc->procAttrs->paramList);
+    genDCT(RESERVED_WORDS + proc->procAttrs->paramSize);
+    genProcedureCall(proc);
+  }
+}
+
+// The argument of WRITES: a string literal or a string constant
+void compileStringArgument(void)
+{
+  Object *obj;
+
+  eat(SB_LPAR);
+  switch (lookAhead->tokenType)
+  {
+  case TK_STRING:
+    eat(TK_STRING);
+    genWriteString(currentToken->stringNode);
+    break;
+  case TK_IDENT:
+    eat(TK_IDENT);
+    obj = checkDeclaredIdent(currentToken->string);
+    if ((obj->kind == OBJ_CONSTANT) && (obj->constAttrs->value->type == TP_STRING))
+      genWriteString(obj->constAttrs->value->stringValue);
+    else
+      error(ERR_NOT_SUPPORTED, currentToken->lineNo, currentToken->colNo);
+    break;
+  default:
+    error(ERR_NOT_SUPPORTED, lookAhead->lineNo, lookAhead->colNo);
+    break;
+  }
+  eat(SB_RPAR);
 }
 
 void compileGroupSt(void)
@@ -634,12 +726,26 @@ void compileGroupSt(void)
 
 void compileIfSt(void)
 {
+  CodeAddress fjInstruction;
+  CodeAddress jInstruction;
+
   eat(KW_IF);
   compileCondition();
   eat(KW_THEN);
+
+  fjInstruction = getCurrentCodeAddress();
+  genFJ(DC_VALUE);
   compileStatement();
   if (lookAhead->tokenType == KW_ELSE)
+  {
+    jInstruction = getCurrentCodeAddress();
+    genJ(DC_VALUE);
+    updateFJ(fjInstruction, getCurrentCodeAddress());
     compileElseSt();
+    updateJ(jInstruction, getCurrentCodeAddress());
+  }
+  else
+    updateFJ(fjInstruction, getCurrentCodeAddress());
 }
 
 void compileElseSt(void)
@@ -650,10 +756,18 @@ void compileElseSt(void)
 
 void compileWhileSt(void)
 {
+  CodeAddress beginWhile;
+  CodeAddress fjInstruction;
+
+  beginWhile = getCurrentCodeAddress();
   eat(KW_WHILE);
   compileCondition();
+  fjInstruction = getCurrentCodeAddress();
+  genFJ(DC_VALUE);
   eat(KW_DO);
   compileStatement();
+  genJ(beginWhile);
+  updateFJ(fjInstruction, getCurrentCodeAddress());
 }
 
 // TODO: Bai3
@@ -661,23 +775,69 @@ void compileSwitchSt(void)
 {
   Type *type;
   ConstantValue *constV;
+  CodeAddress value;
+  CodeAddress fjInstruction = -1;
+  CodeAddress fallThrough = -1;
+  CodeAddress start;
+  CodeAddress caseStart;
+  // The J of each break, chained through their q until END
+  CodeAddress breaks = -1;
+  CodeAddress jump;
+  int offset;
+
+  // The value is kept in a temporary, each case compares it to its constant
+  value = getCurrentCodeAddress();
+  genLA(0, 0);
   eat(KW_SWITCH);
   type = compileExpression();
+  offset = allocateLocal(symtab->currentScope, type);
+  updateLA(value, offset);
+  genStore(type);
   eat(SB_SEMICOLON);
   eat(KW_BEGIN);
   while (lookAhead->tokenType == KW_CASE)
   {
     eat(KW_CASE);
+    if (fjInstruction >= 0)
+      updateFJ(fjInstruction, getCurrentCodeAddress());
     constV = compileConstant();
     checkTypeEquality(type, &constV->type);
+    start = getCurrentCodeAddress();
+    genValue(type, 0, offset);
+    caseStart = getCurrentCodeAddress();
+    if ((type->typeClass == TP_FLOAT) && (constV->type == TP_INT))
+      genLCF(constV->intValue);
+    else
+      genConstant(constV);
+    genCompare(SB_EQ, type, start, type, caseStart);
+    fjInstruction = getCurrentCodeAddress();
+    genFJ(DC_VALUE);
+
+    // A case without break goes on with the statements of the next one
+    if (fallThrough >= 0)
+      updateJ(fallThrough, getCurrentCodeAddress());
+    fallThrough = -1;
+
     eat(SB_COLON);
     compileStatements();
     if (lookAhead->tokenType == KW_BREAK)
     {
       eat(KW_BREAK);
       eat(SB_SEMICOLON);
+      jump = getCurrentCodeAddress();
+      genJ(breaks);
+      breaks = jump;
+    }
+    else
+    {
+      fallThrough = getCurrentCodeAddress();
+      genJ(DC_VALUE);
     }
   }
+  if (fjInstruction >= 0)
+    updateFJ(fjInstruction, getCurrentCodeAddress());
+  if (fallThrough >= 0)
+    updateJ(fallThrough, getCurrentCodeAddress());
   if (lookAhead->tokenType == KW_DEFAULT)
   {
     eat(KW_DEFAULT);
@@ -688,6 +848,8 @@ void compileSwitchSt(void)
   }
   eat(KW_END);
   // eat(SB_SEMICOLON);
+
+  updateJChain(breaks, getCurrentCodeAddress());
 }
 
 void compileForSt(void)
@@ -695,32 +857,70 @@ void compileForSt(void)
   // TODO: Check type consistency of FOR's variable
   Type *varType;
   Type *type;
+  CodeAddress beginLoop;
+  CodeAddress fjInstruction;
 
   eat(KW_FOR);
 
   // checkDeclaredVariable(currentToken->string);
   varType = compileLValue();
+  checkBasicType(varType);
+  // The address of the variable stays on the stack for the whole loop
+  genCV();
 
   eat(SB_ASSIGN);
   type = compileExpression();
   checkTypeEquality(varType, type);
+  genConvert(varType, type);
+  genStore(varType);
+  genCV();
+  genLoad(varType);
 
+  beginLoop = getCurrentCodeAddress();
   eat(KW_TO);
   type = compileExpression();
   checkTypeEquality(varType, type);
+  genConvert(varType, type);
+  genCompare(SB_LE, varType, beginLoop, varType, beginLoop);
+  fjInstruction = getCurrentCodeAddress();
+  genFJ(DC_VALUE);
 
   eat(KW_DO);
   compileStatement();
+
+  genCV();
+  genCV();
+  genLoad(varType);
+  if (varType->typeClass == TP_FLOAT)
+  {
+    genLCF(1);
+    genADF();
+  }
+  else
+  {
+    genLC(1);
+    genAD();
+  }
+  genStore(varType);
+  genCV();
+  genLoad(varType);
+  genJ(beginLoop);
+  updateFJ(fjInstruction, getCurrentCodeAddress());
+  genDCT(1);
 }
 
 // ************* START UPDATE *************
 // Thêm Repeat - Until
 void compileRepeatSt(void)
 {
+  CodeAddress beginLoop;
+
   eat(KW_REPEAT);
+  beginLoop = getCurrentCodeAddress();
   compileStatement();
   eat(KW_UNTIL);
   compileCondition();
+  genFJ(beginLoop);
 }
 // ************* END UPDATE *************
 
@@ -728,10 +928,18 @@ void compileRepeatSt(void)
 // Thêm Do - while
 void compileDoWhileSt(void)
 {
+  CodeAddress beginLoop;
+  CodeAddress fjInstruction;
+
   eat(KW_DO);
+  beginLoop = getCurrentCodeAddress();
   compileStatement();
   eat(KW_WHILE);
   compileCondition();
+  fjInstruction = getCurrentCodeAddress();
+  genFJ(DC_VALUE);
+  genJ(beginLoop);
+  updateFJ(fjInstruction, getCurrentCodeAddress());
 }
 // ************* END UPDATE *************
 
@@ -742,13 +950,17 @@ void compileArgument(Object *param)
   Type *type;
   if (param->paramAttrs->kind == PARAM_VALUE)
   {
+    // An int argument is widened for a DOUBLE parameter, not the other way
     type = compileExpression();
-    checkTypeEquality(type, param->paramAttrs->type);
+    checkTypeEquality(param->paramAttrs->type, type);
+    genConvert(param->paramAttrs->type, type);
   }
   else
   {
+    // The variable itself is passed, so its type must be the very same
     type = compileLValue();
-    checkTypeEquality(type, param->paramAttrs->type);
+    if (compareType(type, param->paramAttrs->type) == 0)
+      error(ERR_TYPE_INCONSISTENCY, currentToken->lineNo, currentToken->colNo);
   }
 }
 
@@ -795,6 +1007,9 @@ void compileArguments(ObjectNode *paramList)
   case SB_SEMICOLON:
   case KW_END:
   case KW_ELSE:
+  // The end of the body of REPEAT and DO
+  case KW_UNTIL:
+  case KW_WHILE:
   case KW_THEN:
     break;
   default:
@@ -806,11 +1021,15 @@ void compileCondition(void)
 {
   Type *type1;
   Type *type2;
+  TokenType op;
+  CodeAddress start1 = getCurrentCodeAddress();
+  CodeAddress start2;
 
   type1 = compileExpression();
   checkBasicType(type1);
 
-  switch (lookAhead->tokenType)
+  op = lookAhead->tokenType;
+  switch (op)
   {
   case SB_EQ:
     eat(SB_EQ);
@@ -834,27 +1053,39 @@ void compileCondition(void)
     error(ERR_INVALID_COMPARATOR, lookAhead->lineNo, lookAhead->colNo);
   }
 
+  start2 = getCurrentCodeAddress();
   type2 = compileExpression();
   checkTypeEquality(type1, type2);
+  genCompare(op, type1, start1, type2, start2);
 }
 
 Type *compileExpression(void)
 {
   Type *type;
+  Type *elseType;
+  CodeAddress fjInstruction;
+  CodeAddress jInstruction;
+  CodeAddress start;
 
   switch (lookAhead->tokenType)
   {
   case SB_PLUS:
     eat(SB_PLUS);
-    type = compileExpression2();
+    start = getCurrentCodeAddress();
+    type = compileTerm();
     checkNumberType(type);
     // checkIntType(type);
+    type = compileExpression3(type, start);
     break;
   case SB_MINUS:
+    // The sign belongs to the first term: -a + b is (-a) + b
     eat(SB_MINUS);
-    type = compileExpression2();
+    start = getCurrentCodeAddress();
+    type = compileTerm();
     checkNumberType(type);
     // checkIntType(type);
+    genNegate(type, start);
+    type = compileExpression3(type, start);
     break;
 
   // **START UPDATE**
@@ -875,11 +1106,20 @@ Type *compileExpression(void)
   case KW_IF:
     eat(KW_IF);
     compileCondition();
+    fjInstruction = getCurrentCodeAddress();
+    genFJ(DC_VALUE);
     eat(KW_RETURN);
     type = compileExpression();
+    jInstruction = getCurrentCodeAddress();
+    genJ(DC_VALUE);
+    updateFJ(fjInstruction, getCurrentCodeAddress());
     eat(KW_ELSE);
     eat(KW_RETURN);
-    type = compileExpression();
+    // Both branches leave a value of the same size
+    elseType = compileExpression();
+    checkTypeEquality(type, elseType);
+    genConvert(type, elseType);
+    updateJ(jInstruction, getCurrentCodeAddress());
     break;
 
     // **************END UPDATE***************
@@ -910,52 +1150,44 @@ Type *compileExpression(void)
 
 Type *compileExpression2(void)
 {
-  Type *type1;
-  Type *type2;
+  Type *type;
+  CodeAddress start = getCurrentCodeAddress();
 
-  type1 = compileTerm();
-  type2 = compileExpression3();
-  if (type2 == NULL)
-    return type1;
-  else
-  {
-    checkTypeEquality(type1, type2);
-    return type1;
-  }
+  type = compileTerm();
+  return compileExpression3(type, start);
 }
 
-Type *compileExpression3(void)
+// The terms are applied from the left; type is that of what is on the stack so far, its code starts at start
+Type *compileExpression3(Type *type, CodeAddress start)
 {
   Type *type1;
-  Type *type2;
+  CodeAddress start1;
 
   switch (lookAhead->tokenType)
   {
   case SB_PLUS:
     eat(SB_PLUS);
+    start1 = getCurrentCodeAddress();
     type1 = compileTerm();
 
     // TODO: Bai4 (Cong 2 String)
     checkBasicType(type1);
+    checkTypeEquality(type, type1);
+    if (type->typeClass == TP_STRING)
+      error(ERR_NOT_SUPPORTED, currentToken->lineNo, currentToken->colNo);
 
-    type2 = compileExpression3();
-    if (type2 != NULL)
-    {
-      checkBasicType(type2);
-      checkTypeEquality(type1, type2);
-    }
-    return type1;
+    type = genArith(SB_PLUS, type, start, type1, start1);
+    return compileExpression3(type, start);
     break;
   case SB_MINUS:
     eat(SB_MINUS);
+    start1 = getCurrentCodeAddress();
     type1 = compileTerm();
     checkNumberType(type1);
+    checkTypeEquality(type, type1);
 
-    type2 = compileExpression3();
-    if (type2 != NULL)
-      checkNumberType(type2);
-
-    return type1;
+    type = genArith(SB_MINUS, type, start, type1, start1);
+    return compileExpression3(type, start);
     break;
     // check the FOLLOW set
   case KW_TO:
@@ -972,20 +1204,17 @@ Type *compileExpression3(void)
   case SB_SEMICOLON:
   case KW_END:
   case KW_ELSE:
+  // The end of the body of REPEAT and DO
+  case KW_UNTIL:
+  case KW_WHILE:
   case KW_THEN:
   // Thêm follow RETURN
   case KW_RETURN:
-    return NULL;
+    return type;
     break;
   default:
     error(ERR_INVALID_EXPRESSION, lookAhead->lineNo, lookAhead->colNo);
   }
-  Type *type;
-
-  type = compileFactor();
-
-  compileTerm2();
-
   return type;
 }
 
@@ -993,6 +1222,7 @@ Type *compileTerm(void)
 {
   // TODO: check type of Term2
   Type *type;
+  CodeAddress start = getCurrentCodeAddress();
 
   type = compileExp();
 
@@ -1000,31 +1230,36 @@ Type *compileTerm(void)
   if (type->typeClass == TP_STRING || type->typeClass == TP_CHAR)
     return type;
 
-  compileTerm2();
-
-  return type;
+  return compileTerm2(type, start);
 }
 
-void compileTerm2(void)
+Type *compileTerm2(Type *type, CodeAddress start)
 {
-  Type *type;
+  Type *type1;
+  CodeAddress start1;
 
   switch (lookAhead->tokenType)
   {
   case SB_TIMES:
 
     eat(SB_TIMES);
-    type = compileExp();
     checkNumberType(type);
+    start1 = getCurrentCodeAddress();
+    type1 = compileExp();
+    checkNumberType(type1);
     // checkIntType(type);
-    compileTerm2();
+    type = genArith(SB_TIMES, type, start, type1, start1);
+    return compileTerm2(type, start);
     break;
   case SB_SLASH:
     eat(SB_SLASH);
-    type = compileExp();
     checkNumberType(type);
+    start1 = getCurrentCodeAddress();
+    type1 = compileExp();
+    checkNumberType(type1);
     // checkIntType(type);
-    compileTerm2();
+    type = genArith(SB_SLASH, type, start, type1, start1);
+    return compileTerm2(type, start);
     break;
     // check the FOLLOW set
   case SB_PLUS:
@@ -1043,6 +1278,9 @@ void compileTerm2(void)
   case SB_SEMICOLON:
   case KW_END:
   case KW_ELSE:
+  // The end of the body of REPEAT and DO
+  case KW_UNTIL:
+  case KW_WHILE:
   case KW_THEN:
   // Them RETURN
   case KW_RETURN:
@@ -1051,33 +1289,42 @@ void compileTerm2(void)
   default:
     error(ERR_INVALID_TERM, lookAhead->lineNo, lookAhead->colNo);
   }
+  return type;
 }
 
 // TODO: Bai2 <Thêm phép lấy mũ>
 Type *compileExp(void)
 {
   Type *type;
+  CodeAddress start = getCurrentCodeAddress();
+
   type = compileFactor();
 
   // TODO: Loai bo phep mu cho STRING or CHAR
   if (type->typeClass == TP_STRING || type->typeClass == TP_CHAR)
     return type;
 
-  compileExp2();
+  compileExp2(type, start);
   return type;
 }
 
 // TODO: Bai2 <Thêm phép lấysw mũ>
-void compileExp2(void)
+// The powers go from the right: a ** b ** c is a ** (b ** c); the exponent is an integer
+void compileExp2(Type *type, CodeAddress start)
 {
-  Type *type;
+  Type *type1;
+  CodeAddress start1;
+
   switch (lookAhead->tokenType)
   {
   case SB_EXP:
     eat(SB_EXP);
-    type = compileFactor();
     checkNumberType(type);
-    compileExp2();
+    start1 = getCurrentCodeAddress();
+    type1 = compileFactor();
+    checkIntType(type1);
+    compileExp2(type1, start1);
+    genPower(type, start, start1);
     break;
 
   // check the FOLLOW set
@@ -1101,6 +1348,9 @@ void compileExp2(void)
   case SB_SEMICOLON:
   case KW_END:
   case KW_ELSE:
+  // The end of the body of REPEAT and DO
+  case KW_UNTIL:
+  case KW_WHILE:
   case KW_THEN:
   case KW_RETURN:
 
@@ -1124,19 +1374,28 @@ Type *compileFactor(void)
     // Thêm cho Float
     eat(TK_NUMBER);
     if (currentToken->flagNumber == 0)
+    {
       type = intType;
+      genLC(currentToken->value);
+    }
     else
+    {
       type = floatType;
+      genLCF(currentToken->fValue);
+    }
     break;
   case TK_CHAR:
     eat(TK_CHAR);
     type = charType;
+    genLC((unsigned char)currentToken->string[0]);
     break;
 
   // Them string
   case TK_STRING:
     eat(TK_STRING);
     type = stringType;
+    // Strings are only written by WRITES
+    error(ERR_NOT_SUPPORTED, currentToken->lineNo, currentToken->colNo);
     break;
 
   // TODO: Bai2 - Them dong ngoac mo ngoac: a*(b+c)
@@ -1164,19 +1423,45 @@ Type *compileFactor(void)
         type = charType;
       else if (obj->constAttrs->value->type == TP_STRING)
         type = stringType;
+      genConstant(obj->constAttrs->value);
       break;
     case OBJ_VARIABLE:
       if (obj->varAttrs->type->typeClass == TP_ARRAY)
+      {
+        genVariableAddress(obj);
         type = compileIndexes(obj->varAttrs->type);
+        genLoad(type);
+      }
       else
+      {
         type = obj->varAttrs->type;
+        if (type->typeClass == TP_STRING)
+          error(ERR_NOT_SUPPORTED, currentToken->lineNo, currentToken->colNo);
+        genVariableValue(obj);
+      }
       break;
     case OBJ_PARAMETER:
       type = obj->paramAttrs->type;
+      if (type->typeClass == TP_STRING)
+        error(ERR_NOT_SUPPORTED, currentToken->lineNo, currentToken->colNo);
+      genParameterValue(obj);
       break;
     case OBJ_FUNCTION:
-      compileArguments(obj->funcAttrs->paramList);
       type = obj->funcAttrs->returnType;
+      if (type->typeClass == TP_STRING)
+        error(ERR_NOT_SUPPORTED, currentToken->lineNo, currentToken->colNo);
+      if (isPredefinedFunction(obj))
+      {
+        compileArguments(obj->funcAttrs->paramList);
+        genPredefinedFunctionCall(obj);
+      }
+      else
+      {
+        genINT(RESERVED_WORDS);
+        compileArguments(obj->funcAttrs->paramList);
+        genDCT(RESERVED_WORDS + obj->funcAttrs->paramSize);
+        genFunctionCall(obj);
+      }
       break;
     default:
       error(ERR_INVALID_FACTOR, currentToken->lineNo, currentToken->colNo);
@@ -1192,20 +1477,30 @@ Type *compileFactor(void)
 Type *compileIndexes(Type *arrayType)
 {
   // TODO: parse a sequence of indexes, check the consistency to the arrayType, and return the element type
+  // The address of the array is the LA just emitted. Indexes count from 1,
+  // so that LA is moved down one element for each of them.
+  // An array not indexed down to a basic type is a block, used by its address.
   Type *type;
+  CodeAddress base = getCurrentCodeAddress() - 1;
+  CodeAddress index;
+  int size;
+
   while (lookAhead->tokenType == SB_LSEL)
   {
     eat(SB_LSEL);
+    index = getCurrentCodeAddress();
     type = compileExpression();
     checkIntType(type);
 
     checkArrayType(arrayType);
 
     arrayType = arrayType->elementType;
+    size = sizeOfType(arrayType);
+    genArrayIndex(base, index, size);
+    updateLA(base, -size);
 
     eat(SB_RSEL);
   }
-  checkBasicType(arrayType);
   return arrayType;
 }
 
@@ -1221,8 +1516,6 @@ int compile(char *fileName)
 
   compileProgram();
 
-  printObject(symtab->program, 0);
-
   cleanSymTab();
 
   free(currentToken);
@@ -7,6 +7,7 @@
 #define __PARSER_H__
 #include "token.h"
 #include "symtab.h"
+#include "instructions.h"
 
 void scan(void);
 void eat(TokenType tokenType);
@@ -38,6 +39,7 @@ void compileStatement(void);
 Type *compileLValue(void);
 void compileAssignSt(void);
 void compileCallSt(void);
+void compileStringArgument(void);
 void compileGroupSt(void);
 void compileIfSt(void);
 void compileElseSt(void);
@@ -57,14 +59,14 @@ void compileArguments(ObjectNode *paramList);
 void compileCondition(void);
 Type *compileExpression(void);
 Type *compileExpression2(void);
-Type *compileExpression3(void);
+Type *compileExpression3(Type *type, CodeAddress start);
 Type *compileTerm(void);
 
 // TODO: Bai2
 Type *compileExp(void);
-void compileExp2(void);
+void compileExp2(Type *type, CodeAddress start);
 
-void compileTerm2(void);
+Type *compileTerm2(Type *type, CodeAddress start);
 Type *compileFactor(void);
 Type *compileIndexes(Type *arrayType);
 
@@ -373,9 +373,6 @@ Token *getValidToken(void)
     free(token);
     token = getToken();
   }
-  // In thong tin Token
-  // TODO: Inthongtin
-  printToken(token);
   return token;
 }
 
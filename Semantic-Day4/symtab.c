@@ -9,6 +9,7 @@
 #include <string.h>
 #include "symtab.h"
 #include "error.h"
+#include "instructions.h"
 
 void freeObject(Object *obj);
 void freeScope(Scope *scope);
@@ -96,6 +97,24 @@ int compareType(Type *type1, Type *type2)
     return 0;
 }
 
+// In words of the VM stack; a STRING only has a slot, it has no code
+int sizeOfType(Type *type)
+{
+  switch (type->typeClass)
+  {
+  case TP_INT:
+    return INT_SIZE;
+  case TP_CHAR:
+    return CHAR_SIZE;
+  case TP_FLOAT:
+    return DOUBLE_SIZE;
+  case TP_ARRAY:
+    return type->arraySize * sizeOfType(type->elementType);
+  default:
+    return 1;
+  }
+}
+
 void freeType(Type *type)
 {
   switch (type->typeClass)
@@ -131,7 +150,7 @@ ConstantValue *makeIntConstant(int i)
 }
 
 // --- Thêm floatConstant ---
-ConstantValue *makeFloatConstant(float f)
+ConstantValue *makeFloatConstant(double f)
 {
   ConstantValue *value = (ConstantValue *)malloc(sizeof(ConstantValue));
   value->type = TP_FLOAT;
@@ -144,7 +163,9 @@ ConstantValue *makeStringConstant(char str[])
 {
   ConstantValue *value = (ConstantValue *)malloc(sizeof(ConstantValue));
   value->type = TP_STRING;
-  value->stringValue = str;
+  // The token that holds str is freed once it is scanned past
+  value->stringValue = (char *)malloc(strlen(str) + 1);
+  strcpy(value->stringValue, str);
   return value;
 }
 
@@ -173,8 +194,8 @@ ConstantValue *duplicateConstantValue(ConstantValue *v)
   // --- Them string ---
   else if (v->type == TP_STRING)
   {
-    // value->stringValue = v->stringValue;
-    memcpy(value->stringValue, v->stringValue, strlen(v->stringValue) + 1);
+    value->stringValue = (char *)malloc(strlen(v->stringValue) + 1);
+    strcpy(value->stringValue, v->stringValue);
   }
 
   return value;
@@ -188,6 +209,7 @@ Scope *createScope(Object *owner, Scope *outer)
   scope->objList = NULL;
   scope->owner = owner;
   scope->outer = outer;
+  scope->frameSize = RESERVED_WORDS;
   return scope;
 }
 
@@ -239,6 +261,9 @@ Object *createFunctionObject(char *name)
   obj->funcAttrs = (FunctionAttributes *)malloc(sizeof(FunctionAttributes));
   obj->funcAttrs->paramList = NULL;
   obj->funcAttrs->scope = createScope(obj, symtab->currentScope);
+  obj->funcAttrs->paramSize = 0;
+  obj->funcAttrs->codeAddress = 0;
+  obj->funcAttrs->resultOffset = 0;
   return obj;
 }
 
@@ -250,6 +275,8 @@ Object *createProcedureObject(char *name)
   obj->procAttrs = (ProcedureAttributes *)malloc(sizeof(ProcedureAttributes));
   obj->procAttrs->paramList = NULL;
   obj->procAttrs->scope = createScope(obj, symtab->currentScope);
+  obj->procAttrs->paramSize = 0;
+  obj->procAttrs->codeAddress = 0;
   return obj;
 }
 
@@ -261,6 +288,7 @@ Object *createParameterObject(char *name, enum ParamKind kind, Object *owner)
   obj->paramAttrs = (ParameterAttributes *)malloc(sizeof(ParameterAttributes));
   obj->paramAttrs->kind = kind;
   obj->paramAttrs->function = owner;
+  obj->paramAttrs->localOffset = 0;
   return obj;
 }
 
@@ -269,6 +297,8 @@ void freeObject(Object *obj)
   switch (obj->kind)
   {
   case OBJ_CONSTANT:
+    if (obj->constAttrs->value->type == TP_STRING)
+      free(obj->constAttrs->value->stringValue);
     free(obj->constAttrs->value);
     free(obj->constAttrs);
     break;
@@ -418,6 +448,10 @@ void initSymTab(void)
   obj = createProcedureObject("WRITELN");
   addObject(&(symtab->globalObjectList), obj);
 
+  // A break point: kplrun -snapshot= checkpoints the program there
+  obj = createProcedureObject("CHECKPOINT");
+  addObject(&(symtab->globalObjectList), obj);
+
   intType = makeIntType();
   // --- Them float ---
   floatType = makeFloatType();
@@ -449,22 +483,60 @@ void exitBlock(void)
   symtab->currentScope = symtab->currentScope->outer;
 }
 
+static int isDoubleType(Type *type)
+{
+  while (type->typeClass == TP_ARRAY)
+    type = type->elementType;
+  return type->typeClass == TP_FLOAT;
+}
+
+/*
+ * Frame slots for a local of the given type. DOUBLE locals, and arrays of
+ * them, start at an even offset. That only makes them 8-byte aligned in the
+ * main program's frame, at base 0: a procedure's frame starts right above
+ * its caller's stack top, which may be odd.
+ */
+int allocateLocal(Scope *scope, Type *type)
+{
+  int offset;
+
+  if (isDoubleType(type) && (scope->frameSize % 2 != 0))
+    scope->frameSize++;
+  offset = scope->frameSize;
+  scope->frameSize += sizeOfType(type);
+  return offset;
+}
+
 void declareObject(Object *obj)
 {
+  Scope *scope = symtab->currentScope;
+
   if (obj->kind == OBJ_PARAMETER)
   {
-    Object *owner = symtab->currentScope->owner;
+    Object *owner = scope->owner;
+
+    // Parameters follow each other, as the caller pushes the arguments
+    obj->paramAttrs->localOffset = scope->frameSize;
+    if (obj->paramAttrs->kind == PARAM_REFERENCE)
+      scope->frameSize++;
+    else
+      scope->frameSize += sizeOfType(obj->paramAttrs->type);
+
     switch (owner->kind)
     {
     case OBJ_FUNCTION:
       addObject(&(owner->funcAttrs->paramList), obj);
+      owner->funcAttrs->paramSize = scope->frameSize - RESERVED_WORDS;
       break;
     case OBJ_PROCEDURE:
       addObject(&(owner->procAttrs->paramList), obj);
+      owner->procAttrs->paramSize = scope->frameSize - RESERVED_WORDS;
       break;
     default:
       break;
     }
   }
-  addObject(&(symtab->currentScope->objList), obj);
+  else if (obj->kind == OBJ_VARIABLE)
+    obj->varAttrs->localOffset = allocateLocal(scope, obj->varAttrs->type);
+  addObject(&(scope->objList), obj);
 }
@@ -9,6 +9,9 @@
 
 #include "token.h"
 
+// Result, dynamic link, return address and static link start every frame
+#define RESERVED_WORDS 4
+
 enum TypeClass
 {
   TP_INT,
@@ -53,7 +56,7 @@ struct ConstantValue_
     int intValue;
     char charValue;
     // Thêm float
-    float floatValue;
+    double floatValue;
     char *stringValue;
   };
 };
@@ -73,6 +76,7 @@ struct VariableAttributes_
 {
   Type *type;
   struct Scope_ *scope;
+  int localOffset;
 };
 
 struct TypeAttributes_
@@ -84,6 +88,8 @@ struct ProcedureAttributes_
 {
   struct ObjectNode_ *paramList;
   struct Scope_ *scope;
+  int paramSize;
+  int codeAddress;
 };
 
 struct FunctionAttributes_
@@ -91,6 +97,9 @@ struct FunctionAttributes_
   struct ObjectNode_ *paramList;
   Type *returnType;
   struct Scope_ *scope;
+  int paramSize;
+  int codeAddress;
+  int resultOffset; // A DOUBLE result is a local, returned by EFF
 };
 
 struct ProgramAttributes_
@@ -103,6 +112,7 @@ struct ParameterAttributes_
   enum ParamKind kind;
   Type *type;
   struct Object_ *function;
+  int localOffset;
 };
 
 typedef struct ConstantAttributes_ ConstantAttributes;
@@ -143,6 +153,7 @@ struct Scope_
   ObjectNode *objList;
   Object *owner;
   struct Scope_ *outer;
+  int frameSize;
 };
 
 typedef struct Scope_ Scope;
@@ -168,12 +179,13 @@ Type *makeCharType(void);
 Type *makeArrayType(int arraySize, Type *elementType);
 Type *duplicateType(Type *type);
 int compareType(Type *type1, Type *type2);
+int sizeOfType(Type *type);
 void freeType(Type *type);
 
 ConstantValue *makeIntConstant(int i);
 
 // Tạo cho float
-ConstantValue *makeFloatConstant(float f);
+ConstantValue *makeFloatConstant(double f);
 
 // Tao string
 ConstantValue *makeStringConstant(char str[]);
@@ -198,5 +210,6 @@ void cleanSymTab(void);
 void enterBlock(Scope *scope);
 void exitBlock(void);
 void declareObject(Object *obj);
+int allocateLocal(Scope *scope, Type *type);
 
 #endif
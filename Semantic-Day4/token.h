@@ -97,7 +97,7 @@ typedef struct
   TokenType tokenType;
   int value;            // --- Int value ---
   int flagNumber;       // --- flagNumber = 0 -> int value, flagNumber = 1 -> floatValue ---
-  float fValue;         // --- Float value ---
+  double fValue;        // --- Float value ---
   char stringNode[256]; // --- Thêm String ---
 } Token;
 
@@ -0,0 +1,206 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+
+#define OUTPUT_SUFFIX ".out"
+
+// A file it could not open stops a run with this state
+#define PS_NO_FILE -1
+
+struct BatchRun_ {
+  char* input;
+  int ps;
+  double seconds;
+};
+
+typedef struct BatchRun_ BatchRun;
+
+static VM* program;
+static BatchRun* runs;
+static int runCount;
+static int nextRun;
+static pthread_mutex_t nextLock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now(void) {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static int endsWith(char* s, char* suffix) {
+  size_t n = strlen(s);
+  size_t k = strlen(suffix);
+
+  return (n >= k) && (strcmp(s + n - k, suffix) == 0);
+}
+
+static void addInput(char* input, int* capacity) {
+  if (runCount == *capacity) {
+    *capacity *= 2;
+    runs = (BatchRun*) realloc(runs, *capacity * sizeof(BatchRun));
+  }
+  runs[runCount].input = strdup(input);
+  runs[runCount].ps = PS_INACTIVE;
+  runs[runCount].seconds = 0;
+  runCount ++;
+}
+
+static int compareRuns(const void* a, const void* b) {
+  return strcmp(((BatchRun*) a)->input, ((BatchRun*) b)->input);
+}
+
+/*
+ * The inputs are the regular files of a directory, in name order, outputs
+ * of earlier batches excepted, or the lines of a list file, in its order.
+ */
+static int listInputs(char* path) {
+  int capacity = 64;
+  struct stat info;
+  char line[4096];
+
+  runs = (BatchRun*) malloc(capacity * sizeof(BatchRun));
+  runCount = 0;
+  if (stat(path, &info) != 0) return 0;
+
+  if (S_ISDIR(info.st_mode)) {
+    DIR* dir = opendir(path);
+    struct dirent* entry;
+
+    if (dir == NULL) return 0;
+    while ((entry = readdir(dir)) != NULL) {
+      snprintf(line, sizeof(line), "%s/%s", path, entry->d_name);
+      if ((stat(line, &info) == 0) && S_ISREG(info.st_mode) && !endsWith(line, OUTPUT_SUFFIX))
+	addInput(line, &capacity);
+    }
+    closedir(dir);
+    qsort(runs, runCount, sizeof(BatchRun), compareRuns);
+  } else {
+    FILE* list = fopen(path, "r");
+
+    if (list == NULL) return 0;
+    while (fgets(line, sizeof(line), list) != NULL) {
+      line[strcspn(line, "\r\n")] = '\0';
+      if (line[0] != '\0')
+	addInput(line, &capacity);
+    }
+    fclose(list);
+  }
+  return 1;
+}
+
+// Runs the program on one input, writing what it prints to input.out
+static void runOne(VM* vm, BatchRun* job) {
+  char* output = (char*) malloc(strlen(job->input) + sizeof(OUTPUT_SUFFIX));
+  double start = now();
+  FILE* in;
+  FILE* out;
+
+  strcpy(output, job->input);
+  strcat(output, OUTPUT_SUFFIX);
+  in = fopen(job->input, "r");
+  out = fopen(output, "w");
+  if ((in == NULL) || (out == NULL))
+    job->ps = PS_NO_FILE;
+  else {
+    char* message;
+
+    resetVM(vm);
+    vm->inputStream = in;
+    vm->outputStream = out;
+    job->ps = run(vm);
+    message = runtimeMessage(job->ps);
+    if (message != NULL)
+      fprintf(out, "Runtime error: %s\n", message);
+  }
+  if (in != NULL) fclose(in);
+  if (out != NULL) fclose(out);
+  free(output);
+  job->seconds = now() - start;
+}
+
+// A worker has a VM of its own on the shared program and takes runs in turn
+static void* worker(void* unused) {
+  VM* vm = (VM*) malloc(sizeof(VM));
+  int i;
+
+  vm->stackSize = program->stackSize;
+  vm->codeSize = program->codeSize;
+  vm->debugMode = 0;
+  vm->engine = program->engine;
+  vm->fuseMode = program->fuseMode;
+  vm->hugePages = program->hugePages;
+  initVM(vm);
+  shareExecutable(vm, program);
+
+  for (;;) {
+    pthread_mutex_lock(&nextLock);
+    i = nextRun ++;
+    pthread_mutex_unlock(&nextLock);
+    if (i >= runCount) break;
+    runOne(vm, &runs[i]);
+  }
+
+  cleanVM(vm);
+  free(vm);
+  return NULL;
+}
+
+static char* statusName(int ps) {
+  switch (ps) {
+  case PS_NORMAL_EXIT: return "ok";
+  case PS_NO_FILE: return "no file";
+  case PS_IO_ERROR: return "io error";
+  case PS_DIVIDE_BY_ZERO: return "divide by zero";
+  case PS_STACK_OVERFLOW: return "stack overflow";
+  default: return "stopped";
+  }
+}
+
+/*
+ * Runs the program loaded into the given VM once per input under path, on
+ * jobs threads, then prints one line per run and a total. Returns the
+ * number of runs that did not end normally, or -1 if path has no inputs.
+ */
+int runBatch(VM* vm, char* path, int jobs) {
+  pthread_t* threads;
+  double start = now();
+  int failed = 0;
+  int i;
+
+  program = vm;
+  if (!listInputs(path) || (runCount == 0)) {
+    free(runs);
+    return -1;
+  }
+  if (jobs > runCount) jobs = runCount;
+  nextRun = 0;
+
+  threads = (pthread_t*) malloc(jobs * sizeof(pthread_t));
+  for (i = 0; i < jobs; i ++)
+    pthread_create(&threads[i], NULL, worker, NULL);
+  for (i = 0; i < jobs; i ++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+
+  for (i = 0; i < runCount; i ++) {
+    printf("%-16s %9.3fs  %s\n", statusName(runs[i].ps), runs[i].seconds, runs[i].input);
+    if (runs[i].ps != PS_NORMAL_EXIT) failed ++;
+    free(runs[i].input);
+  }
+  printf("kplrun: %d runs, %d failed, %.3fs on %d threads\n", runCount, failed, now() - start, jobs);
+  free(runs);
+  return failed;
+}
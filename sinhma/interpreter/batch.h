@@ -0,0 +1,14 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "vm.h"
+
+int runBatch(VM* program, char* path, int jobs);
+
+#endif
@@ -0,0 +1,129 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include "fusion.h"
+
+// Superinstruction of "LV; LV; cmp; FJ" (VV) or "LV; LC; cmp; FJ" (VC)
+static enum OpCode compareJump(enum OpCode cmp, enum OpCode second) {
+  int offset = cmp - OP_EQ;
+
+  if (second == OP_LV) return OP_VVEQ + offset;
+  else return OP_VCEQ + offset;
+}
+
+static int isCompare(enum OpCode op) {
+  return (op >= OP_EQ) && (op <= OP_LE);
+}
+
+/*
+ * Rewrites the code block in place, replacing the stack idioms of the code
+ * generator by superinstructions (see instructions.h), and fixes up the
+ * targets of J, FJ and CALL. A sequence is only fused when no jump, call or
+ * return lands inside it. newAddress (codeSize + 1 entries) receives the
+ * new address of every old one. Returns the number of instructions that no
+ * longer need a dispatch of their own.
+ */
+int fuseCode(CodeBlock* codeBlock, int* newAddress, int* fusedCount) {
+  Instruction* code = codeBlock->code;
+  int n = codeBlock->codeSize;
+  char* leader = (char*) calloc(n + 1, sizeof(char));
+  int eliminated = 0;
+  int i, j, k;
+
+  *fusedCount = 0;
+  for (i = 0; i < n; i ++) {
+    switch (code[i].op) {
+    case OP_CALL:
+      // The callee returns to the instruction after the call
+      leader[i + 1] = 1;
+    case OP_J:
+    case OP_FJ:
+      if ((code[i].q >= 0) && (code[i].q < n))
+	leader[code[i].q] = 1;
+      break;
+    default: break;
+    }
+  }
+
+  i = 0;
+  j = 0;
+  while (i < n) {
+    Instruction seq[4];
+    int length = 0;
+    int kept = 0;
+
+    for (k = 0; (k < 4) && (i + k < n); k ++)
+      seq[k] = code[i + k];
+    // Nothing may jump into the middle of a sequence
+    for (k = 1; (k < 4) && (i + k < n) && !leader[i + k]; k ++);
+
+    if ((k >= 4) && (seq[0].op == OP_LV) && ((seq[1].op == OP_LV) || (seq[1].op == OP_LC))
+	&& isCompare(seq[2].op) && (seq[3].op == OP_FJ)) {
+      code[j] = seq[0];
+      code[j].op = compareJump(seq[2].op, seq[1].op);
+      code[j + 1] = seq[1];
+      code[j + 2] = seq[3];
+      length = 4;
+      kept = 3;
+    } else if ((k >= 3) && (seq[0].op == OP_LA) && ((seq[1].op == OP_LV) || (seq[1].op == OP_LC))
+	       && (seq[2].op == OP_ST)) {
+      code[j] = seq[0];
+      code[j].op = (seq[1].op == OP_LV) ? OP_MOV : OP_MOVC;
+      code[j + 1] = seq[1];
+      length = 3;
+      kept = 2;
+    } else if ((k >= 3) && (seq[0].op == OP_LV) && (seq[1].op == OP_LC)
+	       && ((seq[2].op == OP_AD) || (seq[2].op == OP_SB))) {
+      code[j] = seq[0];
+      code[j].op = OP_LVAC;
+      code[j + 1] = seq[1];
+      if (seq[2].op == OP_SB)
+	code[j + 1].q = - (unsigned int) seq[1].q;
+      length = 3;
+      kept = 2;
+    } else if ((k >= 2) && (seq[0].op == OP_LC)
+	       && ((seq[1].op == OP_AD) || (seq[1].op == OP_SB))) {
+      code[j] = seq[0];
+      code[j].op = OP_ADC;
+      if (seq[1].op == OP_SB)
+	code[j].q = - (unsigned int) seq[0].q;
+      length = 2;
+      kept = 1;
+    }
+
+    if (length > 0) {
+      for (k = 0; k < length; k ++)
+	newAddress[i + k] = j + ((k < kept) ? k : kept - 1);
+      i += length;
+      j += kept;
+      eliminated += length - 1;
+      (*fusedCount) ++;
+    } else {
+      newAddress[i] = j;
+      code[j ++] = seq[0];
+      i ++;
+    }
+  }
+  newAddress[n] = j;
+  codeBlock->codeSize = j;
+  codeBlock->fused = 1;
+
+  for (i = 0; i < j; i ++) {
+    switch (code[i].op) {
+    case OP_J:
+    case OP_FJ:
+    case OP_CALL:
+      if ((code[i].q >= 0) && (code[i].q <= n))
+	code[i].q = newAddress[code[i].q];
+      break;
+    default: break;
+    }
+  }
+
+  free(leader);
+  return eliminated;
+}
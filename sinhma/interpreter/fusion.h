@@ -0,0 +1,14 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __FUSION_H__
+#define __FUSION_H__
+
+#include "instructions.h"
+
+int fuseCode(CodeBlock* codeBlock, int* newAddress, int* fusedCount);
+
+#endif
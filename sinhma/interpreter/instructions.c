@@ -5,28 +5,85 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "instructions.h"
 
-#define MAX_BLOCK 50
+struct LoadMessage {
+  LoadError error;
+  char* message;
+};
 
+struct LoadMessage loadMessages[] = {
+  {LOAD_OK, "No error."},
+  {LOAD_BAD_HEADER, "Bad executable header."},
+  {LOAD_BAD_VERSION, "Unsupported executable version."},
+  {LOAD_BAD_SECTION, "Missing or bad code section."},
+  {LOAD_NO_MEMORY, "Not enough memory for the code."},
+  {LOAD_TRUNCATED, "Truncated instruction at the end of the file."},
+};
+
+#define MIN_CODE_SIZE 16
+
+// maxSize is only the initial capacity
 CodeBlock* createCodeBlock(int maxSize) {
   CodeBlock* codeBlock = (CodeBlock*) malloc(sizeof(CodeBlock));
 
+  if (maxSize < MIN_CODE_SIZE) maxSize = MIN_CODE_SIZE;
   codeBlock->code = (Instruction*) malloc(maxSize * sizeof(Instruction));
   codeBlock->codeSize = 0;
   codeBlock->maxSize = maxSize;
+  codeBlock->mapping = NULL;
+  codeBlock->mappingSize = 0;
+  codeBlock->fused = 0;
   return codeBlock;
 }
 
 void freeCodeBlock(CodeBlock* codeBlock) {
-  free(codeBlock->code);
+  if (codeBlock->mapping != NULL)
+    munmap(codeBlock->mapping, codeBlock->mappingSize);
+  else free(codeBlock->code);
   free(codeBlock);
 }
 
+/*
+ * Makes room for size instructions, doubling the capacity so that emitting
+ * stays amortized O(1). Returns 0 when out of memory.
+ */
+int reserveCode(CodeBlock* codeBlock, int size) {
+  Instruction* code;
+  int maxSize = codeBlock->maxSize;
+
+  unmapCode(codeBlock);
+  if (size <= codeBlock->maxSize) return 1;
+  if (maxSize < MIN_CODE_SIZE) maxSize = MIN_CODE_SIZE;
+  while (maxSize < size) maxSize *= 2;
+  code = (Instruction*) realloc(codeBlock->code, maxSize * sizeof(Instruction));
+  if (code == NULL) return 0;
+  codeBlock->code = code;
+  codeBlock->maxSize = maxSize;
+  return 1;
+}
+
+// Gives back the unused capacity once no more code is emitted
+void shrinkCodeBlock(CodeBlock* codeBlock) {
+  Instruction* code;
+  int maxSize = (codeBlock->codeSize > 0) ? codeBlock->codeSize : 1;
+
+  if ((codeBlock->mapping != NULL) || (maxSize == codeBlock->maxSize)) return;
+  code = (Instruction*) realloc(codeBlock->code, maxSize * sizeof(Instruction));
+  if (code == NULL) return;
+  codeBlock->code = code;
+  codeBlock->maxSize = maxSize;
+}
+
 int emitCode(CodeBlock* codeBlock, enum OpCode op, WORD p, WORD q) {
-  Instruction* bottom = codeBlock->code + codeBlock->codeSize;
+  Instruction* bottom;
 
-  if (codeBlock->codeSize >= codeBlock->maxSize) return 0;
+  if (!reserveCode(codeBlock, codeBlock->codeSize + 1)) return 0;
+  bottom = codeBlock->code + codeBlock->codeSize;
 
   bottom->op = op;
   bottom->p = p;
@@ -68,6 +125,62 @@ int emitLE(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_LE, DC_VALUE, D
 
 int emitBP(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_BP, DC_VALUE, DC_VALUE); }
 
+int emitLCF(CodeBlock* codeBlock, double value) {
+  WORD words[DOUBLE_SIZE];
+
+  memcpy(words, &value, sizeof(value));
+  return emitCode(codeBlock, OP_LCF, words[0], words[1]);
+}
+
+int emitLVF(CodeBlock* codeBlock, WORD p, WORD q) { return emitCode(codeBlock, OP_LVF, p, q); }
+int emitLIF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_LIF, DC_VALUE, DC_VALUE); }
+int emitSTF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_STF, DC_VALUE, DC_VALUE); }
+int emitADF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_ADF, DC_VALUE, DC_VALUE); }
+int emitSBF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_SBF, DC_VALUE, DC_VALUE); }
+int emitMLF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_MLF, DC_VALUE, DC_VALUE); }
+int emitDVF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_DVF, DC_VALUE, DC_VALUE); }
+int emitNEGF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_NEGF, DC_VALUE, DC_VALUE); }
+int emitEQF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_EQF, DC_VALUE, DC_VALUE); }
+int emitNEF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_NEF, DC_VALUE, DC_VALUE); }
+int emitGTF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_GTF, DC_VALUE, DC_VALUE); }
+int emitLTF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_LTF, DC_VALUE, DC_VALUE); }
+int emitGEF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_GEF, DC_VALUE, DC_VALUE); }
+int emitLEF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_LEF, DC_VALUE, DC_VALUE); }
+int emitCVIF(CodeBlock* codeBlock, WORD q) { return emitCode(codeBlock, OP_CVIF, DC_VALUE, q); }
+int emitCVFI(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_CVFI, DC_VALUE, DC_VALUE); }
+int emitRF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_RF, DC_VALUE, DC_VALUE); }
+int emitWRF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_WRF, DC_VALUE, DC_VALUE); }
+int emitEFF(CodeBlock* codeBlock, WORD q) { return emitCode(codeBlock, OP_EFF, DC_VALUE, q); }
+
+int emitMVB(CodeBlock* codeBlock, WORD q) { return emitCode(codeBlock, OP_MVB, DC_VALUE, q); }
+int emitFLB(CodeBlock* codeBlock, WORD q) { return emitCode(codeBlock, OP_FLB, DC_VALUE, q); }
+
+int emitPW(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_PW, DC_VALUE, DC_VALUE); }
+int emitPWF(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_PWF, DC_VALUE, DC_VALUE); }
+
+// The operand of LCF
+double constantDouble(Instruction* inst) {
+  WORD words[DOUBLE_SIZE] = { inst->p, inst->q };
+  double value;
+
+  memcpy(&value, words, sizeof(value));
+  return value;
+}
+
+// Words taken by the instruction, the operand slots of superinstructions included
+int instructionWords(enum OpCode op) {
+  switch (op) {
+  case OP_LVAC:
+  case OP_MOV:
+  case OP_MOVC:
+    return 2;
+  default:
+    if ((op >= OP_VVEQ) && (op <= OP_VCLE))
+      return 3;
+    return 1;
+  }
+}
+
 
 void printInstruction(Instruction* inst) {
   switch (inst->op) {
@@ -103,6 +216,48 @@ void printInstruction(Instruction* inst) {
   case OP_LE: printf("LE"); break;
 
   case OP_BP: printf("BP"); break;
+
+  case OP_LCF: printf("LCF %g", constantDouble(inst)); break;
+  case OP_LVF: printf("LVF %d,%d", inst->p, inst->q); break;
+  case OP_LIF: printf("LIF"); break;
+  case OP_STF: printf("STF"); break;
+  case OP_ADF: printf("ADF"); break;
+  case OP_SBF: printf("SBF"); break;
+  case OP_MLF: printf("MLF"); break;
+  case OP_DVF: printf("DVF"); break;
+  case OP_NEGF: printf("NEGF"); break;
+  case OP_EQF: printf("EQF"); break;
+  case OP_NEF: printf("NEF"); break;
+  case OP_GTF: printf("GTF"); break;
+  case OP_LTF: printf("LTF"); break;
+  case OP_GEF: printf("GEF"); break;
+  case OP_LEF: printf("LEF"); break;
+  case OP_CVIF: printf("CVIF %d", inst->q); break;
+  case OP_CVFI: printf("CVFI"); break;
+  case OP_RF: printf("RF"); break;
+  case OP_WRF: printf("WRF"); break;
+  case OP_EFF: printf("EFF %d", inst->q); break;
+  case OP_MVB: printf("MVB %d", inst->q); break;
+  case OP_FLB: printf("FLB %d", inst->q); break;
+  case OP_PW: printf("PW"); break;
+  case OP_PWF: printf("PWF"); break;
+
+  case OP_ADC: printf("ADC %d", inst->q); break;
+  case OP_LVAC: printf("LVAC %d,%d", inst->p, inst->q); break;
+  case OP_MOV: printf("MOV %d,%d", inst->p, inst->q); break;
+  case OP_MOVC: printf("MOVC %d,%d", inst->p, inst->q); break;
+  case OP_VVEQ: printf("VVEQ %d,%d", inst->p, inst->q); break;
+  case OP_VVNE: printf("VVNE %d,%d", inst->p, inst->q); break;
+  case OP_VVGT: printf("VVGT %d,%d", inst->p, inst->q); break;
+  case OP_VVLT: printf("VVLT %d,%d", inst->p, inst->q); break;
+  case OP_VVGE: printf("VVGE %d,%d", inst->p, inst->q); break;
+  case OP_VVLE: printf("VVLE %d,%d", inst->p, inst->q); break;
+  case OP_VCEQ: printf("VCEQ %d,%d", inst->p, inst->q); break;
+  case OP_VCNE: printf("VCNE %d,%d", inst->p, inst->q); break;
+  case OP_VCGT: printf("VCGT %d,%d", inst->p, inst->q); break;
+  case OP_VCLT: printf("VCLT %d,%d", inst->p, inst->q); break;
+  case OP_VCGE: printf("VCGE %d,%d", inst->p, inst->q); break;
+  case OP_VCLE: printf("VCLE %d,%d", inst->p, inst->q); break;
   default: break;
   }
 }
@@ -141,6 +296,48 @@ void sprintInstruction(char* s, Instruction* inst) {
   case OP_LE: sprintf(s,"LE"); break;
 
   case OP_BP: sprintf(s,"BP"); break;
+
+  case OP_LCF: sprintf(s,"LCF %g", constantDouble(inst)); break;
+  case OP_LVF: sprintf(s,"LVF %d,%d", inst->p, inst->q); break;
+  case OP_LIF: sprintf(s,"LIF"); break;
+  case OP_STF: sprintf(s,"STF"); break;
+  case OP_ADF: sprintf(s,"ADF"); break;
+  case OP_SBF: sprintf(s,"SBF"); break;
+  case OP_MLF: sprintf(s,"MLF"); break;
+  case OP_DVF: sprintf(s,"DVF"); break;
+  case OP_NEGF: sprintf(s,"NEGF"); break;
+  case OP_EQF: sprintf(s,"EQF"); break;
+  case OP_NEF: sprintf(s,"NEF"); break;
+  case OP_GTF: sprintf(s,"GTF"); break;
+  case OP_LTF: sprintf(s,"LTF"); break;
+  case OP_GEF: sprintf(s,"GEF"); break;
+  case OP_LEF: sprintf(s,"LEF"); break;
+  case OP_CVIF: sprintf(s,"CVIF %d", inst->q); break;
+  case OP_CVFI: sprintf(s,"CVFI"); break;
+  case OP_RF: sprintf(s,"RF"); break;
+  case OP_WRF: sprintf(s,"WRF"); break;
+  case OP_EFF: sprintf(s,"EFF %d", inst->q); break;
+  case OP_MVB: sprintf(s,"MVB %d", inst->q); break;
+  case OP_FLB: sprintf(s,"FLB %d", inst->q); break;
+  case OP_PW: sprintf(s,"PW"); break;
+  case OP_PWF: sprintf(s,"PWF"); break;
+
+  case OP_ADC: sprintf(s,"ADC %d", inst->q); break;
+  case OP_LVAC: sprintf(s,"LVAC %d,%d", inst->p, inst->q); break;
+  case OP_MOV: sprintf(s,"MOV %d,%d", inst->p, inst->q); break;
+  case OP_MOVC: sprintf(s,"MOVC %d,%d", inst->p, inst->q); break;
+  case OP_VVEQ: sprintf(s,"VVEQ %d,%d", inst->p, inst->q); break;
+  case OP_VVNE: sprintf(s,"VVNE %d,%d", inst->p, inst->q); break;
+  case OP_VVGT: sprintf(s,"VVGT %d,%d", inst->p, inst->q); break;
+  case OP_VVLT: sprintf(s,"VVLT %d,%d", inst->p, inst->q); break;
+  case OP_VVGE: sprintf(s,"VVGE %d,%d", inst->p, inst->q); break;
+  case OP_VVLE: sprintf(s,"VVLE %d,%d", inst->p, inst->q); break;
+  case OP_VCEQ: sprintf(s,"VCEQ %d,%d", inst->p, inst->q); break;
+  case OP_VCNE: sprintf(s,"VCNE %d,%d", inst->p, inst->q); break;
+  case OP_VCGT: sprintf(s,"VCGT %d,%d", inst->p, inst->q); break;
+  case OP_VCLT: sprintf(s,"VCLT %d,%d", inst->p, inst->q); break;
+  case OP_VCGE: sprintf(s,"VCGE %d,%d", inst->p, inst->q); break;
+  case OP_VCLE: sprintf(s,"VCLE %d,%d", inst->p, inst->q); break;
   default: break;
   }
 }
@@ -157,19 +354,133 @@ void printCodeBlock(CodeBlock* codeBlock) {
 }
 
 
-void loadCode(CodeBlock* codeBlock, FILE* f) {
-  Instruction* code = codeBlock->code;
-  int n;
+char* loadMessage(LoadError err) {
+  return loadMessages[err].message;
+}
 
-  codeBlock->codeSize = 0;
-  while (!feof(f)) {
-    n = fread(code, sizeof(Instruction), MAX_BLOCK, f);
-    code += n;
-    codeBlock->codeSize += n;
+// Version 0: the rest of the file is the code, n bytes of it already read
+static LoadError loadBareCode(CodeBlock* codeBlock, FILE* f, char* start, int n) {
+  size_t size = n;
+  size_t capacity;
+
+  if (!reserveCode(codeBlock, n / sizeof(Instruction) + 1)) return LOAD_NO_MEMORY;
+  memcpy(codeBlock->code, start, n);
+  for (;;) {
+    capacity = codeBlock->maxSize * sizeof(Instruction);
+    size += fread((char*) codeBlock->code + size, 1, capacity - size, f);
+    if (size < capacity) break;
+    if (!reserveCode(codeBlock, codeBlock->maxSize + 1)) return LOAD_NO_MEMORY;
   }
+  if (size % sizeof(Instruction) != 0) return LOAD_TRUNCATED;
+  codeBlock->codeSize = size / sizeof(Instruction);
+  return LOAD_OK;
 }
 
+/*
+ * Maps the code section read-only where the file allows it. Otherwise
+ * (pipes...) it is read into the code buffer. The mapping only lasts while
+ * nothing rewrites the code: fusing a SECTION_CODE first copies it with
+ * unmapCode(). A SECTION_FUSED_CODE, or any code run with -nofuse or
+ * -register, executes in place and shares its pages between processes.
+ */
+static LoadError loadCodeSection(CodeBlock* codeBlock, FILE* f, ExecutableHeader* header) {
+  SectionHeader sections[EXE_MAX_SECTIONS];
+  SectionHeader* code = NULL;
+  struct stat status;
+  long pageSize;
+  off_t start;
+  size_t length;
+  void* mapping;
+  int i;
+
+  if (header->version != EXE_VERSION) return LOAD_BAD_VERSION;
+  if ((header->sectionCount <= 0) || (header->sectionCount > EXE_MAX_SECTIONS)
+      || (header->codeLength < 0))
+    return LOAD_BAD_HEADER;
+  if (fread(sections, sizeof(SectionHeader), header->sectionCount, f) != header->sectionCount)
+    return LOAD_BAD_HEADER;
+  for (i = 0; i < header->sectionCount; i ++)
+    if ((sections[i].kind == SECTION_CODE) || (sections[i].kind == SECTION_FUSED_CODE))
+      code = &sections[i];
+
+  if ((code == NULL)
+      || (code->offset < sizeof(ExecutableHeader) + header->sectionCount * sizeof(SectionHeader))
+      || (code->offset % sizeof(WORD) != 0)
+      || (code->size != header->codeLength * sizeof(Instruction)))
+    return LOAD_BAD_SECTION;
+  codeBlock->fused = (code->kind == SECTION_FUSED_CODE);
+
+  if ((fstat(fileno(f), &status) == 0) && S_ISREG(status.st_mode)) {
+    if (status.st_size < (off_t) code->offset + code->size)
+      return LOAD_TRUNCATED;
+    pageSize = sysconf(_SC_PAGESIZE);
+    start = code->offset - code->offset % pageSize;
+    length = code->offset - start + code->size;
+    mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(f), start);
+    if (mapping != MAP_FAILED) {
+      free(codeBlock->code);
+      codeBlock->mapping = mapping;
+      codeBlock->mappingSize = length;
+      codeBlock->code = (Instruction*) ((char*) mapping + (code->offset - start));
+      codeBlock->codeSize = header->codeLength;
+      codeBlock->maxSize = header->codeLength;
+      return LOAD_OK;
+    }
+  }
+
+  // Skip to the section and read it
+  if (!reserveCode(codeBlock, header->codeLength)) return LOAD_NO_MEMORY;
+  for (i = sizeof(ExecutableHeader) + header->sectionCount * sizeof(SectionHeader); i < code->offset; i ++)
+    if (getc(f) == EOF) return LOAD_TRUNCATED;
+  if (fread(codeBlock->code, sizeof(Instruction), header->codeLength, f) != header->codeLength)
+    return LOAD_TRUNCATED;
+  codeBlock->codeSize = header->codeLength;
+  return LOAD_OK;
+}
+
+LoadError loadCode(CodeBlock* codeBlock, FILE* f) {
+  ExecutableHeader header;
+  int n;
+
+  unmapCode(codeBlock);
+  codeBlock->codeSize = 0;
+  codeBlock->fused = 0;
+  n = fread(&header, 1, sizeof(header), f);
+  if ((n == sizeof(header)) && (memcmp(header.magic, EXE_MAGIC, sizeof(header.magic)) == 0))
+    return loadCodeSection(codeBlock, f, &header);
+  return loadBareCode(codeBlock, f, (char*) &header, n);
+}
 
 void saveCode(CodeBlock* codeBlock, FILE* f) {
+  ExecutableHeader header;
+  SectionHeader section;
+  int offset = sizeof(ExecutableHeader) + sizeof(SectionHeader);
+
+  memcpy(header.magic, EXE_MAGIC, sizeof(header.magic));
+  header.version = EXE_VERSION;
+  header.sectionCount = 1;
+  header.codeLength = codeBlock->codeSize;
+  section.kind = codeBlock->fused ? SECTION_FUSED_CODE : SECTION_CODE;
+  section.offset = (offset + EXE_ALIGNMENT - 1) / EXE_ALIGNMENT * EXE_ALIGNMENT;
+  section.size = codeBlock->codeSize * sizeof(Instruction);
+
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(&section, sizeof(section), 1, f);
+  for (; offset < section.offset; offset ++)
+    putc(0, f);
   fwrite(codeBlock->code, sizeof(Instruction), codeBlock->codeSize, f);
 }
+
+// Gives a mapped code block a private, writable copy of its code
+void unmapCode(CodeBlock* codeBlock) {
+  Instruction* code;
+
+  if (codeBlock->mapping == NULL) return;
+  code = (Instruction*) malloc((codeBlock->codeSize + 1) * sizeof(Instruction));
+  memcpy(code, codeBlock->code, codeBlock->codeSize * sizeof(Instruction));
+  munmap(codeBlock->mapping, codeBlock->mappingSize);
+  codeBlock->mapping = NULL;
+  codeBlock->mappingSize = 0;
+  codeBlock->code = code;
+  codeBlock->maxSize = codeBlock->codeSize + 1;
+}
@@ -8,12 +8,14 @@
 #define __INSTRUCTIONS_H__
 
 #include <stdio.h>
+#include <stddef.h>
 
 #define TRUE 1
 #define FALSE 0
 #define DC_VALUE 0
 #define INT_SIZE 1
 #define CHAR_SIZE 1
+#define DOUBLE_SIZE 2
 
 typedef int WORD;
 
@@ -49,9 +51,65 @@ enum OpCode {
   OP_GE,   // Greater or Equal t := t - 1;  if s[t] >= s[t+1] then s[t] := 1 else s[t] := 0;
   OP_LE,   // Less or Equal    t := t - 1;  if s[t] >= s[t+1] then s[t] := 1 else s[t] := 0;
 
-  OP_BP    // Break point. Just for debugging
+  OP_BP,   // Break point. Just for debugging
+
+  // A DOUBLE takes two words, in the order of its bytes in memory; d[a] is
+  // the double in s[a] and s[a+1].
+  OP_LCF,  // Load Constant Float  t := t + 2; d[t-1] := the double whose words are p, q;
+  OP_LVF,  // Load Value Float     t := t + 2; d[t-1] := d[base(p) + q];
+  OP_LIF,  // Load Indirect Float  t := t + 1; d[t-1] := d[s[t-1]];
+  OP_STF,  // Store Float          d[s[t-2]] := d[t-1]; t := t - 3;
+  OP_ADF,  // Add Float            t := t - 2; d[t-1] := d[t-1] + d[t+1];
+  OP_SBF,  // Substract Float      t := t - 2; d[t-1] := d[t-1] - d[t+1];
+  OP_MLF,  // Multiple Float       t := t - 2; d[t-1] := d[t-1] * d[t+1];
+  OP_DVF,  // Divide Float         t := t - 2; d[t-1] := d[t-1] / d[t+1];
+  OP_NEGF, // Negative Float       d[t-1] := - d[t-1];
+  OP_EQF,  // Equal Float          t := t - 3; if d[t] = d[t+2] then s[t] := 1 else s[t] := 0;
+  OP_NEF,  // Not Equal Float      t := t - 3; if d[t] != d[t+2] then s[t] := 1 else s[t] := 0;
+  OP_GTF,  // Greater Float        t := t - 3; if d[t] > d[t+2] then s[t] := 1 else s[t] := 0;
+  OP_LTF,  // Less Float           t := t - 3; if d[t] < d[t+2] then s[t] := 1 else s[t] := 0;
+  OP_GEF,  // Greater or Equal F.  t := t - 3; if d[t] >= d[t+2] then s[t] := 1 else s[t] := 0;
+  OP_LEF,  // Less or Equal Float  t := t - 3; if d[t] <= d[t+2] then s[t] := 1 else s[t] := 0;
+  OP_CVIF, // Int to Float         the int s[t-q] becomes d[t-q], the q words above it move up; t := t + 1;
+  OP_CVFI, // Float to Int         t := t - 1; s[t] := d[t] truncated;
+  OP_RF,   // Read Float           t := t + 2; read a double into d[t-1];
+  OP_WRF,  // Write Float          write the double d[t-1]; t := t - 2;
+  OP_EFF,  // Exit Function Float  d[b] := d[b+q]; t := b + 1; pc := s[b+2]; b := s[b+1];
+
+  // Whole blocks of q words, such as arrays. The destination address is
+  // pushed first; the blocks must lie inside the stack.
+  OP_MVB,  // Move Block           t := t - 2; s[s[t+1]+i] := s[s[t+2]+i] for 0 <= i < q;
+  OP_FLB,  // Fill Block           t := t - 2; s[s[t+1]+i] := s[t+2] for 0 <= i < q;
+
+  // Powers to an integer exponent, by squaring. A negative exponent gives
+  // 1 / x ** -n, truncated for PW, where 0 to it is a division by zero.
+  OP_PW,   // Power                t := t - 1; s[t] := s[t] ** s[t+1];
+  OP_PWF,  // Power Float          t := t - 1; d[t-1] := d[t-1] ** s[t+1];
+
+  // Superinstructions. They are only created by the VM, when it loads code
+  // or saves it with -save=, and are never emitted by kplc. A
+  // superinstruction keeps the operand words of the sequence it replaces in
+  // the slots following it.
+  OP_ADC,  // LC c; AD         s[t] := s[t] + c;  (LC c; SB becomes ADC -c)
+  OP_LVAC, // LV p,q; LC c; AD t := t + 1; s[t] := s[base(p) + q] + c;
+  OP_MOV,  // LA p,q; LV p',q'; ST  s[base(p) + q] := s[base(p') + q'];
+  OP_MOVC, // LA p,q; LC c; ST      s[base(p) + q] := c;
+  OP_VVEQ, // LV p,q; LV p',q'; EQ; FJ l   if not s[base(p)+q] = s[base(p')+q'] then pc := l;
+  OP_VVNE, // LV p,q; LV p',q'; NE; FJ l
+  OP_VVGT, // LV p,q; LV p',q'; GT; FJ l
+  OP_VVLT, // LV p,q; LV p',q'; LT; FJ l
+  OP_VVGE, // LV p,q; LV p',q'; GE; FJ l
+  OP_VVLE, // LV p,q; LV p',q'; LE; FJ l
+  OP_VCEQ, // LV p,q; LC c; EQ; FJ l       if not s[base(p)+q] = c then pc := l;
+  OP_VCNE, // LV p,q; LC c; NE; FJ l
+  OP_VCGT, // LV p,q; LC c; GT; FJ l
+  OP_VCLT, // LV p,q; LC c; LT; FJ l
+  OP_VCGE, // LV p,q; LC c; GE; FJ l
+  OP_VCLE  // LV p,q; LC c; LE; FJ l
 };
 
+#define NUM_OF_OPCODES (OP_VCLE + 1)
+
 struct Instruction_ {
   enum OpCode op;
   WORD p;
@@ -61,16 +119,65 @@ struct Instruction_ {
 typedef struct Instruction_ Instruction;
 typedef int CodeAddress;
 
+// The code grows as instructions are emitted; maxSize is its capacity
 struct CodeBlock_ {
   Instruction* code;
   int codeSize;
   int maxSize;
+  void* mapping;        // file mapping that code points into, or NULL
+  size_t mappingSize;
+  int fused;            // code holds superinstructions
 };
 
 typedef struct CodeBlock_ CodeBlock;
 
+/*
+ * Executable file: a header, a table of sections, then the sections. The
+ * code section is the array of Instruction, aligned so that it can be
+ * mapped and run in place. All fields are in the byte order of the host.
+ * kplc writes a SECTION_CODE; kplrun -save= writes a SECTION_FUSED_CODE,
+ * which is loaded without fusing it again and so stays mapped.
+ * Files without the magic are taken as a bare array of Instruction, the
+ * format of version 0.
+ */
+#define EXE_MAGIC "KPLX"
+#define EXE_VERSION 1
+#define EXE_MAX_SECTIONS 16
+#define EXE_ALIGNMENT 16
+
+#define SECTION_CODE 1
+#define SECTION_FUSED_CODE 2    // the code, superinstructions already fused
+
+struct ExecutableHeader_ {
+  char magic[4];
+  int version;
+  int sectionCount;
+  int codeLength;       // in instructions
+};
+
+typedef struct ExecutableHeader_ ExecutableHeader;
+
+struct SectionHeader_ {
+  int kind;
+  int offset;           // from the start of the file
+  int size;             // in bytes
+};
+
+typedef struct SectionHeader_ SectionHeader;
+
+typedef enum {
+  LOAD_OK,
+  LOAD_BAD_HEADER,
+  LOAD_BAD_VERSION,
+  LOAD_BAD_SECTION,
+  LOAD_NO_MEMORY,
+  LOAD_TRUNCATED
+} LoadError;
+
 CodeBlock* createCodeBlock(int maxSize);
 void freeCodeBlock(CodeBlock* codeBlock);
+int reserveCode(CodeBlock* codeBlock, int size);
+void shrinkCodeBlock(CodeBlock* codeBlock);
 
 int emitCode(CodeBlock* codeBlock, enum OpCode op, WORD p, WORD q);
 
@@ -107,11 +214,44 @@ int emitLE(CodeBlock* codeBlock);
 
 int emitBP(CodeBlock* codeBlock);
 
+int emitLCF(CodeBlock* codeBlock, double value);
+int emitLVF(CodeBlock* codeBlock, WORD p, WORD q);
+int emitLIF(CodeBlock* codeBlock);
+int emitSTF(CodeBlock* codeBlock);
+int emitADF(CodeBlock* codeBlock);
+int emitSBF(CodeBlock* codeBlock);
+int emitMLF(CodeBlock* codeBlock);
+int emitDVF(CodeBlock* codeBlock);
+int emitNEGF(CodeBlock* codeBlock);
+int emitEQF(CodeBlock* codeBlock);
+int emitNEF(CodeBlock* codeBlock);
+int emitGTF(CodeBlock* codeBlock);
+int emitLTF(CodeBlock* codeBlock);
+int emitGEF(CodeBlock* codeBlock);
+int emitLEF(CodeBlock* codeBlock);
+int emitCVIF(CodeBlock* codeBlock, WORD q);
+int emitCVFI(CodeBlock* codeBlock);
+int emitRF(CodeBlock* codeBlock);
+int emitWRF(CodeBlock* codeBlock);
+int emitEFF(CodeBlock* codeBlock, WORD q);
+
+int emitMVB(CodeBlock* codeBlock, WORD q);
+int emitFLB(CodeBlock* codeBlock, WORD q);
+
+int emitPW(CodeBlock* codeBlock);
+int emitPWF(CodeBlock* codeBlock);
+
+double constantDouble(Instruction* instruction);
+
+int instructionWords(enum OpCode op);
+
 void sprintInstruction(char *buffer,Instruction* instruction);
 void printInstruction(Instruction* instruction);
 void printCodeBlock(CodeBlock* codeBlock);
 
-void loadCode(CodeBlock* codeBlock, FILE* f);
+LoadError loadCode(CodeBlock* codeBlock, FILE* f);
 void saveCode(CodeBlock* codeBlock, FILE* f);
+void unmapCode(CodeBlock* codeBlock);
+char* loadMessage(LoadError err);
 
 #endif
@@ -0,0 +1,750 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+
+/*
+ * Baseline compiler from verified KPL code to x86-64, one template per
+ * instruction. The native code works on the VM stack itself, with the same
+ * frames (result, DL, RA, SL at b..b+3) and the same display, so it can
+ * leave to run() after any instruction and be entered again before any
+ * other. Registers while native code runs:
+ *   rbx  the stack          r12  t          r13  b
+ *   r14  nativeTable        r15  saved return address (EP, EF)
+ * Return addresses on the stack stay code addresses: EP and EF go on
+ * through nativeTable, to the LANDING_SIZE bytes just before the code
+ * after the CALL, where the caller restores the display it knows the
+ * level of. I/O goes through the functions of vm.c. The code
+ * is compiled for one VM: the addresses of its registers and display, and
+ * the VM itself as first argument of those calls, are built in.
+ * Instructions without a template (break points, unreachable code) leave
+ * to run() like they do from the threaded engines.
+ */
+
+int readCharIO(VM* vm, WORD* value);
+int readIntIO(VM* vm, WORD* value);
+void writeCharIO(VM* vm, WORD value);
+void writeIntIO(VM* vm, WORD value);
+void writeLnIO(VM* vm);
+int readDoubleIO(VM* vm, WORD* at);
+void writeDoubleIO(VM* vm, WORD* at);
+int moveBlock(VM* vm, WORD to, WORD from, WORD q);
+int fillBlock(VM* vm, WORD to, WORD value, WORD q);
+int powerInt(WORD* at, WORD n);
+void powerDouble(WORD* at, WORD n);
+void restoreDisplay(VM* vm, int returnPc);
+
+typedef void (*NativeEntry)(Memory s, long t, long b, void** table, void* target);
+
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RSI 6
+#define RDI 7
+#define R12 12
+#define R13 13
+#define R14 14
+#define R15 15
+#define NONE -1
+
+// Condition codes, added to 0x0F 0x80 (jcc) or 0x0F 0x90 (setcc)
+#define CC_AE 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_A  0x7
+#define CC_P  0xA
+#define CC_NP 0xB
+#define CC_L  0xC
+#define CC_GE 0xD
+#define CC_LE 0xE
+#define CC_G  0xF
+
+// The prologue comes first in the native code
+#define ENTRY_OFFSET 0
+// Code of a CALL run on return, ahead of the next instruction
+#define LANDING_SIZE 48
+
+// The code is assembled into this buffer, then copied to nativeCode.
+// Each thread has its own, so VMs on different threads compile at once.
+static __thread unsigned char* buffer;
+static __thread int length;
+static __thread int capacity;
+static __thread int exitOffset;
+
+struct Patch {
+  int offset;        // of a rel32 field
+  int target;        // code address it jumps to
+};
+
+static __thread struct Patch* patches;
+static __thread int patchCount;
+
+static void emitByte(int byte) {
+  if (length == capacity) {
+    capacity *= 2;
+    buffer = (unsigned char*) realloc(buffer, capacity);
+  }
+  buffer[length++] = byte;
+}
+
+static void emit32(int value) {
+  emitByte(value & 0xFF);
+  emitByte((value >> 8) & 0xFF);
+  emitByte((value >> 16) & 0xFF);
+  emitByte((value >> 24) & 0xFF);
+}
+
+static void emit64(long value) {
+  emit32((int) value);
+  emit32((int) (value >> 32));
+}
+
+static void emitOpcode(int opcode) {
+  if (opcode > 0xFF) emitByte(opcode >> 8);
+  emitByte(opcode & 0xFF);
+}
+
+// opcode reg, [base + index * scale + disp]; w selects 64-bit operands
+static void emitMem(int w, int opcode, int reg, int base, int index, int scale, int disp) {
+  int rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (base >> 3);
+  int ss = (scale == 8) ? 3 : ((scale == 4) ? 2 : 0);
+
+  if (index != NONE) rex |= (index >> 3) << 1;
+  if (rex != 0x40) emitByte(rex);
+  emitOpcode(opcode);
+  // Always a SIB byte and a 32-bit displacement
+  emitByte(0x80 | ((reg & 7) << 3) | 4);
+  emitByte((ss << 6) | (((index == NONE) ? 4 : index) & 7) << 3 | (base & 7));
+  emit32(disp);
+}
+
+// opcode reg, rm between registers
+static void emitReg(int w, int opcode, int reg, int rm) {
+  int rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+
+  if (rex != 0x40) emitByte(rex);
+  emitOpcode(opcode);
+  emitByte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// The slot t + offset of the stack
+static void emitTop(int w, int opcode, int reg, int offset) {
+  emitMem(w, opcode, reg, RBX, R12, 4, offset * 4);
+}
+
+static void emitMovImm64(int reg, long value) {
+  emitByte(0x48 | (reg >> 3));
+  emitByte(0xB8 + (reg & 7));
+  emit64(value);
+}
+
+static void emitMovImm32(int reg, int value) {
+  if (reg >= 8) emitByte(0x41);
+  emitByte(0xB8 + (reg & 7));
+  emit32(value);
+}
+
+static void emitCall(void* function) {
+  emitMovImm64(RAX, (long) function);
+  emitReg(0, 0xFF, 2, RAX);
+}
+
+static void emitJumpTo(int opcode, int target) {
+  emitOpcode(opcode);
+  patches[patchCount].offset = length;
+  patches[patchCount].target = target;
+  patchCount ++;
+  emit32(0);
+}
+
+// Leaves to run() with the given state, pc = next
+static void emitExit(int state, int next) {
+  emitMovImm32(RDI, state);
+  emitMovImm32(RSI, next);
+  emitByte(0xE9);
+  emit32(exitOffset - (length + 4));
+}
+
+// Same, unless the condition holds
+static void emitExitUnless(int cc, int state, int next) {
+  emitByte(0x70 + cc);
+  emitByte(15);
+  emitExit(state, next);
+}
+
+// eax = base(p) for the code at the given static level
+static void emitBase(VM* vm, int p, int level) {
+  if (p == 0)
+    emitReg(0, 0x89, R13, RAX);
+  else {
+    emitMovImm64(RAX, (long) &vm->display[level - p]);
+    emitMem(0, 0x8B, RAX, RAX, NONE, 1, 0);
+  }
+}
+
+// reg = stack[base(p) + q]
+static void emitLoadVar(VM* vm, int reg, int p, int q, int level) {
+  emitBase(vm, p, level);
+  emitMem(0, 0x8B, reg, RBX, RAX, 4, q * 4);
+}
+
+static void emitPush(int reg) {
+  emitReg(1, 0xFF, 0, R12);
+  emitTop(0, 0x89, reg, 0);
+}
+
+// Goes on after the CALL at r15, through its landing
+static void emitReturnJump(void) {
+  emitMem(1, 0x8B, RAX, R14, R15, 8, 8);        // nativeTable[ra + 1]
+  emitReg(1, 0x81, 5, RAX);                     // - LANDING_SIZE
+  emit32(LANDING_SIZE);
+  emitReg(0, 0xFF, 4, RAX);
+}
+
+static void emitReturn(VM* vm, int function) {
+  if (function)
+    emitReg(1, 0x89, R13, R12);                 // t = b
+  else emitMem(1, 0x8D, R12, R13, NONE, 1, -1); // t = b - 1
+  emitMem(0, 0x8B, R15, RBX, R13, 4, 8);        // return address
+  emitMem(1, 0x63, R13, RBX, R13, 4, 4);        // b = dynamic link
+  emitReturnJump();
+}
+
+// EFF q: the double at b + q becomes the result, over the result and DL
+static void emitFloatReturn(int q) {
+  emitMem(0, 0x8B, R15, RBX, R13, 4, 8);        // return address
+  emitMem(1, 0x63, RCX, RBX, R13, 4, 4);        // dynamic link
+  emitByte(0xF2);
+  emitMem(0, 0x0F10, 0, RBX, R13, 4, q * 4);    // movsd xmm0, [b + q]
+  emitByte(0xF2);
+  emitMem(0, 0x0F11, 0, RBX, R13, 4, 0);
+  emitMem(1, 0x8D, R12, R13, NONE, 1, 1);       // t = b + 1
+  emitReg(1, 0x89, RCX, R13);                   // b = dynamic link
+  emitReturnJump();
+}
+
+/*
+ * Display of the caller at the given level once a call with this p has
+ * returned (see leaveDisplay in vm.c): the level back after a nested
+ * procedure, its own frame after one at the same level, the whole display
+ * otherwise. Always LANDING_SIZE bytes.
+ */
+static void emitLanding(VM* vm, int i, int p, int level) {
+  int start = length;
+
+  if (p == 0) {
+    emitMovImm64(RAX, (long) &vm->currentLevel);
+    emitMem(0, 0xC7, 0, RAX, NONE, 1, 0);
+    emit32(level);
+  } else if (p == 1) {
+    emitMovImm64(RAX, (long) &vm->display[level]);
+    emitMem(0, 0x89, R13, RAX, NONE, 1, 0);
+  } else {
+    emitMovImm64(RAX, (long) &vm->b);
+    emitMem(0, 0x89, R13, RAX, NONE, 1, 0);
+    emitMovImm32(RSI, i);
+    emitMovImm64(RDI, (long) vm);
+    emitCall(restoreDisplay);
+  }
+  // Over the rest
+  emitByte(0xEB);
+  emitByte(LANDING_SIZE - (length + 1 - start));
+  while (length - start < LANDING_SIZE)
+    emitByte(0xCC);
+}
+
+static void emitCompare(int cc) {
+  emitTop(0, 0x8B, RAX, 0);
+  emitReg(1, 0xFF, 1, R12);
+  emitReg(0, 0x31, RCX, RCX);
+  emitTop(0, 0x39, RAX, 0);
+  emitOpcode(0x0F90 + cc);
+  emitByte(0xC0 | RCX);
+  emitTop(0, 0x89, RCX, 0);
+}
+
+// Jumps to code[pc+2].q unless stack[base(p) + q] cc right
+static void emitCompareJump(VM* vm, Instruction* inst, int level) {
+  // Jump when the comparison fails, in the order EQ NE GT LT GE LE
+  static const int otherwise[6] = { CC_NE, CC_E, CC_LE, CC_GE, CC_L, CC_G };
+  int constant = (inst->op >= OP_VCEQ);
+  int cmp = inst->op - (constant ? OP_VCEQ : OP_VVEQ);
+
+  emitLoadVar(vm, RCX, inst->p, inst->q, level);
+  if (constant) {
+    emitReg(0, 0x81, 7, RCX);
+    emit32(inst[1].q);
+  } else {
+    emitBase(vm, inst[1].p, level);
+    emitMem(0, 0x3B, RCX, RBX, RAX, 4, inst[1].q * 4);
+  }
+  emitJumpTo(0x0F80 + otherwise[cmp], inst[2].q);
+}
+
+// SSE2 instructions on the slot t + offset: movsd, addsd, ucomisd...
+static void emitFloatTop(int prefix, int opcode, int offset) {
+  emitByte(prefix);
+  emitTop(0, opcode, 0, offset);
+}
+
+// t -= 2, then d[t-1] = d[t-1] op d[t+1]
+static void emitFloatArith(int opcode) {
+  emitReg(1, 0x81, 5, R12);
+  emit32(2);
+  emitFloatTop(0xF2, 0x0F10, -1);
+  emitFloatTop(0xF2, opcode, 1);
+  emitFloatTop(0xF2, 0x0F11, -1);
+}
+
+/*
+ * t -= 3, then s[t] = d[t] cmp d[t+2]. Unordered (NaN) compares are false
+ * but for NE: LT and LE compare the other way round, so that above and
+ * above-or-equal see the unordered case as false.
+ */
+static void emitFloatCompare(int op) {
+  int swap = (op == OP_LTF) || (op == OP_LEF);
+
+  emitReg(1, 0x81, 5, R12);
+  emit32(3);
+  emitReg(0, 0x31, RCX, RCX);
+  emitReg(0, 0x31, RAX, RAX);
+  emitFloatTop(0xF2, 0x0F10, swap ? 2 : 0);
+  emitFloatTop(0x66, 0x0F2E, swap ? 0 : 2);
+  switch (op) {
+  case OP_EQF:
+    emitOpcode(0x0F90 + CC_E); emitByte(0xC0 | RCX);
+    emitOpcode(0x0F90 + CC_NP); emitByte(0xC0 | RAX);
+    emitReg(0, 0x21, RAX, RCX);
+    break;
+  case OP_NEF:
+    emitOpcode(0x0F90 + CC_NE); emitByte(0xC0 | RCX);
+    emitOpcode(0x0F90 + CC_P); emitByte(0xC0 | RAX);
+    emitReg(0, 0x09, RAX, RCX);
+    break;
+  case OP_GTF: case OP_LTF:
+    emitOpcode(0x0F90 + CC_A); emitByte(0xC0 | RCX);
+    break;
+  default:
+    emitOpcode(0x0F90 + CC_AE); emitByte(0xC0 | RCX);
+    break;
+  }
+  emitTop(0, 0x89, RCX, 0);
+}
+
+static void emitInstruction(VM* vm, Instruction* code, int i) {
+  Instruction* inst = &code[i];
+  int level = vm->codeLevels[i];
+  int k;
+
+  if (level < 0) {
+    // Unreachable
+    emitExit(PS_ACTIVE, i);
+    return;
+  }
+
+  switch (inst->op) {
+  case OP_LA:
+    emitBase(vm, inst->p, level);
+    emitReg(0, 0x81, 0, RAX);
+    emit32(inst->q);
+    emitPush(RAX);
+    break;
+  case OP_LV:
+    emitLoadVar(vm, RAX, inst->p, inst->q, level);
+    emitPush(RAX);
+    break;
+  case OP_LC:
+    emitReg(1, 0xFF, 0, R12);
+    emitTop(0, 0xC7, 0, 0);
+    emit32(inst->q);
+    break;
+  case OP_LI:
+    emitTop(1, 0x63, RAX, 0);
+    emitMem(0, 0x8B, RAX, RBX, RAX, 4, 0);
+    emitTop(0, 0x89, RAX, 0);
+    break;
+  case OP_INT:
+    emitReg(1, 0x81, 0, R12);
+    emit32(inst->q);
+    break;
+  case OP_DCT:
+    emitReg(1, 0x81, 5, R12);
+    emit32(inst->q);
+    break;
+  case OP_J:
+    emitJumpTo(0xE9, inst->q);
+    break;
+  case OP_FJ:
+    emitTop(0, 0x8B, RAX, 0);
+    emitReg(1, 0xFF, 1, R12);
+    emitReg(0, 0x85, RAX, RAX);
+    emitJumpTo(0x0F80 + CC_E, inst->q);
+    break;
+  case OP_HL:
+    emitExit(PS_NORMAL_EXIT, i + 1);
+    break;
+  case OP_ST:
+    emitTop(1, 0x63, RAX, -1);
+    emitTop(0, 0x8B, RCX, 0);
+    emitMem(0, 0x89, RCX, RBX, RAX, 4, 0);
+    emitReg(1, 0x81, 5, R12);
+    emit32(2);
+    break;
+  case OP_CALL:
+    // Frame-entry check, as checkFrame() in vm.c
+    emitMem(1, 0x8D, RAX, R12, NONE, 1, 1 + vm->frameSizes[inst->q]);
+    emitReg(1, 0x81, 7, RAX);
+    emit32(vm->stackSize);
+    emitExitUnless(CC_LE, PS_STACK_OVERFLOW, i + 1);
+    emitTop(0, 0x89, R13, 2);                   // Dynamic Link
+    emitTop(0, 0xC7, 0, 3);                     // Return Address
+    emit32(i);
+    emitBase(vm, inst->p, level);
+    emitTop(0, 0x89, RAX, 4);                   // Static Link
+    emitMem(1, 0x8D, R13, R12, NONE, 1, 1);     // Base & Result
+    emitMovImm64(RAX, (long) &vm->currentLevel);
+    emitMem(0, 0xC7, 0, RAX, NONE, 1, 0);
+    emit32(level - inst->p + 1);
+    emitMovImm64(RAX, (long) &vm->display[level - inst->p + 1]);
+    emitMem(0, 0x89, R13, RAX, NONE, 1, 0);
+    emitJumpTo(0xE9, inst->q);
+    emitLanding(vm, i, inst->p, level);
+    break;
+  case OP_EP:
+    emitReturn(vm, 0);
+    break;
+  case OP_EF:
+    emitReturn(vm, 1);
+    break;
+  case OP_RC:
+  case OP_RI:
+    emitReg(1, 0xFF, 0, R12);
+    emitMem(1, 0x8D, RSI, RBX, R12, 4, 0);
+    emitMovImm64(RDI, (long) vm);
+    emitCall((inst->op == OP_RC) ? (void*) readCharIO : (void*) readIntIO);
+    emitReg(0, 0x85, RAX, RAX);
+    emitExitUnless(CC_NE, PS_IO_ERROR, i + 1);
+    break;
+  case OP_WRC:
+  case OP_WRI:
+    emitTop(0, 0x8B, RSI, 0);
+    emitMovImm64(RDI, (long) vm);
+    emitCall((inst->op == OP_WRC) ? (void*) writeCharIO : (void*) writeIntIO);
+    emitReg(1, 0xFF, 1, R12);
+    break;
+  case OP_WLN:
+    emitMovImm64(RDI, (long) vm);
+    emitCall(writeLnIO);
+    break;
+  case OP_AD:
+  case OP_SB:
+    emitTop(0, 0x8B, RAX, 0);
+    emitReg(1, 0xFF, 1, R12);
+    emitTop(0, (inst->op == OP_AD) ? 0x01 : 0x29, RAX, 0);
+    break;
+  case OP_ML:
+    emitTop(0, 0x8B, RAX, 0);
+    emitReg(1, 0xFF, 1, R12);
+    emitTop(0, 0x0FAF, RAX, 0);
+    emitTop(0, 0x89, RAX, 0);
+    break;
+  case OP_DV:
+    emitTop(0, 0x8B, RCX, 0);
+    emitReg(1, 0xFF, 1, R12);
+    emitReg(0, 0x85, RCX, RCX);
+    emitExitUnless(CC_NE, PS_DIVIDE_BY_ZERO, i + 1);
+    emitTop(0, 0x8B, RAX, 0);
+    emitByte(0x99);                             // cdq
+    emitReg(0, 0xF7, 7, RCX);                   // idiv ecx
+    emitTop(0, 0x89, RAX, 0);
+    break;
+  case OP_NEG:
+    emitTop(0, 0xF7, 3, 0);
+    break;
+  case OP_CV:
+    emitTop(0, 0x8B, RAX, 0);
+    emitTop(0, 0x89, RAX, 1);
+    emitReg(1, 0xFF, 0, R12);
+    break;
+  case OP_EQ: emitCompare(CC_E); break;
+  case OP_NE: emitCompare(CC_NE); break;
+  case OP_GT: emitCompare(CC_G); break;
+  case OP_LT: emitCompare(CC_L); break;
+  case OP_GE: emitCompare(CC_GE); break;
+  case OP_LE: emitCompare(CC_LE); break;
+  case OP_ADC:
+    emitTop(0, 0x81, 0, 0);
+    emit32(inst->q);
+    break;
+  case OP_LVAC:
+    emitLoadVar(vm, RAX, inst->p, inst->q, level);
+    emitReg(0, 0x81, 0, RAX);
+    emit32(inst[1].q);
+    emitPush(RAX);
+    break;
+  case OP_MOV:
+    emitLoadVar(vm, RCX, inst[1].p, inst[1].q, level);
+    emitBase(vm, inst->p, level);
+    emitMem(0, 0x89, RCX, RBX, RAX, 4, inst->q * 4);
+    break;
+  case OP_MOVC:
+    emitBase(vm, inst->p, level);
+    emitMem(0, 0xC7, 0, RBX, RAX, 4, inst->q * 4);
+    emit32(inst[1].q);
+    break;
+  case OP_VVEQ: case OP_VVNE: case OP_VVGT:
+  case OP_VVLT: case OP_VVGE: case OP_VVLE:
+  case OP_VCEQ: case OP_VCNE: case OP_VCGT:
+  case OP_VCLT: case OP_VCGE: case OP_VCLE:
+    emitCompareJump(vm, inst, level);
+    break;
+  case OP_LCF:
+    // One 8-byte store, which the movsd reading it can forward from
+    emitMovImm64(RAX, ((long) (unsigned int) inst->q << 32) | (unsigned int) inst->p);
+    emitReg(1, 0x81, 0, R12);
+    emit32(2);
+    emitTop(1, 0x89, RAX, -1);
+    break;
+  case OP_LVF:
+    emitBase(vm, inst->p, level);
+    emitByte(0xF2);
+    emitMem(0, 0x0F10, 0, RBX, RAX, 4, inst->q * 4);
+    emitReg(1, 0x81, 0, R12);
+    emit32(2);
+    emitFloatTop(0xF2, 0x0F11, -1);
+    break;
+  case OP_LIF:
+    emitTop(1, 0x63, RAX, 0);
+    emitByte(0xF2);
+    emitMem(0, 0x0F10, 0, RBX, RAX, 4, 0);
+    emitReg(1, 0xFF, 0, R12);
+    emitFloatTop(0xF2, 0x0F11, -1);
+    break;
+  case OP_STF:
+    emitTop(1, 0x63, RAX, -2);
+    emitFloatTop(0xF2, 0x0F10, -1);
+    emitByte(0xF2);
+    emitMem(0, 0x0F11, 0, RBX, RAX, 4, 0);
+    emitReg(1, 0x81, 5, R12);
+    emit32(3);
+    break;
+  case OP_ADF: emitFloatArith(0x0F58); break;
+  case OP_SBF: emitFloatArith(0x0F5C); break;
+  case OP_MLF: emitFloatArith(0x0F59); break;
+  case OP_DVF: emitFloatArith(0x0F5E); break;
+  case OP_NEGF:
+    emitTop(0, 0x81, 6, 0);                     // the sign, in the high word
+    emit32(0x80000000);
+    break;
+  case OP_EQF: case OP_NEF: case OP_GTF:
+  case OP_LTF: case OP_GEF: case OP_LEF:
+    emitFloatCompare(inst->op);
+    break;
+  case OP_CVIF:
+    // The q words above the integer move up one slot
+    for (k = 0; k < inst->q; k ++) {
+      emitTop(0, 0x8B, RAX, -k);
+      emitTop(0, 0x89, RAX, 1 - k);
+    }
+    emitFloatTop(0xF2, 0x0F2A, -inst->q);       // cvtsi2sd xmm0, dword
+    emitFloatTop(0xF2, 0x0F11, -inst->q);
+    emitReg(1, 0xFF, 0, R12);
+    break;
+  case OP_CVFI:
+    emitByte(0xF2);
+    emitTop(0, 0x0F2C, RAX, -1);                // cvttsd2si, INT_MIN when out of range
+    emitReg(1, 0xFF, 1, R12);
+    emitTop(0, 0x89, RAX, 0);
+    break;
+  case OP_RF:
+    emitReg(1, 0x81, 0, R12);
+    emit32(2);
+    emitMem(1, 0x8D, RSI, RBX, R12, 4, -4);
+    emitMovImm64(RDI, (long) vm);
+    emitCall(readDoubleIO);
+    emitReg(0, 0x85, RAX, RAX);
+    emitExitUnless(CC_NE, PS_IO_ERROR, i + 1);
+    break;
+  case OP_WRF:
+    emitMem(1, 0x8D, RSI, RBX, R12, 4, -4);
+    emitMovImm64(RDI, (long) vm);
+    emitCall(writeDoubleIO);
+    emitReg(1, 0x81, 5, R12);
+    emit32(2);
+    break;
+  case OP_EFF:
+    emitFloatReturn(inst->q);
+    break;
+  case OP_MVB:
+  case OP_FLB:
+    emitTop(0, 0x8B, RSI, -1);
+    emitTop(0, 0x8B, RDX, 0);
+    emitMovImm32(RCX, inst->q);
+    emitMovImm64(RDI, (long) vm);
+    emitCall((inst->op == OP_MVB) ? (void*) moveBlock : (void*) fillBlock);
+    emitReg(1, 0x81, 5, R12);
+    emit32(2);
+    emitReg(0, 0x85, RAX, RAX);
+    emitExitUnless(CC_NE, PS_STACK_OVERFLOW, i + 1);
+    break;
+  case OP_PW:
+  case OP_PWF:
+    emitTop(0, 0x8B, RSI, 0);
+    emitReg(1, 0xFF, 1, R12);
+    emitMem(1, 0x8D, RDI, RBX, R12, 4, (inst->op == OP_PW) ? 0 : -4);
+    if (inst->op == OP_PW) {
+      emitCall(powerInt);
+      emitReg(0, 0x85, RAX, RAX);
+      emitExitUnless(CC_NE, PS_DIVIDE_BY_ZERO, i + 1);
+    } else
+      emitCall(powerDouble);
+    break;
+  default:
+    // Break points and anything else are left to run()
+    emitExit(PS_ACTIVE, i);
+    break;
+  }
+}
+
+/*
+ * Translates the whole (verified, possibly fused) code block. Returns 0 when
+ * no executable memory can be had, in which case the interpreter runs.
+ */
+int compileNative(VM* vm) {
+  Instruction* code = vm->codeBlock->code;
+  int n = vm->codeBlock->codeSize;
+  int* offsets = (int*) malloc((n + 1) * sizeof(int));
+  size_t pageSize = 4096;
+  int i, k;
+
+  freeNative(vm);
+  capacity = 4096;
+  length = 0;
+  buffer = (unsigned char*) malloc(capacity);
+  patches = (struct Patch*) malloc((n + 1) * sizeof(struct Patch));
+  patchCount = 0;
+
+  // Prologue: void entry(s, t, b, table, target)
+  emitByte(0x53);                               // push rbx
+  emitByte(0x41); emitByte(0x54);               // push r12
+  emitByte(0x41); emitByte(0x55);               // push r13
+  emitByte(0x41); emitByte(0x56);               // push r14
+  emitByte(0x41); emitByte(0x57);               // push r15
+  emitReg(1, 0x89, RDI, RBX);
+  emitReg(1, 0x89, RSI, R12);
+  emitReg(1, 0x89, RDX, R13);
+  emitReg(1, 0x89, RCX, R14);
+  emitByte(0x41); emitByte(0xFF); emitByte(0xE0); // jmp r8
+
+  // Common exit: edi = ps, esi = pc
+  exitOffset = length;
+  emitMovImm64(RAX, (long) &vm->t);
+  emitMem(0, 0x89, R12, RAX, NONE, 1, 0);
+  emitMovImm64(RAX, (long) &vm->b);
+  emitMem(0, 0x89, R13, RAX, NONE, 1, 0);
+  emitMovImm64(RAX, (long) &vm->ps);
+  emitMem(0, 0x89, RDI, RAX, NONE, 1, 0);
+  emitMovImm64(RAX, (long) &vm->pc);
+  emitMem(0, 0x89, RSI, RAX, NONE, 1, 0);
+  emitByte(0x41); emitByte(0x5F);               // pop r15
+  emitByte(0x41); emitByte(0x5E);               // pop r14
+  emitByte(0x41); emitByte(0x5D);               // pop r13
+  emitByte(0x41); emitByte(0x5C);               // pop r12
+  emitByte(0x5B);                               // pop rbx
+  emitByte(0xC3);                               // ret
+
+  i = 0;
+  while (i < n) {
+    int words = instructionWords(code[i].op);
+
+    // Operands of a superinstruction are never entered on their own
+    for (k = 0; (k < words) && (i + k < n); k ++)
+      offsets[i + k] = length;
+    emitInstruction(vm, code, i);
+    i += words;
+  }
+  offsets[n] = length;
+  emitExit(PS_ACTIVE, n);
+
+  for (k = 0; k < patchCount; k ++) {
+    int at = patches[k].offset;
+    int rel = offsets[patches[k].target] - (at + 4);
+    memcpy(buffer + at, &rel, 4);
+  }
+
+  vm->nativeSize = (length + pageSize - 1) & ~(pageSize - 1);
+  vm->nativeCode = (unsigned char*) mmap(NULL, vm->nativeSize, PROT_READ | PROT_WRITE,
+				     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (vm->nativeCode == MAP_FAILED) {
+    vm->nativeCode = NULL;
+  } else {
+    memcpy(vm->nativeCode, buffer, length);
+    if (mprotect(vm->nativeCode, vm->nativeSize, PROT_READ | PROT_EXEC) != 0) {
+      munmap(vm->nativeCode, vm->nativeSize);
+      vm->nativeCode = NULL;
+    }
+  }
+
+  if (vm->nativeCode != NULL) {
+    vm->nativeTable = (void**) malloc((n + 1) * sizeof(void*));
+    for (i = 0; i <= n; i ++)
+      vm->nativeTable[i] = vm->nativeCode + offsets[i];
+  }
+
+  free(offsets);
+  free(patches);
+  free(buffer);
+  return vm->nativeCode != NULL;
+}
+
+/*
+ * Runs native code from pc until it leaves to run(). Returns 0 if there is
+ * no native code for this program.
+ */
+int runNative(VM* vm) {
+  NativeEntry entry;
+
+  if ((vm->nativeCode == NULL) && !compileNative(vm))
+    return 0;
+  entry = (NativeEntry) (vm->nativeCode + ENTRY_OFFSET);
+  entry(vm->stack, vm->t, vm->b, vm->nativeTable, vm->nativeTable[vm->pc]);
+  return 1;
+}
+
+void freeNative(VM* vm) {
+  if (vm->nativeCode != NULL)
+    munmap(vm->nativeCode, vm->nativeSize);
+  vm->nativeCode = NULL;
+  free(vm->nativeTable);
+  vm->nativeTable = NULL;
+}
+
+#else
+
+// No code generator for this machine: the interpreter runs instead
+
+int compileNative(VM* vm) {
+  return 0;
+}
+
+int runNative(VM* vm) {
+  return 0;
+}
+
+void freeNative(VM* vm) {
+}
+
+#endif
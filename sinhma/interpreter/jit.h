@@ -0,0 +1,16 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "vm.h"
+
+int compileNative(VM* vm);
+int runNative(VM* vm);
+void freeNative(VM* vm);
+
+#endif
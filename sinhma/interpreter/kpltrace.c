@@ -0,0 +1,99 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "instructions.h"
+#include "trace.h"
+#include "vm.h"
+
+#define DEFAULT_CODE_SIZE 1024
+
+void printUsage(void) {
+  printf("Usage: kpltrace trace program\n");
+  printf("   trace: trace file written by kplrun -trace=trace\n");
+  printf("   program: the kpl program that was traced\n");
+}
+
+void printReason(int reason) {
+  printf("Stopped by ");
+  switch (reason) {
+  case PS_ACTIVE: printf("kplrun while active\n"); break;
+  case PS_NORMAL_EXIT: printf("normal exit\n"); break;
+  case PS_IO_ERROR: printf("runtime error: IO error!\n"); break;
+  case PS_DIVIDE_BY_ZERO: printf("runtime error: Divide by zero!\n"); break;
+  case PS_STACK_OVERFLOW: printf("runtime error: Stack overflow!\n"); break;
+  default:
+    if (reason < 0) printf("signal %d\n", - reason);
+    else printf("state %d\n", reason);
+    break;
+  }
+}
+
+/******************************************************************/
+
+int main(int argc, char *argv[]) {
+  TraceHeader header;
+  TraceRecord record;
+  CodeBlock* codeBlock;
+  LoadError error;
+  FILE* f;
+  FILE* program;
+  unsigned long long sequence;
+  int i;
+
+  if (argc != 3) {
+    printUsage();
+    return -1;
+  }
+
+  f = fopen(argv[1], "rb");
+  if (f == NULL) {
+    printf("kpltrace: Can\'t read trace file!\n");
+    return -1;
+  }
+  if ((fread(&header, sizeof(header), 1, f) != 1)
+      || (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0)
+      || (header.version != TRACE_VERSION) || (header.recordSize != sizeof(TraceRecord))) {
+    printf("kpltrace: Wrong trace format!\n");
+    fclose(f);
+    return -1;
+  }
+
+  program = fopen(argv[2], "r");
+  if (program == NULL) {
+    printf("kpltrace: Can\'t read program file!\n");
+    return -1;
+  }
+  codeBlock = createCodeBlock(DEFAULT_CODE_SIZE);
+  error = loadCode(codeBlock, program);
+  fclose(program);
+  if (error != LOAD_OK) {
+    printf("kpltrace: %s\n", loadMessage(error));
+    return -1;
+  }
+
+  printf("%llu instructions executed, the last %d traced\n", header.total, header.count);
+  printReason(header.reason);
+  sequence = header.total - header.count;
+  for (i = 0; i < header.count; i ++) {
+    if (fread(&record, sizeof(record), 1, f) != 1) {
+      printf("kpltrace: Trace file truncated!\n");
+      break;
+    }
+    printf("%12llu %6d:  ", sequence ++, record.pc);
+    if ((record.pc >= 0) && (record.pc < codeBlock->codeSize) && (codeBlock->code[record.pc].op == record.op))
+      printInstruction(&codeBlock->code[record.pc]);
+    else printf("? (opcode %d, not the program traced)", record.op);
+    printf("\t t=%d b=%d s[t]=%d\n", record.t, record.b, record.top);
+  }
+
+  fclose(f);
+  freeCodeBlock(codeBlock);
+  return 0;
+}
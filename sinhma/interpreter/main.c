@@ -7,56 +7,312 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "vm.h"
-#define DEFAULT_STACK_SIZE 2048
+#include "verifier.h"
+#include "packed.h"
+#include "batch.h"
+#include "snapshot.h"
+#include "serve.h"
+// Reserved, not allocated: pages are committed as the stack reaches them
+#define DEFAULT_STACK_SIZE (1 << 24)
 #define DEFAULT_CODE_SIZE 1024
+#define MAX_PROGRAMS 16
 
-extern int debugMode;
-extern int stackSize;
-extern int codeSize;
-
+VM vm;
 int dumpCode;
+int statMode;
+char* saveFile;
+int benchThreads;
+int profileMode;
+char* traceFile;
+char* snapshotFile;
+char* restoreFile;
+char* batchPath;
+int batchJobs;
+char* serveSocket;
+// The programs served besides the input one
+char* programFiles[MAX_PROGRAMS];
+int programCount;
+
+// Shared by the threads of -bench=
+char* benchProgram;
+char* benchInput;
+size_t benchInputSize;
 
 
 void printUsage(void) {
-  printf("Usage: kplrun input [-s=stack_size] [-c=code_size] [-debug] [-dump]\n");
+  printf("Usage: kplrun input [-s=stack_size] [-c=code_size] [-debug] [-dump] [-save=output] [-threaded] [-cached] [-jit] [-packed] [-register] [-nofuse] [-hugepages] [-stat] [-profile] [-trace=file] [-snapshot=file] [-restore=file] [-bench=threads] [-batch=inputs] [-serve=socket] [-program=file] [-jobs=threads]\n");
   printf("   input: input kpl program\n");
-  printf("   -s=stack_size: set the stack size\n");
-  printf("   -c=code_size: set the code size\n");
-  printf("   -debug: enable code dump\n");
+  printf("   -s=stack_size: set the maximum stack size, in words (reserved, used on demand)\n");
+  printf("   -c=code_size: set the initial code size (it grows as needed)\n");
+  printf("   -debug: enable code dump (interactive, runs under curses)\n");
+  printf("   -save=output: write the program to output in the current executable format, with its superinstructions unless -nofuse, so that it runs where it is mapped\n");
+  printf("   -threaded: run with the direct-threaded engine\n");
+  printf("   -cached: run with the threaded engine that keeps the stack top in registers\n");
+  printf("   -jit: compile to native code (x86-64), interpreting what it cannot compile\n");
+  printf("   -packed: run from the compact encoding of the code\n");
+  printf("   -register: run the code translated into three-operand register instructions\n");
+  printf("   -nofuse: do not replace instruction sequences by superinstructions; the code then runs where it is mapped\n");
+  printf("   -hugepages: back the stack with transparent huge pages\n");
+  printf("   -stat: print loading statistics on stderr\n");
+  printf("   -batch=inputs: run the program on every file of a directory, or every file listed\n");
+  printf("                  in a file, writing the output of each input to input.out\n");
+  printf("   -serve=socket: run the program for every request on a Unix socket (see serve.h),\n");
+  printf("                  until interrupted\n");
+  printf("   -program=file: serve this program too, by its name (repeatable)\n");
+  printf("   -jobs=threads: number of threads of -batch and -serve (default: one per processor)\n");
+  printf("   -profile: count the instructions executed and report on stderr where they went\n");
+  printf("   -trace=file: keep the last instructions executed and write them to file when the\n");
+  printf("                program ends, fails or is killed (see kpltrace)\n");
+  printf("   -snapshot=file: at the first break point (call checkpoint in KPL), write the state of the program to file\n");
+  printf("                   and stop\n");
+  printf("   -restore=file: resume the program from a snapshot (same program, same options)\n");
+  printf("   -bench=threads: run the program once per thread, all at once, on the same input\n");
 }
 
 int analyseParam(char* param) {
   if (strncmp(param, "-s=", 3) == 0) {
-    stackSize = atoi(param+3);
+    vm.stackSize = atoi(param+3);
     return 1;
   }
   if (strncmp(param, "-c=", 3) == 0) {
-    codeSize = atoi(param+3);
+    vm.codeSize = atoi(param+3);
     return 1;
   }
   if (strcmp(param, "-debug") == 0) {
-    debugMode = 1;
+    vm.debugMode = 1;
     return 1;
   }
   if (strcmp(param, "-dump") == 0) {
     dumpCode = 1;
     return 1;
   }
+  if (strncmp(param, "-save=", 6) == 0) {
+    saveFile = param + 6;
+    return 1;
+  }
+  if (strcmp(param, "-threaded") == 0) {
+    vm.engine = ENGINE_THREADED;
+    return 1;
+  }
+  if (strcmp(param, "-cached") == 0) {
+    vm.engine = ENGINE_CACHED;
+    return 1;
+  }
+  if (strcmp(param, "-jit") == 0) {
+    vm.engine = ENGINE_NATIVE;
+    return 1;
+  }
+  if (strcmp(param, "-packed") == 0) {
+    vm.engine = ENGINE_PACKED;
+    return 1;
+  }
+  if (strcmp(param, "-register") == 0) {
+    vm.engine = ENGINE_REGISTER;
+    return 1;
+  }
+  if (strcmp(param, "-nofuse") == 0) {
+    vm.fuseMode = 0;
+    return 1;
+  }
+  if (strcmp(param, "-hugepages") == 0) {
+    vm.hugePages = 1;
+    return 1;
+  }
+  if (strcmp(param, "-profile") == 0) {
+    profileMode = 1;
+    return 1;
+  }
+  if (strncmp(param, "-trace=", 7) == 0) {
+    traceFile = param + 7;
+    return 1;
+  }
+  if (strncmp(param, "-snapshot=", 10) == 0) {
+    snapshotFile = param + 10;
+    return 1;
+  }
+  if (strncmp(param, "-restore=", 9) == 0) {
+    restoreFile = param + 9;
+    return 1;
+  }
+  if (strncmp(param, "-batch=", 7) == 0) {
+    batchPath = param + 7;
+    return 1;
+  }
+  if (strncmp(param, "-serve=", 7) == 0) {
+    serveSocket = param + 7;
+    return 1;
+  }
+  if (strncmp(param, "-program=", 9) == 0) {
+    if (programCount == MAX_PROGRAMS - 1) return 0;
+    programFiles[programCount ++] = param + 9;
+    return 1;
+  }
+  if (strncmp(param, "-jobs=", 6) == 0) {
+    batchJobs = atoi(param+6);
+    return batchJobs > 0;
+  }
+  if (strncmp(param, "-bench=", 7) == 0) {
+    benchThreads = atoi(param+7);
+    return benchThreads > 0;
+  }
+  if (strcmp(param, "-stat") == 0) {
+    statMode = 1;
+    return 1;
+  }
   return 0;
 }
 
+/*
+ * One run of -bench=, in a VM of its own: the program is loaded again, it
+ * reads the saved input and its output is thrown away.
+ */
+void* benchRun(void* unused) {
+  VM* worker = (VM*) malloc(sizeof(VM));
+  FILE* f;
+  long ps = PS_IO_ERROR;
+
+  worker->stackSize = vm.stackSize;
+  worker->codeSize = vm.codeSize;
+  worker->debugMode = 0;
+  worker->engine = vm.engine;
+  worker->fuseMode = vm.fuseMode;
+  worker->hugePages = vm.hugePages;
+  initVM(worker);
+  f = fopen(benchProgram, "r");
+  if ((f != NULL) && loadExecutable(worker, f)) {
+    // fmemopen wants a non-empty buffer
+    if (benchInputSize > 0)
+      worker->inputStream = fmemopen(benchInput, benchInputSize, "r");
+    else worker->inputStream = fopen("/dev/null", "r");
+    worker->outputStream = fopen("/dev/null", "w");
+    if ((worker->inputStream != NULL) && (worker->outputStream != NULL))
+      ps = run(worker);
+    if (worker->inputStream != NULL) fclose(worker->inputStream);
+    if (worker->outputStream != NULL) fclose(worker->outputStream);
+  }
+  if (f != NULL) fclose(f);
+  cleanVM(worker);
+  free(worker);
+  return (void*) ps;
+}
+
+/*
+ * Throughput of many VMs in one process: runs the program on benchThreads
+ * threads at once and reports the wall time on stderr.
+ */
+int benchmark(void) {
+  pthread_t* threads = (pthread_t*) malloc(benchThreads * sizeof(pthread_t));
+  size_t capacity = 4096;
+  struct timespec start, end;
+  double seconds;
+  int failed = 0;
+  int i;
+
+  // Every run gets the whole of stdin
+  benchInput = (char*) malloc(capacity);
+  benchInputSize = 0;
+  while (!feof(stdin)) {
+    if (benchInputSize == capacity) {
+      capacity *= 2;
+      benchInput = (char*) realloc(benchInput, capacity);
+    }
+    benchInputSize += fread(benchInput + benchInputSize, 1, capacity - benchInputSize, stdin);
+    if (ferror(stdin)) break;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < benchThreads; i ++)
+    pthread_create(&threads[i], NULL, benchRun, NULL);
+  for (i = 0; i < benchThreads; i ++) {
+    void* ps;
+    pthread_join(threads[i], &ps);
+    if ((long) ps != PS_NORMAL_EXIT) failed ++;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  fprintf(stderr, "kplrun: %d runs in %.3fs, %.1f runs/s, %d failed\n",
+	  benchThreads, seconds, benchThreads / seconds, failed);
+  free(threads);
+  free(benchInput);
+  return (failed == 0) ? 0 : -1;
+}
+
+/*
+ * Loads the programs of -program= beside the input one and serves them
+ * all on serveSocket.
+ */
+int serve(char* input) {
+  VM* programs[MAX_PROGRAMS];
+  char* names[MAX_PROGRAMS];
+  int count = 1;
+  int result = 0;
+  int i;
+  FILE* f;
+
+  programs[0] = &vm;
+  names[0] = input;
+  for (i = 0; (i < programCount) && (result == 0); i ++) {
+    VM* program = (VM*) malloc(sizeof(VM));
+
+    program->stackSize = vm.stackSize;
+    program->codeSize = vm.codeSize;
+    program->debugMode = 0;
+    program->engine = vm.engine;
+    program->fuseMode = vm.fuseMode;
+    program->hugePages = vm.hugePages;
+    initVM(program);
+    programs[count] = program;
+    names[count ++] = programFiles[i];
+    f = fopen(programFiles[i], "r");
+    if ((f == NULL) || (loadExecutable(program, f) == 0)) {
+      printf("kplrun: Can\'t load %s!\n", programFiles[i]);
+      result = -1;
+    }
+    if (f != NULL) fclose(f);
+  }
+
+  if ((result == 0) && (runServer(programs, names, count, serveSocket, batchJobs) != 0)) {
+    printf("kplrun: Can\'t listen on %s!\n", serveSocket);
+    result = -1;
+  }
+  for (i = 1; i < count; i ++) {
+    cleanVM(programs[i]);
+    free(programs[i]);
+  }
+  return result;
+}
+
 /******************************************************************/
 
 int main(int argc, char *argv[]) {
   int i;
   FILE* f;
+  char* message;
 
-  debugMode = 0;
-  stackSize = DEFAULT_STACK_SIZE;
-  codeSize = DEFAULT_CODE_SIZE;
+  vm.debugMode = 0;
+  vm.engine = ENGINE_SWITCH;
+  vm.stackSize = DEFAULT_STACK_SIZE;
+  vm.codeSize = DEFAULT_CODE_SIZE;
   dumpCode = 0;
+  vm.fuseMode = 1;
+  vm.hugePages = 0;
+  statMode = 0;
+  saveFile = NULL;
+  benchThreads = 0;
+  profileMode = 0;
+  traceFile = NULL;
+  restoreFile = NULL;
+  snapshotFile = NULL;
+  batchPath = NULL;
+  batchJobs = sysconf(_SC_NPROCESSORS_ONLN);
+  serveSocket = NULL;
+  programCount = 0;
 
   if (argc <= 1) {
     printf("kplrun: no input file.\n");
@@ -70,6 +326,11 @@ int main(int argc, char *argv[]) {
       return -1;
     }
 
+  // Dumps, debugger traces and profiles show the code as it was compiled,
+  // or as it was saved
+  if (dumpCode || vm.debugMode || profileMode || (traceFile != NULL))
+    vm.fuseMode = 0;
+
   f = fopen(argv[1],"r");
 	    
   if (f == NULL) {
@@ -77,33 +338,104 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
-  initVM();
-  if (loadExecutable(f) == 0) {
+  initVM(&vm);
+  vm.snapshotFile = snapshotFile;
+  if (loadExecutable(&vm, f) == 0) {
     printf("kplrun: Wrong executable format!\n");
+    if (vm.loadError != LOAD_OK)
+      printf("kplrun: %s\n", loadMessage(vm.loadError));
+    if (vm.verifyError != VE_OK)
+      printf("kplrun: %d: %s\n", vm.verifyErrorPc, verifyMessage(vm.verifyError));
     fclose(f);
-    cleanVM();
+    cleanVM(&vm);
     return -1;
   }
   fclose(f);
 
+  if (statMode)
+    fprintf(stderr, "kplrun: %d superinstructions, %d instructions eliminated\n",
+	    vm.fusedCount, vm.eliminatedCount);
+  if (statMode && (vm.packedCode != NULL))
+    fprintf(stderr, "kplrun: code packed into %d bytes (%d unpacked)\n",
+	    vm.packedCode->size, (int) (vm.packedCode->codeSize * sizeof(Instruction)));
+  if (statMode && (vm.registerCode != NULL))
+    fprintf(stderr, "kplrun: %d register instructions for %d stack instructions, %d constants\n",
+	    vm.registerCode->codeSize, vm.registerCode->stackSize, vm.registerCode->constantCount);
+
   if (dumpCode) {
-    printCodeBuffer();
+    printCodeBuffer(&vm);
     return 0;
   }
 
-  switch (run()) {
-  case PS_DIVIDE_BY_ZERO:
-    printf("Runtime error: Divide by zero!\n");
-    break;
-  case PS_STACK_OVERFLOW:
-    printf("Runtime error: Stack overflow!\n");
-    break;
-  case PS_IO_ERROR:
-    printf("Runtime error: IO error!\n");
-    break;
-  default:
-    break;
-  }
-  cleanVM();
+  if (saveFile != NULL) {
+    f = fopen(saveFile, "wb");
+    if (f == NULL) {
+      printf("kplrun: Can\'t write output file!\n");
+      cleanVM(&vm);
+      return -1;
+    }
+    saveExecutable(&vm, f);
+    fclose(f);
+    cleanVM(&vm);
+    return 0;
+  }
+
+  if (batchPath != NULL) {
+    i = runBatch(&vm, batchPath, batchJobs);
+    if (i < 0)
+      printf("kplrun: Can\'t read batch inputs!\n");
+    cleanVM(&vm);
+    return (i == 0) ? 0 : -1;
+  }
+
+  if (serveSocket != NULL) {
+    i = serve(argv[1]);
+    cleanVM(&vm);
+    return i;
+  }
+
+  if (benchThreads > 0) {
+    cleanVM(&vm);
+    benchProgram = argv[1];
+    return benchmark();
+  }
+
+  if (restoreFile != NULL) {
+    SnapshotError error = restoreSnapshot(&vm, restoreFile);
+    if (error != SNAPSHOT_OK) {
+      printf("kplrun: %s\n", snapshotMessage(error));
+      cleanVM(&vm);
+      return -1;
+    }
+  }
+
+  if (profileMode)
+    vm.profile = createProfile(vm.codeBlock->codeSize);
+  if (traceFile != NULL) {
+    vm.trace = createTrace(traceFile);
+    if (vm.trace == NULL) {
+      printf("kplrun: Can\'t write trace file!\n");
+      cleanVM(&vm);
+      return -1;
+    }
+    dumpTraceOnSignals(vm.trace);
+  }
+  message = runtimeMessage(run(&vm));
+  if (message != NULL)
+    printf("Runtime error: %s\n", message);
+  if (vm.trace != NULL) {
+    dumpTrace(vm.trace, vm.ps);
+    freeTrace(vm.trace);
+  }
+  if (profileMode) {
+    fflush(stdout);
+    printProfile(vm.profile, vm.codeBlock->code, stderr);
+    freeProfile(vm.profile);
+  }
+  if (statMode && (vm.registerCode != NULL)) {
+    fflush(stdout);
+    fprintf(stderr, "kplrun: %llu register instructions executed\n", vm.registerDispatches);
+  }
+  cleanVM(&vm);
   return 0;
 }
@@ -0,0 +1,271 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "packed.h"
+
+#define OPERANDS_NONE   0
+#define OPERANDS_Q      1
+#define OPERANDS_TARGET 2
+#define OPERANDS_PQ     3
+#define OPERANDS_CALL   4
+#define OPERANDS_PQC    5
+#define OPERANDS_PQPQ   6
+#define OPERANDS_VV     7
+#define OPERANDS_VC     8
+
+static int operandKind(enum OpCode op) {
+  switch (op) {
+  case OP_LA: case OP_LV: case OP_LCF: case OP_LVF: return OPERANDS_PQ;
+  case OP_LC: case OP_INT: case OP_DCT: case OP_ADC: return OPERANDS_Q;
+  case OP_CVIF: case OP_EFF: case OP_MVB: case OP_FLB: return OPERANDS_Q;
+  case OP_J: case OP_FJ: return OPERANDS_TARGET;
+  case OP_CALL: return OPERANDS_CALL;
+  case OP_LVAC: case OP_MOVC: return OPERANDS_PQC;
+  case OP_MOV: return OPERANDS_PQPQ;
+  default:
+    if ((op >= OP_VVEQ) && (op <= OP_VVLE)) return OPERANDS_VV;
+    if ((op >= OP_VCEQ) && (op <= OP_VCLE)) return OPERANDS_VC;
+    return OPERANDS_NONE;
+  }
+}
+
+static int operandSize(WORD value) {
+  unsigned int u = ((unsigned int) value << 1) ^ (unsigned int) (value >> 31);
+  int size = 1;
+
+  while (u >= 0x80) {
+    u >>= 7;
+    size ++;
+  }
+  return size;
+}
+
+static unsigned char* encodeOperand(unsigned char* s, WORD value) {
+  unsigned int u = ((unsigned int) value << 1) ^ (unsigned int) (value >> 31);
+
+  while (u >= 0x80) {
+    *s++ = (u & 0x7F) | 0x80;
+    u >>= 7;
+  }
+  *s++ = u;
+  return s;
+}
+
+static unsigned char* encodeTarget(unsigned char* s, int target) {
+  memcpy(s, &target, sizeof(target));
+  return s + sizeof(target);
+}
+
+// Bytes taken by an instruction, the operands of its slots included
+static int packedSize(Instruction* inst) {
+  switch (operandKind(inst->op)) {
+  case OPERANDS_Q:
+    return 1 + operandSize(inst->q);
+  case OPERANDS_TARGET:
+    return 1 + 4;
+  case OPERANDS_PQ:
+    return 1 + operandSize(inst->p) + operandSize(inst->q);
+  case OPERANDS_CALL:
+    return 1 + operandSize(inst->p) + operandSize(inst->q) + 4;
+  case OPERANDS_PQC:
+    return 1 + operandSize(inst->p) + operandSize(inst->q) + operandSize(inst[1].q);
+  case OPERANDS_PQPQ:
+    return 1 + operandSize(inst->p) + operandSize(inst->q)
+      + operandSize(inst[1].p) + operandSize(inst[1].q);
+  case OPERANDS_VV:
+    return 1 + operandSize(inst->p) + operandSize(inst->q)
+      + operandSize(inst[1].p) + operandSize(inst[1].q) + 4;
+  case OPERANDS_VC:
+    return 1 + operandSize(inst->p) + operandSize(inst->q) + operandSize(inst[1].q) + 4;
+  default:
+    return 1;
+  }
+}
+
+/*
+ * Builds the packed form of a code block, superinstructions included (the
+ * fusion never leaves one incomplete). Jump targets are byte offsets, so
+ * the offsets are laid out first.
+ */
+PackedCode* packCode(CodeBlock* codeBlock) {
+  Instruction* code = codeBlock->code;
+  int n = codeBlock->codeSize;
+  PackedCode* packed = (PackedCode*) malloc(sizeof(PackedCode));
+  unsigned char* s;
+  int i, k, words;
+  int size = 0;
+
+  packed->codeSize = n;
+  packed->offsets = (int*) malloc((n + 1) * sizeof(int));
+  for (i = 0; i < n; i += words) {
+    words = instructionWords(code[i].op);
+    for (k = 0; k < words; k ++)
+      packed->offsets[i + k] = size;
+    size += packedSize(&code[i]);
+  }
+  packed->offsets[n] = size;
+  packed->size = size;
+  packed->bytes = (unsigned char*) malloc(size + 1);
+
+  s = packed->bytes;
+  for (i = 0; i < n; i += words) {
+    Instruction* inst = &code[i];
+
+    words = instructionWords(inst->op);
+    *s++ = inst->op;
+    switch (operandKind(inst->op)) {
+    case OPERANDS_Q:
+      s = encodeOperand(s, inst->q);
+      break;
+    case OPERANDS_TARGET:
+      s = encodeTarget(s, packed->offsets[inst->q]);
+      break;
+    case OPERANDS_PQ:
+      s = encodeOperand(s, inst->p);
+      s = encodeOperand(s, inst->q);
+      break;
+    case OPERANDS_CALL:
+      s = encodeOperand(s, inst->p);
+      s = encodeOperand(s, inst->q);
+      s = encodeTarget(s, i);
+      break;
+    case OPERANDS_PQC:
+      s = encodeOperand(s, inst->p);
+      s = encodeOperand(s, inst->q);
+      s = encodeOperand(s, inst[1].q);
+      break;
+    case OPERANDS_PQPQ:
+      s = encodeOperand(s, inst->p);
+      s = encodeOperand(s, inst->q);
+      s = encodeOperand(s, inst[1].p);
+      s = encodeOperand(s, inst[1].q);
+      break;
+    case OPERANDS_VV:
+      s = encodeOperand(s, inst->p);
+      s = encodeOperand(s, inst->q);
+      s = encodeOperand(s, inst[1].p);
+      s = encodeOperand(s, inst[1].q);
+      s = encodeTarget(s, packed->offsets[inst[2].q]);
+      break;
+    case OPERANDS_VC:
+      s = encodeOperand(s, inst->p);
+      s = encodeOperand(s, inst->q);
+      s = encodeOperand(s, inst[1].q);
+      s = encodeTarget(s, packed->offsets[inst[2].q]);
+      break;
+    default:
+      break;
+    }
+  }
+  *s = PACKED_END;
+  return packed;
+}
+
+void freePackedCode(PackedCode* packed) {
+  if (packed == NULL) return;
+  free(packed->bytes);
+  free(packed->offsets);
+  free(packed);
+}
+
+/*
+ * Decodes the instruction at the given offset back into its code words,
+ * the operand slots of a superinstruction included (LV, LC and FJ as the
+ * fusion left them). Returns the offset of the next instruction.
+ */
+int unpackInstruction(PackedCode* packed, int offset, Instruction* inst) {
+  const unsigned char* ip = packed->bytes + offset;
+  enum OpCode op = *ip++;
+  int k;
+
+  for (k = 0; k < instructionWords(op); k ++) {
+    inst[k].p = DC_VALUE;
+    inst[k].q = DC_VALUE;
+  }
+  inst->op = op;
+
+  switch (operandKind(op)) {
+  case OPERANDS_Q:
+    inst->q = decodeOperand(&ip);
+    break;
+  case OPERANDS_TARGET:
+    inst->q = packedAddress(packed, decodeTarget(&ip));
+    break;
+  case OPERANDS_PQ:
+    inst->p = decodeOperand(&ip);
+    inst->q = decodeOperand(&ip);
+    break;
+  case OPERANDS_CALL:
+    inst->p = decodeOperand(&ip);
+    inst->q = decodeOperand(&ip);
+    decodeTarget(&ip);
+    break;
+  case OPERANDS_PQC:
+    inst->p = decodeOperand(&ip);
+    inst->q = decodeOperand(&ip);
+    inst[1].op = OP_LC;
+    inst[1].q = decodeOperand(&ip);
+    break;
+  case OPERANDS_PQPQ:
+  case OPERANDS_VV:
+    inst->p = decodeOperand(&ip);
+    inst->q = decodeOperand(&ip);
+    inst[1].op = OP_LV;
+    inst[1].p = decodeOperand(&ip);
+    inst[1].q = decodeOperand(&ip);
+    break;
+  case OPERANDS_VC:
+    inst->p = decodeOperand(&ip);
+    inst->q = decodeOperand(&ip);
+    inst[1].op = OP_LC;
+    inst[1].q = decodeOperand(&ip);
+    break;
+  default:
+    break;
+  }
+  if ((op >= OP_VVEQ) && (op <= OP_VCLE)) {
+    inst[2].op = OP_FJ;
+    inst[2].q = packedAddress(packed, decodeTarget(&ip));
+  }
+  return ip - packed->bytes;
+}
+
+// Code address of the instruction starting at the given offset
+int packedAddress(PackedCode* packed, int offset) {
+  int low = 0;
+  int high = packed->codeSize;
+
+  // The first pc whose offset is not below it: the head, not a slot
+  while (low < high) {
+    int middle = (low + high) / 2;
+
+    if (packed->offsets[middle] < offset) low = middle + 1;
+    else high = middle;
+  }
+  return low;
+}
+
+// Same output as printCodeBlock on the code block that was packed
+void printPackedCode(PackedCode* packed) {
+  Instruction inst[3];
+  int offset = 0;
+  int pc = 0;
+  int k;
+
+  while (pc < packed->codeSize) {
+    int next = unpackInstruction(packed, offset, inst);
+
+    for (k = 0; (k < instructionWords(inst[0].op)) && (pc < packed->codeSize); k ++) {
+      printf("%d:  ", pc);
+      printInstruction(&inst[k]);
+      printf("\n");
+      pc ++;
+    }
+    offset = next;
+  }
+}
@@ -0,0 +1,79 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __PACKED_H__
+#define __PACKED_H__
+
+#include <string.h>
+#include "instructions.h"
+
+/*
+ * Compact form of a code block. Every instruction is one opcode byte
+ * followed by only the operands it uses:
+ *   LA, LV               p, q
+ *   LC, INT, DCT, ADC    q
+ *   J, FJ                target
+ *   CALL                 p, q, own address
+ *   LVAC, MOVC           p, q, c
+ *   MOV                  p, q, p', q'
+ *   VV*                  p, q, p', q', target
+ *   VC*                  p, q, c, target
+ *   anything else        nothing
+ * Operands are zigzag varints (one byte for -64..63), jump targets are the
+ * byte offsets of the targets in four bytes. CALL keeps the code address of
+ * its callee and its own, since frames hold code addresses.
+ * offsets[pc] is where the instruction at pc starts; the operand slots of
+ * a superinstruction share the offset of their head. offsets[codeSize] is
+ * the size, and the byte there is PACKED_END.
+ */
+
+#define PACKED_END 0xFF
+
+struct PackedCode_ {
+  unsigned char* bytes;
+  int size;
+  int* offsets;
+  int codeSize;
+};
+
+typedef struct PackedCode_ PackedCode;
+
+PackedCode* packCode(CodeBlock* codeBlock);
+void freePackedCode(PackedCode* packed);
+int unpackInstruction(PackedCode* packed, int offset, Instruction* inst);
+int packedAddress(PackedCode* packed, int offset);
+void printPackedCode(PackedCode* packed);
+
+// Decoders used by the interpreter; both advance *ip past the operand
+
+static inline WORD decodeOperand(const unsigned char** ip) {
+  const unsigned char* s = *ip;
+  unsigned int u = *s++;
+
+  if (u >= 0x80) {
+    unsigned int c;
+    int shift = 7;
+
+    u &= 0x7F;
+    do {
+      c = *s++;
+      u |= (c & 0x7F) << shift;
+      shift += 7;
+    } while (c >= 0x80);
+  }
+  *ip = s;
+  return (WORD) ((u >> 1) ^ - (u & 1));
+}
+
+static inline int decodeTarget(const unsigned char** ip) {
+  int target;
+
+  memcpy(&target, *ip, sizeof(target));
+  *ip += sizeof(target);
+  return target;
+}
+
+#endif
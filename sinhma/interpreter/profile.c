@@ -0,0 +1,190 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include "profile.h"
+
+// Length of each list of the report
+#define REPORT_LINES 20
+
+struct Ranked_ {
+  int pc;
+  Count count;
+};
+
+typedef struct Ranked_ Ranked;
+
+static void enterProcedure(Profile* profile, int entry) {
+  if (profile->depth == profile->capacity) {
+    profile->capacity *= 2;
+    profile->entries = (int*) realloc(profile->entries, profile->capacity * sizeof(int));
+    profile->starts = (Count*) realloc(profile->starts, profile->capacity * sizeof(Count));
+  }
+  profile->entries[profile->depth] = entry;
+  profile->starts[profile->depth] = profile->total;
+  profile->depth ++;
+  profile->calls[entry] ++;
+  profile->active[entry] ++;
+}
+
+static void leaveProcedure(Profile* profile) {
+  int entry;
+
+  profile->depth --;
+  entry = profile->entries[profile->depth];
+  // Only the outermost activation of a recursion adds to the inclusive count
+  if (-- profile->active[entry] == 0)
+    profile->inclusive[entry] += profile->total - profile->starts[profile->depth];
+}
+
+Profile* createProfile(int codeSize) {
+  Profile* profile = (Profile*) malloc(sizeof(Profile));
+
+  profile->codeSize = codeSize;
+  profile->total = 0;
+  profile->counts = (Count*) calloc(codeSize + 1, sizeof(Count));
+  profile->taken = (Count*) calloc(codeSize + 1, sizeof(Count));
+  profile->calls = (Count*) calloc(codeSize + 1, sizeof(Count));
+  profile->exclusive = (Count*) calloc(codeSize + 1, sizeof(Count));
+  profile->inclusive = (Count*) calloc(codeSize + 1, sizeof(Count));
+  profile->active = (int*) calloc(codeSize + 1, sizeof(int));
+  profile->capacity = 64;
+  profile->entries = (int*) malloc(profile->capacity * sizeof(int));
+  profile->starts = (Count*) malloc(profile->capacity * sizeof(Count));
+  profile->depth = 0;
+  profile->previous = -1;
+  enterProcedure(profile, 0);
+  return profile;
+}
+
+void freeProfile(Profile* profile) {
+  if (profile == NULL) return;
+  free(profile->counts);
+  free(profile->taken);
+  free(profile->calls);
+  free(profile->exclusive);
+  free(profile->inclusive);
+  free(profile->active);
+  free(profile->entries);
+  free(profile->starts);
+  free(profile);
+}
+
+/*
+ * Counts the instruction at pc, about to be executed. Whether the previous
+ * one jumped back, called or returned is seen from where it led.
+ */
+void profileStep(Profile* profile, Instruction* code, int pc) {
+  int previous = profile->previous;
+
+  if (previous >= 0) {
+    switch (code[previous].op) {
+    case OP_J:
+    case OP_FJ:
+      if ((pc <= previous) && (pc == code[previous].q))
+	profile->taken[previous] ++;
+      break;
+    case OP_CALL:
+      if (pc == code[previous].q)
+	enterProcedure(profile, pc);
+      break;
+    case OP_EP:
+    case OP_EF:
+      if (profile->depth > 1)
+	leaveProcedure(profile);
+      break;
+    default:
+      break;
+    }
+  }
+  profile->counts[pc] ++;
+  profile->exclusive[profile->entries[profile->depth - 1]] ++;
+  profile->total ++;
+  profile->previous = pc;
+}
+
+static int compareRanked(const void* a, const void* b) {
+  Count x = ((Ranked*) a)->count;
+  Count y = ((Ranked*) b)->count;
+
+  if (x != y) return (x < y) ? 1 : -1;
+  return ((Ranked*) a)->pc - ((Ranked*) b)->pc;
+}
+
+static double percent(Count count, Count total) {
+  return (total == 0) ? 0 : 100.0 * count / total;
+}
+
+/*
+ * Writes the report: procedures, hot instructions and hot loops, each by
+ * decreasing instruction count. A loop is the code from the target of a
+ * backward J or FJ up to that jump.
+ */
+void printProfile(Profile* profile, Instruction* code, FILE* f) {
+  Ranked* ranked = (Ranked*) malloc((profile->codeSize + 1) * sizeof(Ranked));
+  char s[100];
+  int n, i, k;
+
+  // Procedures still active (the program stopped inside them) end here
+  while (profile->depth > 0)
+    leaveProcedure(profile);
+
+  fprintf(f, "Profile: %llu instructions executed\n", profile->total);
+
+  fprintf(f, "\nProcedures:\n");
+  fprintf(f, "  %6s %12s %14s %7s %14s %7s\n", "entry", "calls", "exclusive", "%", "inclusive", "%");
+  n = 0;
+  for (i = 0; i < profile->codeSize; i ++)
+    if (profile->calls[i] > 0) {
+      ranked[n].pc = i;
+      ranked[n].count = profile->exclusive[i];
+      n ++;
+    }
+  qsort(ranked, n, sizeof(Ranked), compareRanked);
+  for (k = 0; k < n; k ++) {
+    i = ranked[k].pc;
+    fprintf(f, "  %6d %12llu %14llu %6.2f%% %14llu %6.2f%%\n", i, profile->calls[i],
+	    profile->exclusive[i], percent(profile->exclusive[i], profile->total),
+	    profile->inclusive[i], percent(profile->inclusive[i], profile->total));
+  }
+
+  fprintf(f, "\nHot instructions:\n");
+  n = 0;
+  for (i = 0; i < profile->codeSize; i ++)
+    if (profile->counts[i] > 0) {
+      ranked[n].pc = i;
+      ranked[n].count = profile->counts[i];
+      n ++;
+    }
+  qsort(ranked, n, sizeof(Ranked), compareRanked);
+  for (k = 0; (k < n) && (k < REPORT_LINES); k ++) {
+    i = ranked[k].pc;
+    sprintInstruction(s, &code[i]);
+    fprintf(f, "  %6d %14llu %6.2f%%  %s\n", i, ranked[k].count,
+	    percent(ranked[k].count, profile->total), s);
+  }
+
+  fprintf(f, "\nHot loops:\n");
+  fprintf(f, "  %13s %12s %14s %7s\n", "pcs", "iterations", "instructions", "%");
+  n = 0;
+  for (i = 0; i < profile->codeSize; i ++)
+    if (profile->taken[i] > 0) {
+      Count body = 0;
+      for (k = code[i].q; k <= i; k ++)
+	body += profile->counts[k];
+      ranked[n].pc = i;
+      ranked[n].count = body;
+      n ++;
+    }
+  qsort(ranked, n, sizeof(Ranked), compareRanked);
+  for (k = 0; (k < n) && (k < REPORT_LINES); k ++) {
+    i = ranked[k].pc;
+    sprintf(s, "%d-%d", code[i].q, i);
+    fprintf(f, "  %13s %12llu %14llu %6.2f%%\n", s, profile->taken[i],
+	    ranked[k].count, percent(ranked[k].count, profile->total));
+  }
+  free(ranked);
+}
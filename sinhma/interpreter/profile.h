@@ -0,0 +1,46 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdio.h>
+#include "instructions.h"
+
+typedef unsigned long long Count;
+
+/*
+ * Execution counts of a program run by the switch loop of run(). A shadow
+ * call stack follows CALL, EP and EF to charge every instruction to the
+ * procedure executing it (exclusive count) and to all procedures active
+ * at the time (inclusive count, once per procedure however deep the
+ * recursion). Procedures are named by their entry pc, main being 0.
+ */
+struct Profile_ {
+  int codeSize;
+  Count total;
+  Count* counts;                // Per pc
+  Count* taken;                 // Per backward J or FJ, times it jumped
+  Count* calls;                 // Per entry
+  Count* exclusive;
+  Count* inclusive;
+  int* active;                  // Activations of an entry on the call stack
+
+  int* entries;                 // The shadow call stack
+  Count* starts;                // total when each activation began
+  int depth;
+  int capacity;
+  int previous;                 // The last pc counted, -1 at first
+};
+
+typedef struct Profile_ Profile;
+
+Profile* createProfile(int codeSize);
+void freeProfile(Profile* profile);
+void profileStep(Profile* profile, Instruction* code, int pc);
+void printProfile(Profile* profile, Instruction* code, FILE* f);
+
+#endif
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Register engine against the stack engines, on the test programs or the
+# ones given: instructions dispatched (unfused stack code, as -profile
+# counts it) and runs per second of -bench= with the threaded engine, which
+# runs fused code, and with the register engine.
+#
+#   ./regbench.sh [program.kpl ...]
+#
+# KPLC, KPLRUN and RUNS (threads of -bench=) may be set in the environment.
+
+KPLC=${KPLC:-../../Semantic-Day4/kplc}
+KPLRUN=${KPLRUN:-./kplrun}
+RUNS=${RUNS:-64}
+INPUT='5\n3\n1\n2\n3\n4\n5\n6\n7\n8\n9\n9\n9\n9\n'
+CODE=${TMPDIR:-/tmp}/regbench.$$.kplx
+
+[ $# -eq 0 ] && set -- ../tests/*.kpl
+
+printf "%-12s %12s %12s %6s %12s %12s\n" program stack register ratio threaded/s register/s
+for f in "$@"; do
+  name=$(basename "$f" .kpl)
+  if ! $KPLC "$f" $CODE -O2 > /dev/null; then
+    echo "$name: compile error"
+    continue
+  fi
+  stack=$(printf "$INPUT" | $KPLRUN $CODE -profile 2>&1 > /dev/null \
+    | sed -n 's/^Profile: \([0-9]*\) instructions executed/\1/p')
+  register=$(printf "$INPUT" | $KPLRUN $CODE -register -stat 2>&1 > /dev/null \
+    | sed -n 's/^kplrun: \([0-9]*\) register instructions executed/\1/p')
+  threaded=$(printf "$INPUT" | $KPLRUN $CODE -threaded -bench=$RUNS 2>&1 > /dev/null \
+    | sed -n 's/.* \([0-9.]*\) runs\/s.*/\1/p')
+  registerRate=$(printf "$INPUT" | $KPLRUN $CODE -register -bench=$RUNS 2>&1 > /dev/null \
+    | sed -n 's/.* \([0-9.]*\) runs\/s.*/\1/p')
+  ratio=$(awk "BEGIN { printf \"%.2f\", $stack / $register }")
+  printf "%-12s %12s %12s %6s %12s %12s\n" "$name" "$stack" "$register" "$ratio" "$threaded" "$registerRate"
+done
+rm -f $CODE
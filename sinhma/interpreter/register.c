@@ -0,0 +1,607 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "register.h"
+
+/*
+ * The translation follows the stack through each basic block. A word
+ * pushed by LV 0, LC or LA is not copied at once: it stays a reference to
+ * the variable, the constant or the address until an instruction uses it
+ * as an operand, so that AD reads the variables themselves and ST gives
+ * the address of the variable to the instruction that computed the value.
+ * A word is only written to its place in the frame when it has to be
+ * there: at the end of a block, before a call, or before its variable is
+ * overwritten.
+ *
+ * Only the words pushed since the start of the block or the last INT are
+ * followed; those below them, locals included, are in their place. So the
+ * work per instruction depends on the expression, not on the frame.
+ */
+
+#define WORD_IN_FRAME 0         // in its own place in the frame
+#define WORD_CONSTANT 1         // value
+#define WORD_VARIABLE 2         // f[value]
+#define WORD_ADDRESS  3         // base(p) + value
+
+struct StackWord {
+  int kind;
+  int p;
+  WORD value;
+  int producer;                 // the instruction that wrote it, -1 if none
+};
+
+/*
+ * The stack of the block: depth words above the frame base, the top count
+ * of them in words, at positions followedFrom() to depth - 1. Once an allocation
+ * fails the translation only goes on without writing, and is dropped.
+ */
+struct Translation {
+  RegisterCode* result;
+  int capacity;
+  int constantCapacity;
+  int* constantSlots;           // Hash of the constants to their index, -1 if free
+  int slotMask;
+  struct StackWord* words;
+  int wordCapacity;
+  int count;
+  int depth;
+  int failed;
+};
+
+static int isTranslated(enum OpCode op) {
+  switch (op) {
+  case OP_LA: case OP_LV: case OP_LC: case OP_LI: case OP_INT: case OP_DCT:
+  case OP_J: case OP_FJ: case OP_HL: case OP_ST: case OP_CALL: case OP_EP: case OP_EF:
+  case OP_RC: case OP_RI: case OP_WRC: case OP_WRI: case OP_WLN:
+  case OP_AD: case OP_SB: case OP_ML: case OP_DV: case OP_NEG: case OP_CV:
+  case OP_EQ: case OP_NE: case OP_GT: case OP_LT: case OP_GE: case OP_LE:
+  case OP_PW:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static enum RegOpCode arithmetic(enum OpCode op) {
+  switch (op) {
+  case OP_AD: return RG_ADD;
+  case OP_SB: return RG_SUB;
+  case OP_ML: return RG_MUL;
+  case OP_DV: return RG_DIV;
+  case OP_PW: return RG_PW;
+  default: return RG_EQ + (op - OP_EQ);
+  }
+}
+
+// Doubles the capacity of an array of size words; 0 if it cannot
+static int grow(void** array, int* capacity, size_t size) {
+  void* larger;
+
+  if (*capacity > INT_MAX / 2) return 0;
+  larger = realloc(*array, 2 * (size_t) *capacity * size);
+  if (larger == NULL) return 0;
+  *array = larger;
+  *capacity *= 2;
+  return 1;
+}
+
+// Index of the new instruction, -1 if it could not be stored
+static int emit(struct Translation* tr, enum RegOpCode op, WORD a, WORD b, WORD c, int pc) {
+  RegisterCode* rc = tr->result;
+  RegInstruction* inst;
+
+  if ((rc->codeSize == tr->capacity)
+      && !grow((void**) &rc->code, &tr->capacity, sizeof(RegInstruction))) {
+    tr->failed = 1;
+    return -1;
+  }
+  inst = &rc->code[rc->codeSize];
+  inst->op = op;
+  inst->a = a;
+  inst->b = b;
+  inst->c = c;
+  inst->pc = pc;
+  return rc->codeSize ++;
+}
+
+static unsigned hashConstant(WORD value) {
+  return (unsigned) value * 2654435761u;
+}
+
+// Doubles the hash of the constants and puts them back in
+static int rehashConstants(struct Translation* tr) {
+  int size = 2 * (tr->slotMask + 1);
+  int* slots = (int*) malloc(size * sizeof(int));
+  int i, k;
+
+  if (slots == NULL) return 0;
+  for (i = 0; i < size; i ++)
+    slots[i] = -1;
+  for (k = 0; k < tr->result->constantCount; k ++) {
+    for (i = hashConstant(tr->result->constants[k]) & (size - 1); slots[i] >= 0; i = (i + 1) & (size - 1));
+    slots[i] = k;
+  }
+  free(tr->constantSlots);
+  tr->constantSlots = slots;
+  tr->slotMask = size - 1;
+  return 1;
+}
+
+static WORD constant(struct Translation* tr, WORD value) {
+  RegisterCode* rc = tr->result;
+  int i;
+
+  for (i = hashConstant(value) & tr->slotMask; tr->constantSlots[i] >= 0; i = (i + 1) & tr->slotMask)
+    if (rc->constants[tr->constantSlots[i]] == value)
+      return ~tr->constantSlots[i];
+  // The hash is kept at most half full
+  if (((rc->constantCount == tr->constantCapacity)
+       && !grow((void**) &rc->constants, &tr->constantCapacity, sizeof(WORD)))
+      || ((2 * (rc->constantCount + 1) > tr->slotMask + 1) && !rehashConstants(tr))) {
+    tr->failed = 1;
+    return ~0;
+  }
+  for (i = hashConstant(value) & tr->slotMask; tr->constantSlots[i] >= 0; i = (i + 1) & tr->slotMask);
+  tr->constantSlots[i] = rc->constantCount;
+  rc->constants[rc->constantCount] = value;
+  return ~(rc->constantCount ++);
+}
+
+// Position of the lowest word followed; the ones below are in their place
+static inline int followedFrom(struct Translation* tr) {
+  return tr->depth - tr->count;
+}
+
+static void push(struct Translation* tr, int kind, int p, WORD value, int producer) {
+  struct StackWord* w;
+
+  tr->depth ++;
+  if ((tr->count == tr->wordCapacity)
+      && !grow((void**) &tr->words, &tr->wordCapacity, sizeof(struct StackWord))) {
+    tr->failed = 1;
+    return;
+  }
+  w = &tr->words[tr->count ++];
+  w->kind = kind;
+  w->p = p;
+  w->value = value;
+  w->producer = producer;
+}
+
+// The top word, one in its place if it is not followed
+static struct StackWord pop(struct Translation* tr) {
+  struct StackWord w = {WORD_IN_FRAME, 0, 0, -1};
+
+  if (tr->count > 0)
+    w = tr->words[-- tr->count];
+  tr->depth --;
+  return w;
+}
+
+static void invalidate(struct Translation* tr, int offset, int pc);
+
+// Writes the k-th word followed to its place
+static void materialize(struct Translation* tr, int k, int pc) {
+  struct StackWord* w = &tr->words[k];
+  int i = followedFrom(tr) + k;
+
+  if (w->kind == WORD_IN_FRAME)
+    return;
+  if ((w->kind == WORD_VARIABLE) && (w->value == i)) {
+    w->kind = WORD_IN_FRAME;
+    return;
+  }
+  invalidate(tr, i, pc);
+  if (w->kind == WORD_CONSTANT)
+    w->producer = emit(tr, RG_MOV, i, constant(tr, w->value), DC_VALUE, pc);
+  else if (w->kind == WORD_VARIABLE)
+    w->producer = emit(tr, RG_MOV, i, w->value, DC_VALUE, pc);
+  else w->producer = emit(tr, RG_LA, i, w->p, w->value, pc);
+  w->kind = WORD_IN_FRAME;
+}
+
+// Before f[offset] is written, the words still to read its old value get it
+static void invalidate(struct Translation* tr, int offset, int pc) {
+  int k;
+
+  for (k = 0; k < tr->count; k ++)
+    if ((tr->words[k].kind == WORD_VARIABLE) && (tr->words[k].value == offset) && (followedFrom(tr) + k != offset))
+      materialize(tr, k, pc);
+}
+
+// Before a store to an address not known here, or anything that needs them in place
+static void materializeVariables(struct Translation* tr, int pc) {
+  int k;
+
+  for (k = 0; k < tr->count; k ++)
+    if (tr->words[k].kind == WORD_VARIABLE)
+      materialize(tr, k, pc);
+}
+
+static void flush(struct Translation* tr, int pc) {
+  int k;
+
+  for (k = 0; k < tr->count; k ++)
+    materialize(tr, k, pc);
+}
+
+// The source operand for a word popped from position i
+static WORD operand(struct Translation* tr, struct StackWord* w, int i, int pc) {
+  switch (w->kind) {
+  case WORD_CONSTANT:
+    return constant(tr, w->value);
+  case WORD_VARIABLE:
+    return w->value;
+  case WORD_ADDRESS:
+    invalidate(tr, i, pc);
+    emit(tr, RG_LA, i, w->p, w->value, pc);
+    return i;
+  default:
+    return i;
+  }
+}
+
+static int isReadBy(struct Translation* tr, int offset) {
+  int k;
+
+  for (k = 0; k < tr->count; k ++)
+    if ((tr->words[k].kind == WORD_VARIABLE) && (tr->words[k].value == offset))
+      return 1;
+  return 0;
+}
+
+// ST: the value goes to the variable or through the address below it
+static void translateStore(struct Translation* tr, int pc) {
+  struct StackWord value = pop(tr);
+  struct StackWord address = pop(tr);
+  int i = tr->depth;
+  WORD x = address.value;
+  WORD a, b;
+
+  if ((address.kind == WORD_ADDRESS) && (address.p == 0)) {
+    if ((value.kind == WORD_VARIABLE) && (value.value == x))
+      return;
+    invalidate(tr, x, pc);
+    // The instruction that computed it writes the variable instead
+    if ((value.kind == WORD_IN_FRAME) && (value.producer >= 0)
+	&& (value.producer == tr->result->codeSize - 1) && !isReadBy(tr, i + 1))
+      tr->result->code[value.producer].a = x;
+    else emit(tr, RG_MOV, x, operand(tr, &value, i + 1, pc), DC_VALUE, pc);
+  } else if (address.kind == WORD_ADDRESS)
+    emit(tr, RG_STU, operand(tr, &value, i + 1, pc), address.p, x, pc);
+  else {
+    a = operand(tr, &address, i, pc);
+    b = operand(tr, &value, i + 1, pc);
+    materializeVariables(tr, pc);
+    emit(tr, RG_ST, a, b, DC_VALUE, pc);
+  }
+}
+
+// FJ, and a compare just before it becomes a compare and jump
+static void translateFalseJump(struct Translation* tr, Instruction* inst, int pc) {
+  struct StackWord condition = pop(tr);
+  RegisterCode* rc = tr->result;
+  RegInstruction compare;
+
+  if ((condition.kind == WORD_IN_FRAME) && (condition.producer >= 0)
+      && (condition.producer == rc->codeSize - 1)
+      && (rc->code[condition.producer].op >= RG_EQ) && (rc->code[condition.producer].op <= RG_LE)) {
+    // What flush writes is not read by the compare, which can go after it
+    compare = rc->code[-- rc->codeSize];
+    flush(tr, pc);
+    emit(tr, RG_JFEQ + (compare.op - RG_EQ), inst->q, compare.b, compare.c, compare.pc);
+  } else {
+    WORD b = operand(tr, &condition, tr->depth, pc);
+
+    flush(tr, pc);
+    emit(tr, RG_JF, inst->q, b, DC_VALUE, pc);
+  }
+}
+
+// INT, or DCT of a negative count: the new words are in their place
+static void allocateWords(struct Translation* tr, int q, int pc) {
+  flush(tr, pc);
+  tr->count = 0;
+  tr->depth += q;
+}
+
+// DCT, or INT of a negative count: the words given back are those of a
+// call, which the callee reads
+static void releaseWords(struct Translation* tr, int q, int pc) {
+  int k;
+
+  for (k = (q < tr->count) ? tr->count - q : 0; k < tr->count; k ++)
+    materialize(tr, k, pc);
+  tr->count = (q < tr->count) ? tr->count - q : 0;
+  tr->depth -= q;
+}
+
+static void translate(struct Translation* tr, Instruction* inst, int pc) {
+  struct StackWord a, b;
+  int i;
+
+  switch (inst->op) {
+  case OP_LA:
+    push(tr, WORD_ADDRESS, inst->p, inst->q, -1);
+    break;
+  case OP_LV:
+    if (inst->p == 0)
+      push(tr, WORD_VARIABLE, 0, inst->q, -1);
+    else {
+      i = tr->depth;
+      invalidate(tr, i, pc);
+      push(tr, WORD_IN_FRAME, 0, 0, emit(tr, RG_LDU, i, inst->p, inst->q, pc));
+    }
+    break;
+  case OP_LC:
+    push(tr, WORD_CONSTANT, 0, inst->q, -1);
+    break;
+  case OP_LI:
+    a = pop(tr);
+    i = tr->depth;
+    if ((a.kind == WORD_ADDRESS) && (a.p == 0))
+      push(tr, WORD_VARIABLE, 0, a.value, -1);
+    else if (a.kind == WORD_ADDRESS) {
+      invalidate(tr, i, pc);
+      push(tr, WORD_IN_FRAME, 0, 0, emit(tr, RG_LDU, i, a.p, a.value, pc));
+    } else {
+      WORD x = operand(tr, &a, i, pc);
+
+      invalidate(tr, i, pc);
+      push(tr, WORD_IN_FRAME, 0, 0, emit(tr, RG_LI, i, x, DC_VALUE, pc));
+    }
+    break;
+  case OP_INT:
+    if (inst->q >= 0)
+      allocateWords(tr, inst->q, pc);
+    else releaseWords(tr, - inst->q, pc);
+    break;
+  case OP_DCT:
+    if (inst->q >= 0)
+      releaseWords(tr, inst->q, pc);
+    else allocateWords(tr, - inst->q, pc);
+    break;
+  case OP_CV:
+    if ((tr->count == 0) || (tr->words[tr->count - 1].kind == WORD_IN_FRAME))
+      push(tr, WORD_VARIABLE, 0, tr->depth - 1, -1);
+    else {
+      a = tr->words[tr->count - 1];
+      push(tr, a.kind, a.p, a.value, -1);
+    }
+    break;
+  case OP_J:
+    flush(tr, pc);
+    emit(tr, RG_J, inst->q, DC_VALUE, DC_VALUE, pc);
+    break;
+  case OP_FJ:
+    translateFalseJump(tr, inst, pc);
+    break;
+  case OP_ST:
+    translateStore(tr, pc);
+    break;
+  case OP_AD: case OP_SB: case OP_ML: case OP_DV: case OP_PW:
+  case OP_EQ: case OP_NE: case OP_GT: case OP_LT: case OP_GE: case OP_LE: {
+    WORD x, y;
+
+    b = pop(tr);
+    a = pop(tr);
+    i = tr->depth;
+    x = operand(tr, &a, i, pc);
+    y = operand(tr, &b, i + 1, pc);
+    invalidate(tr, i, pc);
+    push(tr, WORD_IN_FRAME, 0, 0, emit(tr, arithmetic(inst->op), i, x, y, pc));
+    break;
+  }
+  case OP_NEG: {
+    WORD x;
+
+    a = pop(tr);
+    i = tr->depth;
+    x = operand(tr, &a, i, pc);
+    invalidate(tr, i, pc);
+    push(tr, WORD_IN_FRAME, 0, 0, emit(tr, RG_NEG, i, x, DC_VALUE, pc));
+    break;
+  }
+  case OP_RI:
+  case OP_RC:
+    i = tr->depth;
+    invalidate(tr, i, pc);
+    push(tr, WORD_IN_FRAME, 0, 0, emit(tr, (inst->op == OP_RI) ? RG_RI : RG_RC, i, DC_VALUE, DC_VALUE, pc));
+    break;
+  case OP_WRI:
+  case OP_WRC:
+    a = pop(tr);
+    emit(tr, (inst->op == OP_WRI) ? RG_WRI : RG_WRC, operand(tr, &a, tr->depth, pc), DC_VALUE, DC_VALUE, pc);
+    break;
+  case OP_WLN:
+    emit(tr, RG_WLN, DC_VALUE, DC_VALUE, DC_VALUE, pc);
+    break;
+  case OP_CALL:
+    flush(tr, pc);
+    emit(tr, RG_CALL, tr->depth, inst->p, inst->q, pc);
+    break;
+  case OP_EP:
+    emit(tr, RG_EP, DC_VALUE, DC_VALUE, DC_VALUE, pc);
+    break;
+  case OP_EF:
+    emit(tr, RG_EF, DC_VALUE, DC_VALUE, DC_VALUE, pc);
+    break;
+  case OP_HL:
+    emit(tr, RG_HL, tr->depth, DC_VALUE, DC_VALUE, pc);
+    break;
+  default:
+    flush(tr, pc);
+    emit(tr, RG_LEAVE, tr->depth, DC_VALUE, DC_VALUE, pc);
+    break;
+  }
+}
+
+/*
+ * Translates verified code, whose stack depth above the frame base is
+ * depths[pc] (-1 where it never runs). A block starts at every target of
+ * a jump or a call and after every jump, call, exit, and instruction left
+ * to run(), so that run() and the engine can hand over at any of them.
+ * Returns NULL if there is not enough memory for the translation.
+ */
+RegisterCode* translateRegisterCode(CodeBlock* codeBlock, int* depths) {
+  Instruction* code = codeBlock->code;
+  int n = codeBlock->codeSize;
+  RegisterCode* rc = (RegisterCode*) calloc(1, sizeof(RegisterCode));
+  struct Translation tr;
+  char* leader = (char*) calloc(n + 1, sizeof(char));
+  int inBlock = 0;
+  int pc, i;
+
+  tr.result = rc;
+  tr.capacity = n + 1;
+  tr.constantCapacity = 16;
+  tr.slotMask = 31;
+  tr.wordCapacity = 16;
+  tr.count = 0;
+  tr.depth = 0;
+  tr.failed = 0;
+  tr.constantSlots = (int*) malloc((tr.slotMask + 1) * sizeof(int));
+  tr.words = (struct StackWord*) malloc(tr.wordCapacity * sizeof(struct StackWord));
+  if (rc != NULL) {
+    rc->stackSize = n;
+    rc->entries = (int*) malloc((n + 1) * sizeof(int));
+    rc->code = (RegInstruction*) malloc(tr.capacity * sizeof(RegInstruction));
+    rc->constants = (WORD*) malloc(tr.constantCapacity * sizeof(WORD));
+  }
+  if ((rc == NULL) || (leader == NULL) || (tr.constantSlots == NULL) || (tr.words == NULL)
+      || (rc->entries == NULL) || (rc->code == NULL) || (rc->constants == NULL)) {
+    free(leader);
+    free(tr.constantSlots);
+    free(tr.words);
+    freeRegisterCode(rc);
+    return NULL;
+  }
+  for (i = 0; i <= tr.slotMask; i ++)
+    tr.constantSlots[i] = -1;
+
+  leader[0] = 1;
+  for (pc = 0; pc < n; pc ++) {
+    enum OpCode op = code[pc].op;
+
+    rc->entries[pc] = -1;
+    if (((op == OP_J) || (op == OP_FJ) || (op == OP_CALL)) && (code[pc].q >= 0) && (code[pc].q < n))
+      leader[code[pc].q] = 1;
+    if ((op == OP_J) || (op == OP_FJ) || (op == OP_CALL) || (op == OP_HL)
+	|| (op == OP_EP) || (op == OP_EF) || !isTranslated(op))
+      leader[pc + 1] = 1;
+  }
+  rc->entries[n] = -1;
+
+  for (pc = 0; (pc < n) && !tr.failed; pc ++) {
+    if (depths[pc] < 0) {
+      inBlock = 0;
+      continue;
+    }
+    if (leader[pc] || !inBlock) {
+      if (inBlock)
+	flush(&tr, pc);
+      tr.count = 0;
+      tr.depth = depths[pc];
+      rc->entries[pc] = rc->codeSize;
+      inBlock = 1;
+    }
+    translate(&tr, &code[pc], pc);
+    if (leader[pc + 1] && ((code[pc].op == OP_J) || (code[pc].op == OP_CALL) || (code[pc].op == OP_HL)
+			   || (code[pc].op == OP_EP) || (code[pc].op == OP_EF) || !isTranslated(code[pc].op)))
+      inBlock = 0;
+  }
+  if (inBlock)
+    flush(&tr, n);
+
+  free(tr.words);
+  free(tr.constantSlots);
+  free(leader);
+  if (tr.failed) {
+    freeRegisterCode(rc);
+    return NULL;
+  }
+  // Jumps go to the entries of their targets
+  for (i = 0; i < rc->codeSize; i ++)
+    if ((rc->code[i].op >= RG_J) && (rc->code[i].op <= RG_JFLE))
+      rc->code[i].a = rc->entries[rc->code[i].a];
+  return rc;
+}
+
+void freeRegisterCode(RegisterCode* registerCode) {
+  if (registerCode == NULL) return;
+  free(registerCode->code);
+  free(registerCode->constants);
+  free(registerCode->entries);
+  free(registerCode);
+}
+
+static char* regNames[NUM_OF_REG_OPCODES] = {
+  "MOV", "ADD", "SUB", "MUL", "DIV", "PW", "NEG",
+  "EQ", "NE", "GT", "LT", "GE", "LE",
+  "J", "JF", "JFEQ", "JFNE", "JFGT", "JFLT", "JFGE", "JFLE",
+  "LA", "LDU", "STU", "LI", "ST",
+  "RI", "RC", "WRI", "WRC", "WLN",
+  "CALL", "EP", "EF", "HL", "LEAVE"
+};
+
+// Operands: f[x] for an offset, #c for a constant
+static void printOperand(RegisterCode* registerCode, WORD x) {
+  if (x >= 0) printf(" f[%d]", x);
+  else printf(" #%d", registerCode->constants[~x]);
+}
+
+void printRegisterCode(RegisterCode* registerCode) {
+  int i;
+
+  for (i = 0; i < registerCode->codeSize; i ++) {
+    RegInstruction* inst = &registerCode->code[i];
+
+    printf("%d:  %s", i, regNames[inst->op]);
+    switch (inst->op) {
+    case RG_MOV: case RG_NEG: case RG_LI: case RG_ST:
+      printOperand(registerCode, inst->a);
+      printOperand(registerCode, inst->b);
+      break;
+    case RG_J:
+      printf(" %d", inst->a);
+      break;
+    case RG_JF:
+      printf(" %d", inst->a);
+      printOperand(registerCode, inst->b);
+      break;
+    case RG_LA: case RG_LDU:
+      printOperand(registerCode, inst->a);
+      printf(" %d,%d", inst->b, inst->c);
+      break;
+    case RG_STU:
+      printf(" %d,%d", inst->b, inst->c);
+      printOperand(registerCode, inst->a);
+      break;
+    case RG_RI: case RG_RC: case RG_WRI: case RG_WRC:
+      printOperand(registerCode, inst->a);
+      break;
+    case RG_CALL:
+      printf(" %d,%d f[%d]", inst->b, inst->c, inst->a);
+      break;
+    case RG_HL: case RG_LEAVE:
+      printf(" f[%d]", inst->a);
+      break;
+    case RG_WLN: case RG_EP: case RG_EF:
+      break;
+    default:
+      if (inst->op >= RG_JFEQ)
+	printf(" %d", inst->a);
+      else printOperand(registerCode, inst->a);
+      printOperand(registerCode, inst->b);
+      printOperand(registerCode, inst->c);
+      break;
+    }
+    printf("    (%d)\n", inst->pc);
+  }
+}
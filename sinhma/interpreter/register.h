@@ -0,0 +1,97 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __REGISTER_H__
+#define __REGISTER_H__
+
+#include "instructions.h"
+
+/*
+ * Register form of a code block, run by the register engine. The words of
+ * the expression stack lie in the frame above the locals, at a depth the
+ * verifier knows for every pc, so a register instruction names them, and
+ * the variables of the current frame, by their offset from the frame
+ * base f: a := b + c is one ADD instead of LA, LV, LV, AD, ST.
+ *
+ * A destination is an offset. A source RK(x) is f[x] when x >= 0 and the
+ * constant constants[~x] otherwise. Every instruction keeps the pc of the
+ * stack instruction it comes from; frames hold those pcs as return
+ * addresses, as in the stack machine.
+ */
+
+enum RegOpCode {
+  RG_MOV,   // f[a] := RK(b)
+  RG_ADD,   // f[a] := RK(b) + RK(c)
+  RG_SUB,   // f[a] := RK(b) - RK(c)
+  RG_MUL,   // f[a] := RK(b) * RK(c)
+  RG_DIV,   // f[a] := RK(b) / RK(c)
+  RG_PW,    // f[a] := RK(b) ** RK(c)
+  RG_NEG,   // f[a] := - RK(b)
+  RG_EQ,    // f[a] := RK(b) = RK(c)
+  RG_NE,    // f[a] := RK(b) != RK(c)
+  RG_GT,    // f[a] := RK(b) > RK(c)
+  RG_LT,    // f[a] := RK(b) < RK(c)
+  RG_GE,    // f[a] := RK(b) >= RK(c)
+  RG_LE,    // f[a] := RK(b) <= RK(c)
+
+  RG_J,     // pc := a
+  RG_JF,    // if RK(b) = 0 then pc := a
+  RG_JFEQ,  // if not RK(b) = RK(c) then pc := a
+  RG_JFNE,  // if not RK(b) != RK(c) then pc := a
+  RG_JFGT,  // if not RK(b) > RK(c) then pc := a
+  RG_JFLT,  // if not RK(b) < RK(c) then pc := a
+  RG_JFGE,  // if not RK(b) >= RK(c) then pc := a
+  RG_JFLE,  // if not RK(b) <= RK(c) then pc := a
+
+  RG_LA,    // f[a] := base(b) + c
+  RG_LDU,   // f[a] := s[base(b) + c]    a variable of an enclosing frame
+  RG_STU,   // s[base(b) + c] := RK(a)
+  RG_LI,    // f[a] := s[RK(b)]
+  RG_ST,    // s[RK(a)] := RK(b)
+
+  RG_RI,    // f[a] := the integer read
+  RG_RC,    // f[a] := the character read
+  RG_WRI,   // write the integer RK(a)
+  RG_WRC,   // write the character RK(a)
+  RG_WLN,   // write a new line
+
+  RG_CALL,  // call the procedure at the stack pc c with static link b, its frame at f + a
+  RG_EP,    // return from a procedure
+  RG_EF,    // return from a function, its result in f[0]
+  RG_HL,    // t := f + a - 1; halt
+  RG_LEAVE, // t := f + a - 1; the stack instruction at pc is left to run()
+
+  NUM_OF_REG_OPCODES
+};
+
+struct RegInstruction_ {
+  enum RegOpCode op;
+  WORD a;
+  WORD b;
+  WORD c;
+  int pc;
+};
+
+typedef struct RegInstruction_ RegInstruction;
+
+struct RegisterCode_ {
+  RegInstruction* code;
+  int codeSize;
+  WORD* constants;
+  int constantCount;
+  // entries[pc] is where the engine starts for the stack pc, -1 where it
+  // cannot: run() steps the stack code until it reaches one
+  int* entries;
+  int stackSize;
+};
+
+typedef struct RegisterCode_ RegisterCode;
+
+RegisterCode* translateRegisterCode(CodeBlock* codeBlock, int* depths);
+void freeRegisterCode(RegisterCode* registerCode);
+void printRegisterCode(RegisterCode* registerCode);
+
+#endif
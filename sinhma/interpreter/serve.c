@@ -0,0 +1,331 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "serve.h"
+
+#define REQUEST_SIZE 1024
+
+// A program being served, with its idle VMs and its latencies
+struct Served_ {
+  char* name;
+  VM* program;
+  VM** idle;
+  int idleCount;
+  long requests;
+  long failed;
+  double* latencies;            // Microseconds, the last LATENCY_SAMPLES
+  pthread_mutex_t lock;
+};
+
+typedef struct Served_ Served;
+
+// The output side of a connection, which knows where its last line ended
+struct Client_ {
+  int socket;
+  int lineEnded;
+};
+
+typedef struct Client_ Client;
+
+static Served* served;
+static int servedCount;
+static int listenSocket;
+
+static double now(void) {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// A VM of the pool: its own stack and display on the shared program
+static VM* createWorkerVM(VM* program) {
+  VM* vm = (VM*) malloc(sizeof(VM));
+
+  vm->stackSize = program->stackSize;
+  vm->codeSize = program->codeSize;
+  vm->debugMode = 0;
+  vm->engine = program->engine;
+  vm->fuseMode = program->fuseMode;
+  vm->hugePages = program->hugePages;
+  initVM(vm);
+  shareExecutable(vm, program);
+  return vm;
+}
+
+// There are as many idle VMs as threads, so there is always one
+static VM* takeVM(Served* s) {
+  VM* vm;
+
+  pthread_mutex_lock(&s->lock);
+  vm = s->idle[-- s->idleCount];
+  pthread_mutex_unlock(&s->lock);
+  return vm;
+}
+
+static void putVM(Served* s, VM* vm, double microseconds, int failed) {
+  pthread_mutex_lock(&s->lock);
+  s->idle[s->idleCount ++] = vm;
+  s->latencies[s->requests % LATENCY_SAMPLES] = microseconds;
+  s->requests ++;
+  if (failed) s->failed ++;
+  pthread_mutex_unlock(&s->lock);
+}
+
+static char* baseName(char* path) {
+  char* slash = strrchr(path, '/');
+
+  return (slash != NULL) ? slash + 1 : path;
+}
+
+// By the name it was given, or the last part of it
+static Served* findServed(char* name) {
+  int i;
+
+  if (name[0] == '\0') return &served[0];
+  for (i = 0; i < servedCount; i ++)
+    if ((strcmp(name, served[i].name) == 0) || (strcmp(name, baseName(served[i].name)) == 0))
+      return &served[i];
+  return NULL;
+}
+
+static int compareLatencies(const void* a, const void* b) {
+  double x = *(double*) a;
+  double y = *(double*) b;
+
+  return (x > y) - (x < y);
+}
+
+static void printStats(FILE* f) {
+  double* sorted = (double*) malloc(LATENCY_SAMPLES * sizeof(double));
+  int i;
+
+  if (sorted == NULL) {
+    fprintf(f, "kplrun: out of memory\n");
+    return;
+  }
+
+  for (i = 0; i < servedCount; i ++) {
+    Served* s = &served[i];
+    long requests, failed;
+    int n;
+
+    pthread_mutex_lock(&s->lock);
+    requests = s->requests;
+    failed = s->failed;
+    n = (requests < LATENCY_SAMPLES) ? requests : LATENCY_SAMPLES;
+    memcpy(sorted, s->latencies, n * sizeof(double));
+    pthread_mutex_unlock(&s->lock);
+
+    qsort(sorted, n, sizeof(double), compareLatencies);
+    // Nearest rank: the smallest sample with at least p% of them at or below it
+    if (n == 0)
+      fprintf(f, "%s: 0 requests\n", s->name);
+    else fprintf(f, "%s: %ld requests, %ld failed, p50 %.0fus, p99 %.0fus\n", s->name,
+		 requests, failed, sorted[(50 * n + 99) / 100 - 1], sorted[(99 * n + 99) / 100 - 1]);
+  }
+  free(sorted);
+}
+
+static ssize_t writeClient(void* cookie, const char* data, size_t size) {
+  Client* client = (Client*) cookie;
+  size_t done = 0;
+
+  while (done < size) {
+    ssize_t n = write(client->socket, data + done, size - done);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return (done > 0) ? done : -1;
+    }
+    done += n;
+  }
+  if (size > 0)
+    client->lineEnded = (data[size - 1] == '\n');
+  return done;
+}
+
+static int closeClient(void* cookie) {
+  return close(((Client*) cookie)->socket);
+}
+
+/*
+ * Runs a request on an idle VM. Its output is line buffered, and flushed
+ * before every read, so that it reaches the client as it is printed. The
+ * stack goes back to the system before the VM goes back to the pool: the
+ * next request finds it as a new process would.
+ */
+static void runRequest(Served* s, FILE* in, FILE* out, Client* client, double start) {
+  VM* vm = takeVM(s);
+  double microseconds;
+  char* message;
+  int ps;
+
+  setvbuf(out, NULL, _IOLBF, 0);
+  resetVM(vm);
+  vm->inputStream = in;
+  vm->outputStream = out;
+  ps = run(vm);
+  message = runtimeMessage(ps);
+  if (message != NULL)
+    fprintf(out, "Runtime error: %s\n", message);
+  fflush(out);
+  // The status line is a line of its own, whatever the program printed
+  if (!client->lineEnded)
+    fputc('\n', out);
+  microseconds = (now() - start) * 1e6;
+  fprintf(out, "kplrun: %s %.0fus\n", (ps == PS_NORMAL_EXIT) ? "ok" : "failed", microseconds);
+  fflush(out);
+
+  clearStack(vm->stackMemory);
+  vm->inputStream = stdin;
+  vm->outputStream = stdout;
+  putVM(s, vm, microseconds, ps != PS_NORMAL_EXIT);
+}
+
+static void serveClient(int connection) {
+  cookie_io_functions_t functions = { NULL, writeClient, NULL, closeClient };
+  Client client = { dup(connection), 1 };
+  double start = now();
+  FILE* in = fdopen(connection, "r");
+  FILE* out = fopencookie(&client, "w", functions);
+  char request[REQUEST_SIZE];
+  Served* s;
+
+  if ((in == NULL) || (out == NULL)) {
+    if (in != NULL) fclose(in);
+    else close(connection);
+    if (out != NULL) fclose(out);
+    else close(client.socket);
+    return;
+  }
+  if (fgets(request, sizeof(request), in) != NULL) {
+    request[strcspn(request, "\r\n")] = '\0';
+    if (strcmp(request, "STATS") == 0)
+      printStats(out);
+    else if ((strncmp(request, "RUN", 3) == 0) && ((request[3] == '\0') || (request[3] == ' '))) {
+      char* name = request + 3;
+
+      while (*name == ' ') name ++;
+      s = findServed(name);
+      if (s != NULL)
+	runRequest(s, in, out, &client, start);
+      else fprintf(out, "kplrun: no program %s\n", name);
+    } else fprintf(out, "kplrun: bad request\n");
+  }
+  fclose(in);
+  fclose(out);
+}
+
+static void* worker(void* unused) {
+  int connection;
+
+  for (;;) {
+    connection = accept(listenSocket, NULL, NULL);
+    if (connection >= 0)
+      serveClient(connection);
+    else if (errno != EINTR)
+      break;
+  }
+  return NULL;
+}
+
+static int openSocket(char* path) {
+  struct sockaddr_un address;
+  int s;
+
+  if (strlen(path) >= sizeof(address.sun_path)) return -1;
+  s = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (s < 0) return -1;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+  unlink(path);
+  if ((bind(s, (struct sockaddr*) &address, sizeof(address)) != 0) || (listen(s, SOMAXCONN) != 0)) {
+    close(s);
+    return -1;
+  }
+  return s;
+}
+
+/*
+ * Serves the programs loaded into the given VMs on a Unix socket, with
+ * jobs threads, each request on a VM of a pool made beforehand. Runs until
+ * SIGINT or SIGTERM, then prints the statistics on stderr. Returns -1 if
+ * the socket cannot be opened.
+ */
+int runServer(VM** programs, char** names, int count, char* socketPath, int jobs) {
+  pthread_t* threads;
+  sigset_t stop;
+  int received;
+  int i, k;
+
+  listenSocket = openSocket(socketPath);
+  if (listenSocket < 0) return -1;
+
+  served = (Served*) malloc(count * sizeof(Served));
+  servedCount = count;
+  for (i = 0; i < count; i ++) {
+    Served* s = &served[i];
+
+    s->name = names[i];
+    s->program = programs[i];
+    s->idle = (VM**) malloc(jobs * sizeof(VM*));
+    for (k = 0; k < jobs; k ++)
+      s->idle[k] = createWorkerVM(programs[i]);
+    s->idleCount = jobs;
+    s->requests = 0;
+    s->failed = 0;
+    s->latencies = (double*) malloc(LATENCY_SAMPLES * sizeof(double));
+    pthread_mutex_init(&s->lock, NULL);
+  }
+
+  // Clients that leave early must not kill the server; the stop signals
+  // are waited for here, and blocked in the workers
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGINT);
+  sigaddset(&stop, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  threads = (pthread_t*) malloc(jobs * sizeof(pthread_t));
+  for (i = 0; i < jobs; i ++)
+    pthread_create(&threads[i], NULL, worker, NULL);
+  fprintf(stderr, "kplrun: serving %d program(s) on %s with %d threads\n", count, socketPath, jobs);
+
+  sigwait(&stop, &received);
+  // Wakes the workers up in accept; those running a request finish it
+  shutdown(listenSocket, SHUT_RDWR);
+  for (i = 0; i < jobs; i ++)
+    pthread_join(threads[i], NULL);
+  close(listenSocket);
+  unlink(socketPath);
+  printStats(stderr);
+
+  for (i = 0; i < count; i ++) {
+    for (k = 0; k < served[i].idleCount; k ++) {
+      cleanVM(served[i].idle[k]);
+      free(served[i].idle[k]);
+    }
+    free(served[i].idle);
+    free(served[i].latencies);
+    pthread_mutex_destroy(&served[i].lock);
+  }
+  free(served);
+  free(threads);
+  return 0;
+}
@@ -0,0 +1,27 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __SERVE_H__
+#define __SERVE_H__
+
+#include "vm.h"
+
+/*
+ * Requests to a server are connections to its Unix socket. A connection
+ * starts with one line:
+ *   RUN [name]   runs the program of that name (the first one without a
+ *                name); the rest of the connection is its input, and its
+ *                output comes back as it is printed, then one status line
+ *                "kplrun: <status> <microseconds>us"
+ *   STATS        one line per program: requests, failures and the 50th
+ *                and 99th percentiles of the latency of the last ones
+ */
+
+#define LATENCY_SAMPLES (1 << 14)
+
+int runServer(VM** programs, char** names, int count, char* socketPath, int jobs);
+
+#endif
@@ -0,0 +1,173 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "snapshot.h"
+
+void restoreDisplay(VM* vm, int returnPc);
+
+struct SnapshotMessage {
+  SnapshotError error;
+  char* message;
+};
+
+struct SnapshotMessage snapshotMessages[] = {
+  {SNAPSHOT_OK, "No error."},
+  {SNAPSHOT_NO_FILE, "Can't open the snapshot file."},
+  {SNAPSHOT_WRONG_FORMAT, "Wrong snapshot format."},
+  {SNAPSHOT_OTHER_CODE, "Snapshot of another program (or of other loading options)."},
+  {SNAPSHOT_TOO_LARGE, "Snapshot stack larger than the stack."},
+  {SNAPSHOT_IO_ERROR, "Can't read or write the snapshot."},
+};
+
+char* snapshotMessage(SnapshotError error) {
+  return snapshotMessages[error].message;
+}
+
+// FNV-1a over the code as it runs, superinstructions included
+static unsigned long long hashCode(CodeBlock* codeBlock) {
+  unsigned char* bytes = (unsigned char*) codeBlock->code;
+  size_t n = codeBlock->codeSize * sizeof(Instruction);
+  unsigned long long hash = 14695981039346656037ULL;
+  size_t i;
+
+  for (i = 0; i < n; i ++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static int writeAll(int fd, void* data, size_t size) {
+  char* s = (char*) data;
+
+  while (size > 0) {
+    ssize_t n = write(fd, s, size);
+    if (n <= 0) return 0;
+    s += n;
+    size -= n;
+  }
+  return 1;
+}
+
+static int readAll(int fd, void* data, size_t size, off_t offset) {
+  char* s = (char*) data;
+
+  while (size > 0) {
+    ssize_t n = pread(fd, s, size, offset);
+    if (n <= 0) return 0;
+    s += n;
+    size -= n;
+    offset += n;
+  }
+  return 1;
+}
+
+// The words kept: the spare words to s[t], whole pages of them
+static int dataSize(int t, int pageSize) {
+  int size = (t + 1 + STACK_SPARE_WORDS) * sizeof(WORD);
+  return (size + pageSize - 1) / pageSize * pageSize;
+}
+
+SnapshotError saveSnapshot(VM* vm, char* fileName) {
+  SnapshotHeader header;
+  int fd;
+  int ok;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.codeHash = hashCode(vm->codeBlock);
+  header.codeSize = vm->codeBlock->codeSize;
+  header.t = vm->t;
+  header.b = vm->b;
+  header.pc = vm->pc;
+  header.pageSize = sysconf(_SC_PAGESIZE);
+  header.dataOffset = header.pageSize;
+  header.dataSize = dataSize(vm->t, header.pageSize);
+  if (header.dataSize > (vm->stackSize + STACK_SPARE_WORDS) * sizeof(WORD))
+    header.dataSize = (vm->stackSize + STACK_SPARE_WORDS) * sizeof(WORD);
+
+  fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return SNAPSHOT_NO_FILE;
+  ok = writeAll(fd, &header, sizeof(header))
+    && (lseek(fd, header.dataOffset, SEEK_SET) == header.dataOffset)
+    && writeAll(fd, vm->stack - STACK_SPARE_WORDS, header.dataSize);
+  close(fd);
+  return ok ? SNAPSHOT_OK : SNAPSHOT_IO_ERROR;
+}
+
+// The static links restoreDisplay() follows from b stay below t
+static int validChain(VM* vm, SnapshotHeader* header) {
+  WORD frame = header->b;
+  int l;
+
+  for (l = vm->codeLevels[header->pc]; l > 0; l --) {
+    if ((frame < 0) || (frame + 3 > header->t))
+      return 0;
+    frame = vm->stack[frame + 3];
+  }
+  return (frame >= 0) && (frame <= header->t + 1);
+}
+
+/*
+ * Puts a VM, its program loaded, back in the state of a snapshot. The
+ * stack is mapped copy-on-write from the file when it is mapped itself
+ * and the page sizes agree, so only the pages touched are ever read.
+ */
+SnapshotError restoreSnapshot(VM* vm, char* fileName) {
+  SnapshotHeader header;
+  StackMemory* memory = vm->stackMemory;
+  int fd = open(fileName, O_RDONLY);
+  int mapped = 0;
+
+  if (fd < 0) return SNAPSHOT_NO_FILE;
+  if (!readAll(fd, &header, sizeof(header), 0)
+      || (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+      || (header.version != SNAPSHOT_VERSION)) {
+    close(fd);
+    return SNAPSHOT_WRONG_FORMAT;
+  }
+  if ((header.codeSize != vm->codeBlock->codeSize) || (header.codeHash != hashCode(vm->codeBlock))) {
+    close(fd);
+    return SNAPSHOT_OTHER_CODE;
+  }
+  // The registers must point into the code and the stack saved with them
+  if ((header.t < -1) || (header.b < 0) || (header.b > header.t + 1)
+      || (header.pc < 0) || (header.pc >= vm->codeBlock->codeSize)
+      || (vm->codeLevels[header.pc] < 0) || (header.dataOffset < 0) || (header.dataSize < 0)) {
+    close(fd);
+    return SNAPSHOT_WRONG_FORMAT;
+  }
+  if ((header.t >= vm->stackSize) || (header.dataSize > (vm->stackSize + STACK_SPARE_WORDS) * sizeof(WORD))) {
+    close(fd);
+    return SNAPSHOT_TOO_LARGE;
+  }
+
+  if ((memory->region != NULL) && (header.pageSize == sysconf(_SC_PAGESIZE))
+      && (memory->low + header.dataSize <= memory->high))
+    mapped = mmap(memory->low, header.dataSize, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_FIXED, fd, header.dataOffset) != MAP_FAILED;
+  if (!mapped && !readAll(fd, vm->stack - STACK_SPARE_WORDS, header.dataSize, header.dataOffset)) {
+    close(fd);
+    return SNAPSHOT_IO_ERROR;
+  }
+  close(fd);
+  if (!validChain(vm, &header))
+    return SNAPSHOT_WRONG_FORMAT;
+
+  resetVM(vm);
+  vm->t = header.t;
+  vm->b = header.b;
+  vm->pc = header.pc;
+  restoreDisplay(vm, vm->pc);
+  return SNAPSHOT_OK;
+}
@@ -0,0 +1,53 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "vm.h"
+
+/*
+ * A snapshot holds the registers of a VM and its stack up to t, taken at
+ * a break point, together with a hash of the code it belongs to. The stack
+ * starts on a page boundary of the file, so that a restore can map it in
+ * place of the stack instead of reading it.
+ */
+
+#define SNAPSHOT_MAGIC "KPLS"
+#define SNAPSHOT_VERSION 2
+
+struct SnapshotHeader_ {
+  char magic[4];
+  int version;
+  unsigned long long codeHash;
+  int codeSize;
+  int t;
+  int b;
+  int pc;
+  int pageSize;
+  int dataOffset;               // The words from the spare ones on
+  int dataSize;
+  int padding;
+};
+
+typedef struct SnapshotHeader_ SnapshotHeader;
+
+enum SnapshotError {
+  SNAPSHOT_OK,
+  SNAPSHOT_NO_FILE,
+  SNAPSHOT_WRONG_FORMAT,
+  SNAPSHOT_OTHER_CODE,
+  SNAPSHOT_TOO_LARGE,
+  SNAPSHOT_IO_ERROR
+};
+
+typedef enum SnapshotError SnapshotError;
+
+SnapshotError saveSnapshot(VM* vm, char* fileName);
+SnapshotError restoreSnapshot(VM* vm, char* fileName);
+char* snapshotMessage(SnapshotError error);
+
+#endif
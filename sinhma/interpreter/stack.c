@@ -0,0 +1,91 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "stack.h"
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+static size_t roundUp(size_t size, size_t unit) {
+  return (size + unit - 1) / unit * unit;
+}
+
+/*
+ * Reserves size words (and the spare one) with STACK_GUARD_SIZE bytes of
+ * inaccessible memory on both sides. With hugePages the words start on a
+ * huge page boundary and the system is asked to back them with huge pages.
+ * Falls back to malloc, without guards, if the region cannot be mapped.
+ */
+StackMemory* createStack(int size, int hugePages) {
+  StackMemory* memory = (StackMemory*) malloc(sizeof(StackMemory));
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t align = hugePages ? HUGE_PAGE_SIZE : page;
+  size_t bytes = roundUp(((size_t) size + STACK_SPARE_WORDS) * sizeof(WORD), align);
+  size_t guard = roundUp(STACK_GUARD_SIZE, page);
+  char* start;
+
+  memory->size = size;
+  memory->regionSize = guard + align + bytes + guard;
+  memory->region = mmap(NULL, memory->regionSize, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory->region == MAP_FAILED)
+    memory->region = NULL;
+  else {
+    start = (char*) roundUp((uintptr_t) (memory->region + guard), align);
+    if (mprotect(start, bytes, PROT_READ | PROT_WRITE) != 0) {
+      munmap(memory->region, memory->regionSize);
+      memory->region = NULL;
+    }
+  }
+  if (memory->region == NULL) {
+    memory->low = memory->high = NULL;
+    memory->words = (WORD*) malloc((size + STACK_SPARE_WORDS) * sizeof(WORD)) + STACK_SPARE_WORDS;
+    return memory;
+  }
+
+#ifdef MADV_HUGEPAGE
+  if (hugePages)
+    madvise(start, bytes, MADV_HUGEPAGE);
+#endif
+  memory->low = start;
+  memory->high = start + bytes;
+  memory->words = (WORD*) start + STACK_SPARE_WORDS;
+  return memory;
+}
+
+void freeStack(StackMemory* memory) {
+  if (memory == NULL) return;
+  if (memory->region != NULL)
+    munmap(memory->region, memory->regionSize);
+  else free(memory->words - STACK_SPARE_WORDS);
+  free(memory);
+}
+
+/*
+ * Gives the pages a program used back to the system, so that the next
+ * program run on the stack finds it as new: zero, and not committed.
+ */
+void clearStack(StackMemory* memory) {
+  if (memory->region != NULL)
+    madvise(memory->low, memory->high - memory->low, MADV_DONTNEED);
+  else memset(memory->words - STACK_SPARE_WORDS, 0, (memory->size + STACK_SPARE_WORDS) * sizeof(WORD));
+}
+
+// Whether an address falls in one of the guard regions of the stack
+int isStackGuard(StackMemory* memory, void* address) {
+  char* a = (char*) address;
+
+  if ((memory == NULL) || (memory->region == NULL)) return 0;
+  return (a >= memory->region) && (a < memory->region + memory->regionSize)
+    && ((a < memory->low) || (a >= memory->high));
+}
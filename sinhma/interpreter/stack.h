@@ -0,0 +1,44 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __STACK_H__
+#define __STACK_H__
+
+#include <stddef.h>
+#include "instructions.h"
+
+/*
+ * Memory of the VM stack. The words are reserved as one virtual region
+ * between two guard regions; the system only commits the pages the
+ * program touches, so a large stack costs nothing until it is used.
+ * words[-2] and words[-1] are spare (the cached engine spills into
+ * words[-1]) and words[0] is on an 8-byte boundary, so that the DOUBLEs
+ * of the main program's frame, at base 0, are aligned. Other frames may
+ * start at any word.
+ */
+
+#define STACK_SPARE_WORDS 2
+
+#define STACK_GUARD_SIZE (1 << 20)
+#define HUGE_PAGE_SIZE   (1 << 21)
+
+struct StackMemory_ {
+  WORD* words;
+  int size;
+  char* region;
+  size_t regionSize;
+  char* low;                    // Guarded below low and from high on
+  char* high;
+};
+
+typedef struct StackMemory_ StackMemory;
+
+StackMemory* createStack(int size, int hugePages);
+void freeStack(StackMemory* memory);
+void clearStack(StackMemory* memory);
+int isStackGuard(StackMemory* memory, void* address);
+
+#endif
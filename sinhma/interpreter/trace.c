@@ -0,0 +1,82 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// The trace written when a signal stops the process
+static Trace* signalTrace = NULL;
+
+// The file is opened at once, so that a signal handler only has to write
+Trace* createTrace(char* fileName) {
+  Trace* trace = (Trace*) malloc(sizeof(Trace));
+
+  trace->fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (trace->fd < 0) {
+    free(trace);
+    return NULL;
+  }
+  trace->records = (TraceRecord*) malloc(TRACE_RECORDS * sizeof(TraceRecord));
+  trace->next = 0;
+  return trace;
+}
+
+void freeTrace(Trace* trace) {
+  if (trace == NULL) return;
+  if (signalTrace == trace)
+    signalTrace = NULL;
+  close(trace->fd);
+  free(trace->records);
+  free(trace);
+}
+
+/*
+ * Writes the trace over the file, oldest record first. Only write() and
+ * lseek() are used, so that it can be called from a signal handler.
+ */
+void dumpTrace(Trace* trace, int reason) {
+  TraceHeader header;
+  int first = 0;
+
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_VERSION;
+  header.recordSize = sizeof(TraceRecord);
+  header.total = trace->next;
+  header.reason = reason;
+  header.padding = 0;
+  if (trace->next > TRACE_RECORDS) {
+    header.count = TRACE_RECORDS;
+    first = trace->next & (TRACE_RECORDS - 1);
+  } else header.count = trace->next;
+
+  if (lseek(trace->fd, 0, SEEK_SET) != 0) return;
+  if (write(trace->fd, &header, sizeof(header)) != sizeof(header)) return;
+  if (write(trace->fd, trace->records + first, (header.count - first) * sizeof(TraceRecord)) < 0) return;
+  if (write(trace->fd, trace->records, first * sizeof(TraceRecord)) < 0) return;
+}
+
+static void signalHandler(int sig) {
+  if (signalTrace != NULL)
+    dumpTrace(signalTrace, - sig);
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+// Dumps the trace before the signals that end a process by default
+void dumpTraceOnSignals(Trace* trace) {
+  signalTrace = trace;
+  signal(SIGINT, signalHandler);
+  signal(SIGTERM, signalHandler);
+  signal(SIGQUIT, signalHandler);
+  signal(SIGABRT, signalHandler);
+  signal(SIGFPE, signalHandler);
+  signal(SIGBUS, signalHandler);
+}
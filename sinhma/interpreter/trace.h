@@ -0,0 +1,68 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "instructions.h"
+
+/*
+ * Ring buffer of the last TRACE_RECORDS instructions executed, each with
+ * the registers before it ran. A trace file is a TraceHeader followed by
+ * the records kept, oldest first; kpltrace prints it against the program.
+ */
+
+#define TRACE_MAGIC "KPLT"
+#define TRACE_VERSION 1
+#define TRACE_RECORDS (1 << 16)
+
+struct TraceRecord_ {
+  int pc;
+  int op;
+  int t;
+  int b;
+  WORD top;                     // s[t]
+};
+
+typedef struct TraceRecord_ TraceRecord;
+
+struct TraceHeader_ {
+  char magic[4];
+  int version;
+  int recordSize;
+  int count;                    // Records in the file
+  unsigned long long total;     // Instructions executed
+  int reason;                   // Final PS_ state, or minus the signal
+  int padding;
+};
+
+typedef struct TraceHeader_ TraceHeader;
+
+struct Trace_ {
+  TraceRecord* records;
+  unsigned long long next;
+  int fd;
+};
+
+typedef struct Trace_ Trace;
+
+Trace* createTrace(char* fileName);
+void freeTrace(Trace* trace);
+void dumpTrace(Trace* trace, int reason);
+void dumpTraceOnSignals(Trace* trace);
+
+static inline void traceStep(Trace* trace, int pc, int op, int t, int b, WORD top) {
+  TraceRecord* record = &trace->records[trace->next & (TRACE_RECORDS - 1)];
+
+  record->pc = pc;
+  record->op = op;
+  record->t = t;
+  record->b = b;
+  record->top = top;
+  trace->next ++;
+}
+
+#endif
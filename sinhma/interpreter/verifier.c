@@ -0,0 +1,389 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include "verifier.h"
+
+#define RETURNS_PROCEDURE 1
+#define RETURNS_FUNCTION  2
+#define RETURNS_DOUBLE    4
+
+// Bound of depths and frames, so that no depth computed below can overflow
+#define MAX_FRAME_SIZE    (INT_MAX / 2)
+
+struct VerifyMessage {
+  VerifyError error;
+  char* message;
+};
+
+struct VerifyMessage verifyMessages[] = {
+  {VE_OK, "No error."},
+  {VE_EMPTY_CODE, "No instructions."},
+  {VE_INVALID_OPCODE, "Invalid opcode."},
+  {VE_INVALID_TARGET, "Jump or call outside the code."},
+  {VE_END_OF_CODE, "Execution runs off the end of the code."},
+  {VE_INVALID_STATIC_LINK, "Static link beyond the main program."},
+  {VE_INCONSISTENT_LEVEL, "Instruction reached at two static levels."},
+  {VE_RETURN_FROM_MAIN, "Return from the main program."},
+  {VE_SHARED_CODE, "Instruction shared by two procedures."},
+  {VE_MIXED_RETURN, "Procedure returns in more than one way (EP, EF, EFF)."},
+  {VE_STACK_UNDERFLOW, "Stack underflow."},
+  {VE_INCONSISTENT_DEPTH, "Instruction reached at two stack depths."},
+  {VE_FRAME_TOO_LARGE, "Frame larger than any stack."},
+  {VE_INSIDE_SUPERINSTRUCTION, "Jump or call into the operands of a superinstruction."},
+};
+
+char* verifyMessage(VerifyError err) {
+  return verifyMessages[err].message;
+}
+
+static int isCompareJump(enum OpCode op) {
+  return (op >= OP_VVEQ) && (op <= OP_VCLE);
+}
+
+/*
+ * Successors of an instruction inside its own procedure. A CALL goes on
+ * at pc + 1 once the callee has returned; the callee is followed from its
+ * own entry. A superinstruction goes on after its operand slots, the
+ * compare-and-jump ones also to the target of the FJ kept in their last
+ * slot. Returns how many were stored in next.
+ */
+static int successors(Instruction* code, int pc, int* next) {
+  switch (code[pc].op) {
+  case OP_J:
+    next[0] = code[pc].q;
+    return 1;
+  case OP_FJ:
+    next[0] = code[pc].q;
+    next[1] = pc + 1;
+    return 2;
+  case OP_HL:
+  case OP_EP:
+  case OP_EF:
+  case OP_EFF:
+    return 0;
+  default:
+    if (isCompareJump(code[pc].op)) {
+      next[0] = code[pc + 2].q;
+      next[1] = pc + 3;
+      return 2;
+    }
+    next[0] = pc + instructionWords(code[pc].op);
+    return 1;
+  }
+}
+
+/*
+ * How many words the instruction needs on top of the frame (pops) and by how
+ * much it moves t. The effect of a CALL seen from the caller is that of the
+ * callee's return: EF leaves the result on top, EFF its two words, EP
+ * nothing. EFF pops the words of the frame up to its result.
+ */
+static int stackEffect(Instruction* inst, int calleeReturn, int* pops) {
+  *pops = 0;
+  switch (inst->op) {
+  case OP_LA:
+  case OP_LV:
+  case OP_LC:
+  case OP_RC:
+  case OP_RI:
+  case OP_LVAC:
+    return 1;
+  case OP_INT:
+    if (inst->q < 0) *pops = - inst->q;
+    return inst->q;
+  case OP_DCT:
+    if (inst->q > 0) *pops = inst->q;
+    return - inst->q;
+  case OP_LI:
+  case OP_NEG:
+  case OP_ADC:
+    *pops = 1;
+    return 0;
+  case OP_CV:
+    *pops = 1;
+    return 1;
+  case OP_FJ:
+  case OP_WRC:
+  case OP_WRI:
+    *pops = 1;
+    return -1;
+  case OP_ST:
+  case OP_MVB:
+  case OP_FLB:
+    *pops = 2;
+    return -2;
+  case OP_AD: case OP_SB: case OP_ML: case OP_DV: case OP_PW:
+  case OP_EQ: case OP_NE: case OP_GT: case OP_LT: case OP_GE: case OP_LE:
+    *pops = 2;
+    return -1;
+  case OP_LCF:
+  case OP_LVF:
+  case OP_RF:
+    return 2;
+  case OP_LIF:
+    *pops = 1;
+    return 1;
+  case OP_STF:
+    *pops = 3;
+    return -3;
+  case OP_ADF: case OP_SBF: case OP_MLF: case OP_DVF:
+    *pops = 4;
+    return -2;
+  case OP_EQF: case OP_NEF: case OP_GTF: case OP_LTF: case OP_GEF: case OP_LEF:
+    *pops = 4;
+    return -3;
+  case OP_NEGF:
+    *pops = 2;
+    return 0;
+  case OP_PWF:
+    *pops = 3;
+    return -1;
+  case OP_CVIF:
+    *pops = (inst->q < 0) ? INT_MAX : inst->q + 1;
+    return 1;
+  case OP_CVFI:
+    *pops = 2;
+    return -1;
+  case OP_WRF:
+    *pops = 2;
+    return -2;
+  case OP_EFF:
+    *pops = (inst->q < 0) ? INT_MAX : inst->q + DOUBLE_SIZE;
+    return 0;
+  case OP_CALL:
+    if (calleeReturn == RETURNS_FUNCTION) return 1;
+    if (calleeReturn == RETURNS_DOUBLE) return 2;
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+/*
+ * Checks the whole control flow graph before anything runs, in three passes:
+ *  1. from pc 0 and every CALL target, opcodes, jump and call targets and
+ *     static links are checked and the static level of each instruction is
+ *     stored in levels (-1 for unreachable code);
+ *  2. every reachable instruction is assigned to exactly one procedure (the
+ *     main program being the one at 0), and each procedure to EP or EF;
+ *  3. the depth of the stack above the frame base is propagated through
+ *     each procedure, which must be the same on every path to an
+ *     instruction, never negative and below MAX_FRAME_SIZE.
+ * frameSizes receives for every procedure entry the largest number of words
+ * its frame can use, header included, and -1 elsewhere: a CALL whose callee
+ * fits below stackSize cannot overflow before the next CALL.
+ * Unless it is NULL, depths receives the depth found by pass 3 before each
+ * instruction (-1 for unreachable code), which the register engine needs.
+ * All tables have codeSize entries. On error errorPc is the offending pc.
+ * Superinstructions are only accepted in fused code; their operand slots
+ * count as unreachable.
+ */
+VerifyError verifyCode(CodeBlock* codeBlock, int* levels, int* frameSizes, int* depths, int* errorPc) {
+  Instruction* code = codeBlock->code;
+  int n = codeBlock->codeSize;
+  int* work;
+  int* owner;
+  int* depth;
+  int* entries;
+  char* returns;
+  int top, entryCount;
+  int next[2];
+  int count;
+  int i, e, k;
+  VerifyError err = VE_OK;
+
+  *errorPc = 0;
+  if (n <= 0) return VE_EMPTY_CODE;
+
+  work = (int*) malloc(n * sizeof(int));
+  owner = (int*) malloc(n * sizeof(int));
+  depth = (int*) malloc(n * sizeof(int));
+  entries = (int*) malloc(n * sizeof(int));
+  returns = (char*) calloc(n, sizeof(char));
+  for (i = 0; i < n; i ++) {
+    levels[i] = -1;
+    frameSizes[i] = -1;
+    owner[i] = -1;
+    depth[i] = -1;
+  }
+
+  // Pass 1: structure and static levels
+  entryCount = 0;
+  entries[entryCount++] = 0;
+  frameSizes[0] = 0;
+  levels[0] = 0;
+  top = 0;
+  work[top++] = 0;
+  while ((top > 0) && (err == VE_OK)) {
+    int pc = work[--top];
+    int level = levels[pc];
+
+    *errorPc = pc;
+    if ((code[pc].op < 0) || (code[pc].op > (codeBlock->fused ? OP_VCLE : OP_PWF))) {
+      err = VE_INVALID_OPCODE;
+      break;
+    }
+    if (pc + instructionWords(code[pc].op) > n) {
+      err = VE_END_OF_CODE;
+      break;
+    }
+    if ((((code[pc].op == OP_J) || (code[pc].op == OP_FJ) || (code[pc].op == OP_CALL))
+	 && ((code[pc].q < 0) || (code[pc].q >= n)))
+	|| (isCompareJump(code[pc].op) && ((code[pc + 2].q < 0) || (code[pc + 2].q >= n)))) {
+      err = VE_INVALID_TARGET;
+      break;
+    }
+    if (((code[pc].op == OP_EP) || (code[pc].op == OP_EF) || (code[pc].op == OP_EFF)) && (level == 0)) {
+      err = VE_RETURN_FROM_MAIN;
+      break;
+    }
+
+    if (code[pc].op == OP_CALL) {
+      int callee = code[pc].q;
+      int calleeLevel = level - code[pc].p + 1;
+
+      if ((code[pc].p < 0) || (code[pc].p > level)) {
+	err = VE_INVALID_STATIC_LINK;
+	break;
+      }
+      if (levels[callee] == -1) {
+	levels[callee] = calleeLevel;
+	work[top++] = callee;
+      } else if (levels[callee] != calleeLevel) {
+	err = VE_INCONSISTENT_LEVEL;
+	break;
+      }
+      // Until pass 3, frameSizes marks the entries found so far
+      if (frameSizes[callee] == -1) {
+	frameSizes[callee] = 0;
+	entries[entryCount++] = callee;
+      }
+    }
+
+    count = successors(code, pc, next);
+    for (i = 0; i < count; i ++) {
+      if (next[i] >= n) {
+	err = VE_END_OF_CODE;
+	break;
+      }
+      if (levels[next[i]] == -1) {
+	levels[next[i]] = level;
+	work[top++] = next[i];
+      } else if (levels[next[i]] != level) {
+	err = VE_INCONSISTENT_LEVEL;
+	break;
+      }
+    }
+  }
+
+  // Nothing reached may start inside the operand slots of a superinstruction
+  for (i = 0; (i < n) && (err == VE_OK); i ++)
+    if (levels[i] != -1)
+      for (k = 1; k < instructionWords(code[i].op); k ++)
+	if (levels[i + k] != -1) {
+	  *errorPc = i + k;
+	  err = VE_INSIDE_SUPERINSTRUCTION;
+	  break;
+	}
+
+  // Pass 2: procedures and how they return
+  for (e = 0; (e < entryCount) && (err == VE_OK); e ++) {
+    int entry = entries[e];
+
+    if (owner[entry] != -1) {
+      *errorPc = entry;
+      err = VE_SHARED_CODE;
+      break;
+    }
+    owner[entry] = entry;
+    top = 0;
+    work[top++] = entry;
+    while (top > 0) {
+      int pc = work[--top];
+
+      *errorPc = pc;
+      if (code[pc].op == OP_EP) returns[entry] |= RETURNS_PROCEDURE;
+      if (code[pc].op == OP_EF) returns[entry] |= RETURNS_FUNCTION;
+      if (code[pc].op == OP_EFF) returns[entry] |= RETURNS_DOUBLE;
+      // More than one way
+      if ((returns[entry] & (returns[entry] - 1)) != 0) {
+	err = VE_MIXED_RETURN;
+	break;
+      }
+
+      count = successors(code, pc, next);
+      for (i = 0; i < count; i ++) {
+	if (owner[next[i]] == -1) {
+	  owner[next[i]] = entry;
+	  work[top++] = next[i];
+	} else if (owner[next[i]] != entry) {
+	  err = VE_SHARED_CODE;
+	  break;
+	}
+      }
+      if (err != VE_OK) break;
+    }
+  }
+
+  // Pass 3: stack depths, relative to the base of the frame
+  for (e = 0; (e < entryCount) && (err == VE_OK); e ++) {
+    int entry = entries[e];
+    // CALL itself stores the three links above the result slot
+    int frameSize = (entry == 0) ? 0 : 4;
+
+    depth[entry] = 0;
+    top = 0;
+    work[top++] = entry;
+    while (top > 0) {
+      int pc = work[--top];
+      int pops;
+      int d = depth[pc];
+      int calleeReturn = (code[pc].op == OP_CALL) ? returns[code[pc].q] : 0;
+
+      *errorPc = pc;
+      if (((code[pc].op == OP_INT) || (code[pc].op == OP_DCT))
+	  && ((code[pc].q > MAX_FRAME_SIZE) || (code[pc].q < - MAX_FRAME_SIZE))) {
+	err = VE_FRAME_TOO_LARGE;
+	break;
+      }
+      d += stackEffect(&code[pc], calleeReturn, &pops);
+      if ((depth[pc] < pops) || (d < 0)) {
+	err = VE_STACK_UNDERFLOW;
+	break;
+      }
+      if (d > MAX_FRAME_SIZE) {
+	err = VE_FRAME_TOO_LARGE;
+	break;
+      }
+      if (d > frameSize) frameSize = d;
+
+      count = successors(code, pc, next);
+      for (i = 0; i < count; i ++) {
+	if (depth[next[i]] == -1) {
+	  depth[next[i]] = d;
+	  work[top++] = next[i];
+	} else if (depth[next[i]] != d) {
+	  err = VE_INCONSISTENT_DEPTH;
+	  break;
+	}
+      }
+      if (err != VE_OK) break;
+    }
+    frameSizes[entry] = frameSize;
+  }
+  if (depths != NULL)
+    for (i = 0; i < n; i ++)
+      depths[i] = depth[i];
+
+  free(work);
+  free(owner);
+  free(depth);
+  free(entries);
+  free(returns);
+  return err;
+}
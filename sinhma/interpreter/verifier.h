@@ -0,0 +1,32 @@
+/* 
+ * @copyright (c) 2008, Hedspi, Hanoi University of Technology
+ * @author Huu-Duc Nguyen
+ * @version 1.0
+ */
+
+#ifndef __VERIFIER_H__
+#define __VERIFIER_H__
+
+#include "instructions.h"
+
+typedef enum {
+  VE_OK,
+  VE_EMPTY_CODE,
+  VE_INVALID_OPCODE,
+  VE_INVALID_TARGET,
+  VE_END_OF_CODE,
+  VE_INVALID_STATIC_LINK,
+  VE_INCONSISTENT_LEVEL,
+  VE_RETURN_FROM_MAIN,
+  VE_SHARED_CODE,
+  VE_MIXED_RETURN,
+  VE_STACK_UNDERFLOW,
+  VE_INCONSISTENT_DEPTH,
+  VE_FRAME_TOO_LARGE,
+  VE_INSIDE_SUPERINSTRUCTION
+} VerifyError;
+
+VerifyError verifyCode(CodeBlock* codeBlock, int* levels, int* frameSizes, int* depths, int* errorPc);
+char* verifyMessage(VerifyError err);
+
+#endif
@@ -6,266 +6,2222 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
 #include <curses.h>
+#include <sys/stat.h>
 
 #include "vm.h"
+#include "fusion.h"
+#include "verifier.h"
+#include "jit.h"
+#include "packed.h"
+#include "stack.h"
+#include "snapshot.h"
 
-CodeBlock *codeBlock;
-WORD* stack;
-WORD* global;
-int t;
-int b;
-int pc;
-int ps;
-int stackSize;
-int codeSize;
-int debugMode;
+// There is one terminal, so one debugger window for all VMs
+WINDOW* win = NULL;
+// stdin and stdout are shared by the VMs that use them, and buffered once
+char inputBuffer[IO_BUFFER_SIZE];
+char outputBuffer[IO_BUFFER_SIZE];
+static pthread_once_t stdioOnce = PTHREAD_ONCE_INIT;
 
-void resetVM(void) {
-  pc = 0;
-  t = -1;
-  b = 0;
-  ps = PS_INACTIVE;
+// The stack lies between guard regions (see stack.h). A fault in one of
+// them while a VM runs on this thread stops it with PS_STACK_OVERFLOW.
+static __thread VM* runningVM = NULL;
+static struct sigaction savedSegvAction;
+static pthread_once_t processOnce = PTHREAD_ONCE_INIT;
+
+static void segvHandler(int sig, siginfo_t* info, void* context) {
+  VM* vm = runningVM;
+
+  if ((vm != NULL) && vm->overflowArmed && isStackGuard(vm->stackMemory, info->si_addr)) {
+    vm->overflowArmed = 0;
+    siglongjmp(vm->overflowJump, 1);
+  }
+  // Not ours: fault again with the previous action, the trace written
+  if ((vm != NULL) && (vm->trace != NULL))
+    dumpTrace(vm->trace, - SIGSEGV);
+  sigaction(SIGSEGV, &savedSegvAction, NULL);
+}
+
+// Process-wide setup, done by the first initVM
+static void initProcess(void) {
+  struct sigaction action;
+
+  action.sa_sigaction = segvHandler;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &savedSegvAction);
+}
+
+void resetVM(VM* vm) {
+  vm->pc = 0;
+  vm->t = -1;
+  vm->b = 0;
+  vm->ps = PS_INACTIVE;
+  vm->currentLevel = 0;
+  if (vm->display != NULL)
+    vm->display[0] = vm->b;
+}
+
+static void bufferStdio(void) {
+  setvbuf(stdin, inputBuffer, _IOFBF, IO_BUFFER_SIZE);
+  setvbuf(stdout, outputBuffer, _IOFBF, IO_BUFFER_SIZE);
+}
+
+// Sets up a VM whose options are set; its program talks to stdin/stdout
+void initVM(VM* vm) {
+  pthread_once(&processOnce, initProcess);
+  vm->codeBlock = createCodeBlock(vm->codeSize);
+  vm->codeOwner = NULL;
+  // Spare words below the stack (see stack.h): the cached engine spills
+  // its top register without checks, even while the stack is empty.
+  vm->stackMemory = createStack(vm->stackSize, vm->hugePages);
+  vm->stack = vm->stackMemory->words;
+  vm->loadError = LOAD_OK;
+  vm->verifyError = VE_OK;
+  vm->verifyErrorPc = 0;
+  vm->fusedCount = 0;
+  vm->eliminatedCount = 0;
+  vm->codeLevels = NULL;
+  vm->display = NULL;
+  vm->displaySize = 0;
+  vm->frameSizes = NULL;
+  vm->threadedCode = NULL;
+  vm->cachedCode = NULL;
+  vm->packedCode = NULL;
+  vm->registerCode = NULL;
+  vm->nativeCode = NULL;
+  vm->nativeSize = 0;
+  vm->nativeTable = NULL;
+  vm->inputStream = stdin;
+  vm->outputStream = stdout;
+  vm->flushBeforeRead = 0;
+  vm->curses = 0;
+  vm->profile = NULL;
+  vm->registerDispatches = 0;
+  vm->trace = NULL;
+  vm->snapshotFile = NULL;
+  vm->overflowArmed = 0;
+  if (!vm->debugMode)
+    pthread_once(&stdioOnce, bufferStdio);
+  resetVM(vm);
+}
+
+// Frees the program and what was made of it, leaving shared parts alone
+static void freeProgram(VM* vm) {
+  free(vm->threadedCode);
+  vm->threadedCode = NULL;
+  free(vm->cachedCode);
+  vm->cachedCode = NULL;
+  free(vm->display);
+  vm->display = NULL;
+  freeNative(vm);
+  if (vm->codeOwner == NULL) {
+    freeCodeBlock(vm->codeBlock);
+    free(vm->codeLevels);
+    free(vm->frameSizes);
+    freePackedCode(vm->packedCode);
+    freeRegisterCode(vm->registerCode);
+  } else if (vm->packedCode != vm->codeOwner->packedCode)
+    freePackedCode(vm->packedCode);
+  vm->codeBlock = NULL;
+  vm->codeOwner = NULL;
+  vm->codeLevels = NULL;
+  vm->frameSizes = NULL;
+  vm->packedCode = NULL;
+  vm->registerCode = NULL;
+}
+
+void cleanVM(VM* vm) {
+  freeProgram(vm);
+  freeStack(vm->stackMemory);
+  vm->stackMemory = NULL;
+  vm->stack = NULL;
 }
 
-void initVM(void) {
-  codeBlock = createCodeBlock(codeSize);
-  stack = (Memory) malloc(stackSize * sizeof(WORD));
-  resetVM();
+/*
+ * Makes vm run the program loaded into from, without loading or verifying
+ * it again. The code and its tables are shared read-only, so from must be
+ * cleaned last; the display and the translations of the engines are vm's.
+ */
+void shareExecutable(VM* vm, VM* from) {
+  freeProgram(vm);
+  vm->codeOwner = from;
+  vm->codeBlock = from->codeBlock;
+  vm->codeLevels = from->codeLevels;
+  vm->frameSizes = from->frameSizes;
+  vm->packedCode = from->packedCode;
+  vm->registerCode = from->registerCode;
+  vm->displaySize = from->displaySize;
+  if (from->display != NULL)
+    vm->display = (WORD*) malloc(vm->displaySize * sizeof(WORD));
+  resetVM(vm);
+}
+
+/*
+ * Runs the verifier over the loaded code and keeps its level and frame
+ * tables. Returns 0 and frees them if the code is rejected. For the
+ * register engine the code is translated with the depths it found.
+ */
+int verifyExecutable(VM* vm) {
+  int n = vm->codeBlock->codeSize;
+  int* depths = NULL;
+  int maxLevel = 0;
+  int i;
+
+  free(vm->codeLevels);
+  free(vm->display);
+  free(vm->frameSizes);
+  vm->codeLevels = (int*) malloc((n + 1) * sizeof(int));
+  vm->frameSizes = (int*) malloc((n + 1) * sizeof(int));
+  vm->display = NULL;
+  if (vm->engine == ENGINE_REGISTER)
+    depths = (int*) malloc((n + 1) * sizeof(int));
+
+  vm->verifyError = verifyCode(vm->codeBlock, vm->codeLevels, vm->frameSizes, depths, &vm->verifyErrorPc);
+  if ((vm->verifyError == VE_OK) && (depths != NULL))
+    vm->registerCode = translateRegisterCode(vm->codeBlock, depths);
+  free(depths);
+  if (vm->verifyError != VE_OK) {
+    free(vm->codeLevels);
+    free(vm->frameSizes);
+    vm->codeLevels = NULL;
+    vm->frameSizes = NULL;
+    return 0;
+  }
+
+  for (i = 0; i < n; i ++)
+    if (vm->codeLevels[i] > maxLevel)
+      maxLevel = vm->codeLevels[i];
+  vm->displaySize = maxLevel + 1;
+  vm->display = (WORD*) malloc(vm->displaySize * sizeof(WORD));
+  return 1;
 }
 
-void cleanVM(void) {
-  freeCodeBlock(codeBlock);
-  free(stack);
+// Replaces common instruction sequences by superinstructions
+void fuseExecutable(VM* vm) {
+  int n = vm->codeBlock->codeSize;
+  int* newAddress = (int*) malloc((n + 1) * sizeof(int));
+  int i;
+
+  // Fusion rewrites the code, which cannot happen in a shared mapping
+  unmapCode(vm->codeBlock);
+  vm->eliminatedCount = fuseCode(vm->codeBlock, newAddress, &vm->fusedCount);
+  // Addresses only move down, so the levels can be moved in place
+  for (i = 0; i < n; i ++)
+    vm->codeLevels[newAddress[i]] = vm->codeLevels[i];
+  // Procedure entries are never fused away, but the words after the first
+  // one of a superinstruction must not overwrite their size
+  for (i = 0; i < n; i ++)
+    if (vm->frameSizes[i] >= 0) {
+      int size = vm->frameSizes[i];
+      vm->frameSizes[i] = -1;
+      vm->frameSizes[newAddress[i]] = size;
+    }
+  free(newAddress);
 }
 
-int loadExecutable(FILE* f) {
-  loadCode(codeBlock,f);
-  resetVM();
+int loadExecutable(VM* vm, FILE* f) {
+  vm->verifyError = VE_OK;
+  if (vm->codeOwner != NULL) {
+    freeProgram(vm);
+    vm->codeBlock = createCodeBlock(vm->codeSize);
+  }
+  vm->loadError = loadCode(vm->codeBlock,f);
+  if (vm->loadError != LOAD_OK)
+    return 0;
+  free(vm->threadedCode);
+  vm->threadedCode = NULL;
+  free(vm->cachedCode);
+  vm->cachedCode = NULL;
+  freeNative(vm);
+  freePackedCode(vm->packedCode);
+  vm->packedCode = NULL;
+  freeRegisterCode(vm->registerCode);
+  vm->registerCode = NULL;
+  vm->fusedCount = 0;
+  vm->eliminatedCount = 0;
+  if (!verifyExecutable(vm))
+    return 0;
+  // The register code keeps the pcs of the stack code, which must not move.
+  // Code saved fused is run as it is, from its mapping.
+  if (vm->fuseMode && (vm->registerCode == NULL) && !vm->codeBlock->fused)
+    fuseExecutable(vm);
+  shrinkCodeBlock(vm->codeBlock);
+  if (vm->engine == ENGINE_PACKED)
+    vm->packedCode = packCode(vm->codeBlock);
+  resetVM(vm);
   return 1;
 }
 
-int saveExecutable(FILE* f) {
-  saveCode(codeBlock,f);
+int saveExecutable(VM* vm, FILE* f) {
+  saveCode(vm->codeBlock,f);
   return 1;
 }
 
-int checkStack(void) {
-  return ((t >= 0) && (t <stackSize));
+int checkStack(VM* vm) {
+  if ((vm->t >= 0) && (vm->t <vm->stackSize))
+    return 1;
+  vm->ps = PS_STACK_OVERFLOW;
+  return 0;
 }
 
-int base(int p) {
-  int currentBase = b;
+// Frame-entry check of CALL: the whole frame of the callee must fit
+static inline int checkFrame(VM* vm, int top, int entry) {
+  // Rearranged so that no sum can overflow: top >= -1
+  return vm->frameSizes[entry] <= vm->stackSize - top - 1;
+}
+
+int base(VM* vm, int p) {
+  int currentBase = vm->b;
+
+  if (p == 0)
+    return currentBase;
+  if ((vm->display != NULL) && (p <= vm->currentLevel))
+    return vm->display[vm->currentLevel - p];
   while (p > 0) {
-    currentBase = stack[currentBase + 3];
+    currentBase = vm->stack[currentBase + 3];
     p --;
   }
   return currentBase;
 }
 
-void printMemory(void) {
+// Called by CALL once b is the new frame: the callee is at level - p + 1
+static inline void enterDisplay(VM* vm, int p) {
+  if (vm->display != NULL) {
+    vm->currentLevel += 1 - p;
+    vm->display[vm->currentLevel] = vm->b;
+  }
+}
+
+// Called by EP/EF once pc and b are restored, with the p of the matching
+// CALL. Below its own level the callee leaves the display as it found it;
+// the p entries from there up to the level of the caller are refilled:
+// none after a call to a nested procedure, the frame of the caller after
+// a call at the same level, its static chain after any other.
+static inline void leaveDisplay(VM* vm, int p) {
+  if (vm->display != NULL) {
+    if (p == 0)
+      vm->currentLevel --;
+    else if (p == 1)
+      vm->display[vm->currentLevel] = vm->b;
+    else {
+      int calleeLevel = vm->currentLevel;
+      int frame = vm->b;
+      int l;
+
+      vm->currentLevel += p - 1;
+      for (l = vm->currentLevel; l >= calleeLevel; l --) {
+	vm->display[l] = frame;
+	frame = vm->stack[frame + 3];
+      }
+    }
+  }
+}
+
+// The whole display of the frame at b, running the code at pc: for native
+// code returning to a caller whose level it cannot tell, and for snapshots
+void restoreDisplay(VM* vm, int pc) {
+  if (vm->display != NULL) {
+    int frame = vm->b;
+    int l;
+
+    vm->currentLevel = vm->codeLevels[pc];
+    for (l = vm->currentLevel; l >= 0; l --) {
+      vm->display[l] = frame;
+      frame = vm->stack[frame + 3];
+    }
+  }
+}
+
+// Condition of a VV or VC compare-and-jump superinstruction
+static int compareOperands(VM* vm, Instruction* inst) {
+  WORD left = vm->stack[base(vm, inst->p) + inst->q];
+  WORD right;
+  int cmp;
+
+  if (inst->op >= OP_VCEQ) {
+    right = inst[1].q;
+    cmp = inst->op - OP_VCEQ + OP_EQ;
+  } else {
+    right = vm->stack[base(vm, inst[1].p) + inst[1].q];
+    cmp = inst->op - OP_VVEQ + OP_EQ;
+  }
+
+  switch (cmp) {
+  case OP_EQ: return left == right;
+  case OP_NE: return left != right;
+  case OP_GT: return left > right;
+  case OP_LT: return left < right;
+  case OP_GE: return left >= right;
+  default: return left <= right;
+  }
+}
+
+/*
+ * DOUBLE values on the stack, for every engine. They are copied rather than
+ * cast: only the main program's DOUBLE locals are sure to be 8-byte aligned
+ * (see stack.h), and the copy is still a single 8-byte move.
+ */
+static inline double loadDouble(Memory s, int a) {
+  double d;
+
+  memcpy(&d, &s[a], sizeof(d));
+  return d;
+}
+
+static inline void storeDouble(Memory s, int a, double d) {
+  memcpy(&s[a], &d, sizeof(d));
+}
+
+// CVFI truncates, and gives what x86 does where C leaves it undefined
+static inline WORD truncateDouble(double d) {
+  if ((d > -2147483649.0) && (d < 2147483648.0))
+    return (WORD) d;
+  return INT_MIN;
+}
+
+// CVIF q on a stack whose top is t, before t moves
+static inline void widenInt(Memory s, int t, int q) {
+  WORD value = s[t - q];
+
+  memmove(&s[t - q + 2], &s[t - q + 1], q * sizeof(WORD));
+  storeDouble(s, t - q, value);
+}
+
+// EFF q on the frame at b: the result over the result slot and the DL
+static inline void moveFloatResult(Memory s, int b, int q) {
+  storeDouble(s, b, loadDouble(s, b + q));
+}
+
+#define FLOAT_ARITH(s, t, op)						\
+  do {									\
+    (t) -= 2;								\
+    storeDouble(s, (t) - 1, loadDouble(s, (t) - 1) op loadDouble(s, (t) + 1)); \
+  } while (0)
+#define FLOAT_COMPARE(s, t, cmp)					\
+  do {									\
+    (t) -= 3;								\
+    (s)[t] = (loadDouble(s, t) cmp loadDouble(s, (t) + 2)) ? TRUE : FALSE; \
+  } while (0)
+
+void printMemory(VM* vm) {
   int i;
   printf("Start dumping...\n");
-  for (i = 0; i <= t; i++) 
-    printf("  %4d: %d\n",i,stack[i]);
+  for (i = 0; i <= vm->t; i++) 
+    printf("  %4d: %d\n",i,vm->stack[i]);
   printf("Finish dumping!\n");
 }
 
-void printCodeBuffer(void) {
-  printCodeBlock(codeBlock);
+void printCodeBuffer(VM* vm) {
+  if (vm->packedCode != NULL)
+    printPackedCode(vm->packedCode);
+  else if (vm->registerCode != NULL)
+    printRegisterCode(vm->registerCode);
+  else printCodeBlock(vm->codeBlock);
 }
 
-int run(void) {
-  Instruction* code = codeBlock->code;
+/************************* Program I/O ****************************/
+
+int readCharIO(VM* vm, WORD* value) {
+  int c;
+
+  if (vm->curses) {
+    char ch;
+    echo();
+    wscanw(win,"%c",&ch);
+    noecho();
+    *value = ch;
+    return 1;
+  }
+
+  if (vm->flushBeforeRead) fflush(vm->outputStream);
+  c = getc_unlocked(vm->inputStream);
+  if (c == EOF) return 0;
+  *value = c;
+  return 1;
+}
+
+int readIntIO(VM* vm, WORD* value) {
+  int c;
+  int negative = 0;
+  unsigned int number = 0;
+
+  if (vm->curses) {
+    int number;
+    echo();
+    wscanw(win,"%d",&number);
+    noecho();
+    *value = number;
+    return 1;
+  }
+
+  // Same input syntax as scanf("%d"): blanks, an optional sign, digits
+  if (vm->flushBeforeRead) fflush(vm->outputStream);
+  do c = getc_unlocked(vm->inputStream);
+  while ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') || (c == '\v') || (c == '\f'));
+  if ((c == '-') || (c == '+')) {
+    negative = (c == '-');
+    c = getc_unlocked(vm->inputStream);
+  }
+  if ((c < '0') || (c > '9')) return 0;
+  while ((c >= '0') && (c <= '9')) {
+    number = number * 10 + (c - '0');
+    c = getc_unlocked(vm->inputStream);
+  }
+  if (c != EOF) ungetc(c, vm->inputStream);
+  *value = negative ? - number : number;
+  return 1;
+}
+
+void writeCharIO(VM* vm, WORD value) {
+  if (vm->curses) wprintw(win,"%c",value);
+  else putc_unlocked(value, vm->outputStream);
+}
+
+void writeIntIO(VM* vm, WORD value) {
+  char digits[12];
+  int n = sizeof(digits);
+  unsigned int number = (value < 0) ? - (unsigned int) value : value;
+
+  if (vm->curses) {
+    wprintw(win,"%d",value);
+    return;
+  }
+
+  do {
+    digits[--n] = '0' + number % 10;
+    number /= 10;
+  } while (number > 0);
+  if (value < 0) digits[--n] = '-';
+  fwrite(digits + n, 1, sizeof(digits) - n, vm->outputStream);
+}
+
+void writeLnIO(VM* vm) {
+  if (vm->curses) wprintw(win,"\n");
+  else putc_unlocked('\n', vm->outputStream);
+}
+
+// Same input syntax as scanf("%lf"); the double goes to at[0], at[1]
+int readDoubleIO(VM* vm, WORD* at) {
+  double value;
+
+  if (vm->curses) {
+    echo();
+    wscanw(win,"%lf",&value);
+    noecho();
+  } else {
+    if (vm->flushBeforeRead) fflush(vm->outputStream);
+    if (fscanf(vm->inputStream, "%lf", &value) != 1) return 0;
+  }
+  memcpy(at, &value, sizeof(value));
+  return 1;
+}
+
+void writeDoubleIO(VM* vm, WORD* at) {
+  double value;
+
+  memcpy(&value, at, sizeof(value));
+  if (vm->curses) wprintw(win,"%g",value);
+  else fprintf(vm->outputStream, "%g", value);
+}
+
+// MVB and FLB: 0 when the block does not lie inside the stack
+static inline int blockInStack(VM* vm, WORD a, WORD q) {
+  return (a >= 0) && (q >= 0) && (a <= vm->stackSize - q);
+}
+
+int moveBlock(VM* vm, WORD to, WORD from, WORD q) {
+  if (!blockInStack(vm, to, q) || !blockInStack(vm, from, q)) return 0;
+  memmove(&vm->stack[to], &vm->stack[from], q * sizeof(WORD));
+  return 1;
+}
+
+// Zero, the common case, is a memset; any other value a loop the compiler
+// vectorizes
+int fillBlock(VM* vm, WORD to, WORD value, WORD q) {
+  Memory s = vm->stack + to;
+  int i;
+
+  if (!blockInStack(vm, to, q)) return 0;
+  if (value == 0)
+    memset(s, 0, q * sizeof(WORD));
+  else for (i = 0; i < q; i ++)
+    s[i] = value;
+  return 1;
+}
+
+/*
+ * PW and PWF, by squaring: log n multiplications where a loop in the
+ * program takes n. The int ones wrap as ML does, so the result is that of
+ * multiplying n times. PW returns 0 for 0 to a negative power.
+ */
+int powerInt(WORD* at, WORD n) {
+  unsigned x = *at;
+  unsigned result = 1;
+
+  if (n < 0) {
+    if (x == 0) return 0;
+    if (x == (unsigned) -1) result = (n & 1) ? x : 1;
+    else if (x != 1) result = 0;
+  } else for (; n > 0; n >>= 1) {
+    if (n & 1) result *= x;
+    x *= x;
+  }
+  *at = (WORD) result;
+  return 1;
+}
+
+void powerDouble(WORD* at, WORD n) {
+  double x = loadDouble(at, 0);
+  double result = 1;
+  unsigned m = (n < 0) ? 0u - (unsigned) n : (unsigned) n;
+
+  for (; m > 0; m >>= 1) {
+    if (m & 1) result *= x;
+    x *= x;
+  }
+  storeDouble(at, 0, (n < 0) ? 1 / result : result);
+}
+
+/*
+ * Direct-threaded engine. The code block is translated once into the
+ * addresses of the handlers below, so every instruction ends with its own
+ * indirect jump instead of sharing the one of the switch in run().
+ * Each handler has the semantics of its case in run(), except that the
+ * code is known to be verified: the stack is only checked by CALL, against
+ * the frame size of the callee, never by the instructions themselves.
+ * The engine returns on halt, on a runtime error and on every instruction
+ * it leaves to run() (break points, unknown opcodes); run() then
+ * executes that single instruction and enters the engine again.
+ */
+static void runThreaded(VM* vm) {
+  static const void* handlers[NUM_OF_OPCODES] = {
+    [OP_LA] = &&op_LA,   [OP_LV] = &&op_LV,   [OP_LC] = &&op_LC,
+    [OP_LI] = &&op_LI,   [OP_INT] = &&op_INT, [OP_DCT] = &&op_DCT,
+    [OP_J] = &&op_J,     [OP_FJ] = &&op_FJ,   [OP_HL] = &&op_HL,
+    [OP_ST] = &&op_ST,   [OP_CALL] = &&op_CALL,
+    [OP_EP] = &&op_EP,   [OP_EF] = &&op_EF,
+    [OP_RC] = &&op_RC,   [OP_RI] = &&op_RI,
+    [OP_WRC] = &&op_WRC, [OP_WRI] = &&op_WRI, [OP_WLN] = &&op_WLN,
+    [OP_AD] = &&op_AD,   [OP_SB] = &&op_SB,   [OP_ML] = &&op_ML,
+    [OP_DV] = &&op_DV,   [OP_NEG] = &&op_NEG, [OP_CV] = &&op_CV,
+    [OP_EQ] = &&op_EQ,   [OP_NE] = &&op_NE,   [OP_GT] = &&op_GT,
+    [OP_LT] = &&op_LT,   [OP_GE] = &&op_GE,   [OP_LE] = &&op_LE,
+    [OP_ADC] = &&op_ADC, [OP_LVAC] = &&op_LVAC,
+    [OP_MOV] = &&op_MOV, [OP_MOVC] = &&op_MOVC,
+    [OP_VVEQ] = &&op_VVEQ, [OP_VVNE] = &&op_VVNE, [OP_VVGT] = &&op_VVGT,
+    [OP_VVLT] = &&op_VVLT, [OP_VVGE] = &&op_VVGE, [OP_VVLE] = &&op_VVLE,
+    [OP_VCEQ] = &&op_VCEQ, [OP_VCNE] = &&op_VCNE, [OP_VCGT] = &&op_VCGT,
+    [OP_VCLT] = &&op_VCLT, [OP_VCGE] = &&op_VCGE, [OP_VCLE] = &&op_VCLE,
+    [OP_LCF] = &&op_LCF, [OP_LVF] = &&op_LVF, [OP_LIF] = &&op_LIF,
+    [OP_STF] = &&op_STF, [OP_ADF] = &&op_ADF, [OP_SBF] = &&op_SBF,
+    [OP_MLF] = &&op_MLF, [OP_DVF] = &&op_DVF, [OP_NEGF] = &&op_NEGF,
+    [OP_EQF] = &&op_EQF, [OP_NEF] = &&op_NEF, [OP_GTF] = &&op_GTF,
+    [OP_LTF] = &&op_LTF, [OP_GEF] = &&op_GEF, [OP_LEF] = &&op_LEF,
+    [OP_CVIF] = &&op_CVIF, [OP_CVFI] = &&op_CVFI,
+    [OP_RF] = &&op_RF,   [OP_WRF] = &&op_WRF, [OP_EFF] = &&op_EFF,
+    [OP_MVB] = &&op_MVB, [OP_FLB] = &&op_FLB,
+    [OP_PW] = &&op_PW,   [OP_PWF] = &&op_PWF,
+  };
+  Instruction* code = vm->codeBlock->code;
+  Memory stack = vm->stack;
+  const void** threaded;
+  int ip = vm->pc;
+  WORD value;
+
+  if (vm->threadedCode == NULL) {
+    int i;
+    vm->threadedCode = (const void**) malloc((vm->codeBlock->codeSize + 1) * sizeof(void*));
+    for (i = 0; i < vm->codeBlock->codeSize; i++) {
+      if ((code[i].op >= 0) && (code[i].op < NUM_OF_OPCODES) && (handlers[code[i].op] != NULL))
+	vm->threadedCode[i] = handlers[code[i].op];
+      else vm->threadedCode[i] = &&op_leave;
+    }
+    // Running off the end of the code is left to run() as well
+    vm->threadedCode[vm->codeBlock->codeSize] = &&op_leave;
+  }
+  threaded = vm->threadedCode;
+
+#define DISPATCH() goto *threaded[ip]
+#define NEXT() do { ip ++; DISPATCH(); } while (0)
+  // Falls through to the third word of the superinstruction or jumps
+#define COMPARE_JUMP(cmp, right)					\
+  do {									\
+    if (stack[base(vm, code[ip].p) + code[ip].q] cmp (right)) ip += 3;	\
+    else ip = code[ip+2].q;						\
+    DISPATCH();								\
+  } while (0)
+
+  DISPATCH();
+
+ op_LA:
+  vm->t ++;
+  stack[vm->t] = base(vm, code[ip].p) + code[ip].q;
+  NEXT();
+ op_LV:
+  vm->t ++;
+  stack[vm->t] = stack[base(vm, code[ip].p) + code[ip].q];
+  NEXT();
+ op_LC:
+  vm->t ++;
+  stack[vm->t] = code[ip].q;
+  NEXT();
+ op_LI:
+  stack[vm->t] = stack[stack[vm->t]];
+  NEXT();
+ op_INT:
+  vm->t += code[ip].q;
+  NEXT();
+ op_DCT:
+  vm->t -= code[ip].q;
+  NEXT();
+ op_J:
+  ip = code[ip].q;
+  DISPATCH();
+ op_FJ:
+  if (stack[vm->t] == FALSE) {
+    ip = code[ip].q;
+    vm->t --;
+    DISPATCH();
+  }
+  vm->t --;
+  NEXT();
+ op_HL:
+  vm->ps = PS_NORMAL_EXIT;
+  vm->pc = ip + 1;
+  return;
+ op_ST:
+  stack[stack[vm->t-1]] = stack[vm->t];
+  vm->t -= 2;
+  NEXT();
+ op_CALL:
+  if (!checkFrame(vm, vm->t, code[ip].q)) {
+    vm->ps = PS_STACK_OVERFLOW;
+    vm->pc = ip + 1;
+    return;
+  }
+  stack[vm->t+2] = vm->b;                 // Dynamic Link
+  stack[vm->t+3] = ip;                // Return Address
+  stack[vm->t+4] = base(vm, code[ip].p);  // Static Link
+  vm->b = vm->t + 1;                      // Base & Result
+  enterDisplay(vm, code[ip].p);
+  ip = code[ip].q;
+  DISPATCH();
+ op_EP:
+  vm->t = vm->b - 1;                      // Previous top
+  ip = stack[vm->b+2];                // Saved return address
+  vm->b = stack[vm->b+1];                 // Saved base
+  leaveDisplay(vm, code[ip].p);
+  NEXT();
+ op_EF:
+  vm->t = vm->b;                          // return value is on the top of the stack
+  ip = stack[vm->b+2];                // Saved return address
+  vm->b = stack[vm->b+1];                 // saved base
+  leaveDisplay(vm, code[ip].p);
+  NEXT();
+ op_RC:
+  vm->t ++;
+  if (!readCharIO(vm, &stack[vm->t])) {
+    vm->ps = PS_IO_ERROR;
+    vm->pc = ip + 1;
+    return;
+  }
+  NEXT();
+ op_RI:
+  vm->t ++;
+  if (!readIntIO(vm, &stack[vm->t])) {
+    vm->ps = PS_IO_ERROR;
+    vm->pc = ip + 1;
+    return;
+  }
+  NEXT();
+ op_WRC:
+  writeCharIO(vm, stack[vm->t]);
+  vm->t --;
+  NEXT();
+ op_WRI:
+  writeIntIO(vm, stack[vm->t]);
+  vm->t --;
+  NEXT();
+ op_WLN:
+  writeLnIO(vm);
+  NEXT();
+ op_AD:
+  vm->t --;
+  stack[vm->t] += stack[vm->t+1];
+  NEXT();
+ op_SB:
+  vm->t --;
+  stack[vm->t] -= stack[vm->t+1];
+  NEXT();
+ op_ML:
+  vm->t --;
+  stack[vm->t] *= stack[vm->t+1];
+  NEXT();
+ op_DV:
+  vm->t --;
+  if (stack[vm->t+1] == 0) {
+    vm->ps = PS_DIVIDE_BY_ZERO;
+    vm->pc = ip + 1;
+    return;
+  }
+  stack[vm->t] /= stack[vm->t+1];
+  NEXT();
+ op_NEG:
+  stack[vm->t] = - stack[vm->t];
+  NEXT();
+ op_CV:
+  stack[vm->t+1] = stack[vm->t];
+  vm->t ++;
+  NEXT();
+ op_EQ:
+  vm->t --;
+  stack[vm->t] = (stack[vm->t] == stack[vm->t+1]) ? TRUE : FALSE;
+  NEXT();
+ op_NE:
+  vm->t --;
+  stack[vm->t] = (stack[vm->t] != stack[vm->t+1]) ? TRUE : FALSE;
+  NEXT();
+ op_GT:
+  vm->t --;
+  stack[vm->t] = (stack[vm->t] > stack[vm->t+1]) ? TRUE : FALSE;
+  NEXT();
+ op_LT:
+  vm->t --;
+  stack[vm->t] = (stack[vm->t] < stack[vm->t+1]) ? TRUE : FALSE;
+  NEXT();
+ op_GE:
+  vm->t --;
+  stack[vm->t] = (stack[vm->t] >= stack[vm->t+1]) ? TRUE : FALSE;
+  NEXT();
+ op_LE:
+  vm->t --;
+  stack[vm->t] = (stack[vm->t] <= stack[vm->t+1]) ? TRUE : FALSE;
+  NEXT();
+ op_ADC:
+  stack[vm->t] += code[ip].q;
+  NEXT();
+ op_LVAC:
+  vm->t ++;
+  stack[vm->t] = stack[base(vm, code[ip].p) + code[ip].q] + code[ip+1].q;
+  ip += 2;
+  DISPATCH();
+ op_MOV:
+  stack[base(vm, code[ip].p) + code[ip].q] = stack[base(vm, code[ip+1].p) + code[ip+1].q];
+  ip += 2;
+  DISPATCH();
+ op_MOVC:
+  stack[base(vm, code[ip].p) + code[ip].q] = code[ip+1].q;
+  ip += 2;
+  DISPATCH();
+ op_VVEQ: COMPARE_JUMP(==, stack[base(vm, code[ip+1].p) + code[ip+1].q]);
+ op_VVNE: COMPARE_JUMP(!=, stack[base(vm, code[ip+1].p) + code[ip+1].q]);
+ op_VVGT: COMPARE_JUMP(>, stack[base(vm, code[ip+1].p) + code[ip+1].q]);
+ op_VVLT: COMPARE_JUMP(<, stack[base(vm, code[ip+1].p) + code[ip+1].q]);
+ op_VVGE: COMPARE_JUMP(>=, stack[base(vm, code[ip+1].p) + code[ip+1].q]);
+ op_VVLE: COMPARE_JUMP(<=, stack[base(vm, code[ip+1].p) + code[ip+1].q]);
+ op_VCEQ: COMPARE_JUMP(==, code[ip+1].q);
+ op_VCNE: COMPARE_JUMP(!=, code[ip+1].q);
+ op_VCGT: COMPARE_JUMP(>, code[ip+1].q);
+ op_VCLT: COMPARE_JUMP(<, code[ip+1].q);
+ op_VCGE: COMPARE_JUMP(>=, code[ip+1].q);
+ op_VCLE: COMPARE_JUMP(<=, code[ip+1].q);
+ op_LCF:
+  vm->t += 2;
+  stack[vm->t-1] = code[ip].p;
+  stack[vm->t] = code[ip].q;
+  NEXT();
+ op_LVF:
+  vm->t += 2;
+  storeDouble(stack, vm->t-1, loadDouble(stack, base(vm, code[ip].p) + code[ip].q));
+  NEXT();
+ op_LIF:
+  vm->t ++;
+  storeDouble(stack, vm->t-1, loadDouble(stack, stack[vm->t-1]));
+  NEXT();
+ op_STF:
+  storeDouble(stack, stack[vm->t-2], loadDouble(stack, vm->t-1));
+  vm->t -= 3;
+  NEXT();
+ op_ADF: FLOAT_ARITH(stack, vm->t, +); NEXT();
+ op_SBF: FLOAT_ARITH(stack, vm->t, -); NEXT();
+ op_MLF: FLOAT_ARITH(stack, vm->t, *); NEXT();
+ op_DVF: FLOAT_ARITH(stack, vm->t, /); NEXT();
+ op_NEGF:
+  storeDouble(stack, vm->t-1, - loadDouble(stack, vm->t-1));
+  NEXT();
+ op_EQF: FLOAT_COMPARE(stack, vm->t, ==); NEXT();
+ op_NEF: FLOAT_COMPARE(stack, vm->t, !=); NEXT();
+ op_GTF: FLOAT_COMPARE(stack, vm->t, >); NEXT();
+ op_LTF: FLOAT_COMPARE(stack, vm->t, <); NEXT();
+ op_GEF: FLOAT_COMPARE(stack, vm->t, >=); NEXT();
+ op_LEF: FLOAT_COMPARE(stack, vm->t, <=); NEXT();
+ op_CVIF:
+  widenInt(stack, vm->t, code[ip].q);
+  vm->t ++;
+  NEXT();
+ op_CVFI:
+  vm->t --;
+  stack[vm->t] = truncateDouble(loadDouble(stack, vm->t));
+  NEXT();
+ op_RF:
+  vm->t += 2;
+  if (!readDoubleIO(vm, &stack[vm->t-1])) {
+    vm->ps = PS_IO_ERROR;
+    vm->pc = ip + 1;
+    return;
+  }
+  NEXT();
+ op_WRF:
+  writeDoubleIO(vm, &stack[vm->t-1]);
+  vm->t -= 2;
+  NEXT();
+ op_EFF:
+  value = stack[vm->b+1];             // saved base, before the result covers it
+  moveFloatResult(stack, vm->b, code[ip].q);
+  vm->t = vm->b + 1;                      // the two words of the result on top
+  ip = stack[vm->b+2];                // Saved return address
+  vm->b = value;
+  leaveDisplay(vm, code[ip].p);
+  NEXT();
+ op_MVB:
+  vm->t -= 2;
+  if (!moveBlock(vm, stack[vm->t+1], stack[vm->t+2], code[ip].q)) {
+    vm->ps = PS_STACK_OVERFLOW;
+    vm->pc = ip + 1;
+    return;
+  }
+  NEXT();
+ op_FLB:
+  vm->t -= 2;
+  if (!fillBlock(vm, stack[vm->t+1], stack[vm->t+2], code[ip].q)) {
+    vm->ps = PS_STACK_OVERFLOW;
+    vm->pc = ip + 1;
+    return;
+  }
+  NEXT();
+ op_PW:
+  vm->t --;
+  if (!powerInt(&stack[vm->t], stack[vm->t+1])) {
+    vm->ps = PS_DIVIDE_BY_ZERO;
+    vm->pc = ip + 1;
+    return;
+  }
+  NEXT();
+ op_PWF:
+  vm->t --;
+  powerDouble(&stack[vm->t-1], stack[vm->t+1]);
+  NEXT();
+ op_leave:
+  vm->pc = ip;
+  return;
+
+#undef COMPARE_JUMP
+#undef NEXT
+#undef DISPATCH
+}
+
+/*
+ * Threaded engine that keeps the top of the stack in registers: sp is t and
+ * tos is s[t], whose copy in memory may be stale. A push spills tos before
+ * reading anything from memory, so the words below the top are always up
+ * to date. tos is spilled and t written back when calling, when leaving the
+ * engine (halt, errors, break points, unknown opcodes) and before the
+ * stores and loads of superinstructions that may hit the top slot itself.
+ * Spills and fills are not checked: as in the other engines, the code is
+ * verified and CALL checks the frame of the callee, which bounds them all.
+ */
+static void runCached(VM* vm) {
+  static const void* handlers[NUM_OF_OPCODES] = {
+    [OP_LA] = &&op_LA,   [OP_LV] = &&op_LV,   [OP_LC] = &&op_LC,
+    [OP_LI] = &&op_LI,   [OP_INT] = &&op_INT, [OP_DCT] = &&op_DCT,
+    [OP_J] = &&op_J,     [OP_FJ] = &&op_FJ,   [OP_HL] = &&op_HL,
+    [OP_ST] = &&op_ST,   [OP_CALL] = &&op_CALL,
+    [OP_EP] = &&op_EP,   [OP_EF] = &&op_EF,
+    [OP_RC] = &&op_RC,   [OP_RI] = &&op_RI,
+    [OP_WRC] = &&op_WRC, [OP_WRI] = &&op_WRI, [OP_WLN] = &&op_WLN,
+    [OP_AD] = &&op_AD,   [OP_SB] = &&op_SB,   [OP_ML] = &&op_ML,
+    [OP_DV] = &&op_DV,   [OP_NEG] = &&op_NEG, [OP_CV] = &&op_CV,
+    [OP_EQ] = &&op_EQ,   [OP_NE] = &&op_NE,   [OP_GT] = &&op_GT,
+    [OP_LT] = &&op_LT,   [OP_GE] = &&op_GE,   [OP_LE] = &&op_LE,
+    [OP_ADC] = &&op_ADC, [OP_LVAC] = &&op_LVAC,
+    [OP_MOV] = &&op_MOV, [OP_MOVC] = &&op_MOVC,
+    [OP_VVEQ] = &&op_VVEQ, [OP_VVNE] = &&op_VVNE, [OP_VVGT] = &&op_VVGT,
+    [OP_VVLT] = &&op_VVLT, [OP_VVGE] = &&op_VVGE, [OP_VVLE] = &&op_VVLE,
+    [OP_VCEQ] = &&op_VCEQ, [OP_VCNE] = &&op_VCNE, [OP_VCGT] = &&op_VCGT,
+    [OP_VCLT] = &&op_VCLT, [OP_VCGE] = &&op_VCGE, [OP_VCLE] = &&op_VCLE,
+    [OP_LCF] = &&op_LCF, [OP_LVF] = &&op_LVF, [OP_LIF] = &&op_LIF,
+    [OP_STF] = &&op_STF, [OP_ADF] = &&op_ADF, [OP_SBF] = &&op_SBF,
+    [OP_MLF] = &&op_MLF, [OP_DVF] = &&op_DVF, [OP_NEGF] = &&op_NEGF,
+    [OP_EQF] = &&op_EQF, [OP_NEF] = &&op_NEF, [OP_GTF] = &&op_GTF,
+    [OP_LTF] = &&op_LTF, [OP_GEF] = &&op_GEF, [OP_LEF] = &&op_LEF,
+    [OP_CVIF] = &&op_CVIF, [OP_CVFI] = &&op_CVFI,
+    [OP_RF] = &&op_RF,   [OP_WRF] = &&op_WRF, [OP_EFF] = &&op_EFF,
+    [OP_MVB] = &&op_MVB, [OP_FLB] = &&op_FLB,
+    [OP_PW] = &&op_PW,   [OP_PWF] = &&op_PWF,
+  };
+  Instruction* code = vm->codeBlock->code;
+  const void** threaded;
+  Memory s = vm->stack;
+  int ip = vm->pc;
+  int sp = vm->t;
+  int bp = vm->b;
+  WORD tos = 0;
+  WORD value;
+
+  if (vm->cachedCode == NULL) {
+    int i;
+    vm->cachedCode = (const void**) malloc((vm->codeBlock->codeSize + 1) * sizeof(void*));
+    for (i = 0; i < vm->codeBlock->codeSize; i++) {
+      if ((code[i].op >= 0) && (code[i].op < NUM_OF_OPCODES) && (handlers[code[i].op] != NULL))
+	vm->cachedCode[i] = handlers[code[i].op];
+      else vm->cachedCode[i] = &&op_leave;
+    }
+    vm->cachedCode[vm->codeBlock->codeSize] = &&op_leave;
+  }
+  threaded = vm->cachedCode;
+
+#define DISPATCH() goto *threaded[ip]
+#define NEXT() do { ip ++; DISPATCH(); } while (0)
+#define SPILL() s[sp] = tos
+#define FILL() tos = s[sp]
+#define PUSH(v) do { SPILL(); sp ++; tos = (v); } while (0)
+  // Memory access that sees the cached top slot
+#define LOAD(a) (((a) == sp) ? tos : s[a])
+#define ADDRESS(i) (((code[i].p == 0) ? bp : base(vm, code[i].p)) + code[i].q)
+#define COMPARE_JUMP(cmp, right)				\
+  do {								\
+    if (LOAD(ADDRESS(ip)) cmp (right)) ip += 3;			\
+    else ip = code[ip+2].q;					\
+    DISPATCH();							\
+  } while (0)
+#define EXIT(state, next)			\
+  do {						\
+    vm->ps = (state);				\
+    SPILL();					\
+    vm->t = sp;					\
+    vm->pc = (next);				\
+    return;					\
+  } while (0)
+
+  FILL();
+  DISPATCH();
+
+ op_LA:
+  PUSH(ADDRESS(ip));
+  NEXT();
+ op_LV:
+  SPILL();
+  value = s[ADDRESS(ip)];
+  sp ++;
+  tos = value;
+  NEXT();
+ op_LC:
+  PUSH(code[ip].q);
+  NEXT();
+ op_LI:
+  tos = LOAD(tos);
+  NEXT();
+ op_INT:
+  SPILL();
+  sp += code[ip].q;
+  FILL();
+  NEXT();
+ op_DCT:
+  SPILL();
+  sp -= code[ip].q;
+  FILL();
+  NEXT();
+ op_J:
+  ip = code[ip].q;
+  DISPATCH();
+ op_FJ:
+  value = tos;
+  sp --;
+  FILL();
+  if (value == FALSE) {
+    ip = code[ip].q;
+    DISPATCH();
+  }
+  NEXT();
+ op_HL:
+  EXIT(PS_NORMAL_EXIT, ip + 1);
+ op_ST:
+  s[s[sp-1]] = tos;
+  sp -= 2;
+  FILL();
+  NEXT();
+ op_CALL:
+  if (!checkFrame(vm, sp, code[ip].q))
+    EXIT(PS_STACK_OVERFLOW, ip + 1);
+  SPILL();
+  s[sp+2] = bp;                   // Dynamic Link
+  s[sp+3] = ip;                   // Return Address
+  s[sp+4] = base(vm, code[ip].p);     // Static Link
+  vm->b = bp = sp + 1;                // Base & Result
+  enterDisplay(vm, code[ip].p);
+  ip = code[ip].q;
+  DISPATCH();
+ op_EP:
+  sp = bp - 1;                    // Previous top
+  ip = s[bp+2];                   // Saved return address
+  vm->b = bp = s[bp+1];               // Saved base
+  leaveDisplay(vm, code[ip].p);
+  FILL();
+  NEXT();
+ op_EF:
+  sp = bp;                        // return value is on the top of the stack
+  ip = s[bp+2];                   // Saved return address
+  vm->b = bp = s[bp+1];               // saved base
+  leaveDisplay(vm, code[ip].p);
+  FILL();
+  NEXT();
+ op_RC:
+  SPILL();
+  sp ++;
+  if (!readCharIO(vm, &tos))
+    EXIT(PS_IO_ERROR, ip + 1);
+  NEXT();
+ op_RI:
+  SPILL();
+  sp ++;
+  if (!readIntIO(vm, &tos))
+    EXIT(PS_IO_ERROR, ip + 1);
+  NEXT();
+ op_WRC:
+  writeCharIO(vm, tos);
+  sp --;
+  FILL();
+  NEXT();
+ op_WRI:
+  writeIntIO(vm, tos);
+  sp --;
+  FILL();
+  NEXT();
+ op_WLN:
+  writeLnIO(vm);
+  NEXT();
+ op_AD:
+  sp --;
+  tos = s[sp] + tos;
+  NEXT();
+ op_SB:
+  sp --;
+  tos = s[sp] - tos;
+  NEXT();
+ op_ML:
+  sp --;
+  tos = s[sp] * tos;
+  NEXT();
+ op_DV:
+  value = tos;
+  sp --;
+  FILL();
+  if (value == 0)
+    EXIT(PS_DIVIDE_BY_ZERO, ip + 1);
+  tos /= value;
+  NEXT();
+ op_NEG:
+  tos = - tos;
+  NEXT();
+ op_CV:
+  SPILL();
+  sp ++;
+  NEXT();
+ op_EQ:
+  sp --;
+  tos = (s[sp] == tos) ? TRUE : FALSE;
+  NEXT();
+ op_NE:
+  sp --;
+  tos = (s[sp] != tos) ? TRUE : FALSE;
+  NEXT();
+ op_GT:
+  sp --;
+  tos = (s[sp] > tos) ? TRUE : FALSE;
+  NEXT();
+ op_LT:
+  sp --;
+  tos = (s[sp] < tos) ? TRUE : FALSE;
+  NEXT();
+ op_GE:
+  sp --;
+  tos = (s[sp] >= tos) ? TRUE : FALSE;
+  NEXT();
+ op_LE:
+  sp --;
+  tos = (s[sp] <= tos) ? TRUE : FALSE;
+  NEXT();
+ op_ADC:
+  tos += code[ip].q;
+  NEXT();
+ op_LVAC:
+  SPILL();
+  value = s[ADDRESS(ip)] + code[ip+1].q;
+  sp ++;
+  tos = value;
+  ip += 2;
+  DISPATCH();
+ op_MOV:
+  SPILL();
+  s[ADDRESS(ip)] = s[ADDRESS(ip+1)];
+  FILL();
+  ip += 2;
+  DISPATCH();
+ op_MOVC:
+  SPILL();
+  s[ADDRESS(ip)] = code[ip+1].q;
+  FILL();
+  ip += 2;
+  DISPATCH();
+ op_VVEQ: COMPARE_JUMP(==, LOAD(ADDRESS(ip+1)));
+ op_VVNE: COMPARE_JUMP(!=, LOAD(ADDRESS(ip+1)));
+ op_VVGT: COMPARE_JUMP(>, LOAD(ADDRESS(ip+1)));
+ op_VVLT: COMPARE_JUMP(<, LOAD(ADDRESS(ip+1)));
+ op_VVGE: COMPARE_JUMP(>=, LOAD(ADDRESS(ip+1)));
+ op_VVLE: COMPARE_JUMP(<=, LOAD(ADDRESS(ip+1)));
+ op_VCEQ: COMPARE_JUMP(==, code[ip+1].q);
+ op_VCNE: COMPARE_JUMP(!=, code[ip+1].q);
+ op_VCGT: COMPARE_JUMP(>, code[ip+1].q);
+ op_VCLT: COMPARE_JUMP(<, code[ip+1].q);
+ op_VCGE: COMPARE_JUMP(>=, code[ip+1].q);
+ op_VCLE: COMPARE_JUMP(<=, code[ip+1].q);
+ op_LCF:
+  SPILL();
+  sp += 2;
+  s[sp-1] = code[ip].p;
+  tos = code[ip].q;
+  NEXT();
+ op_LVF:
+  SPILL();
+  sp += 2;
+  storeDouble(s, sp-1, loadDouble(s, ADDRESS(ip)));
+  FILL();
+  NEXT();
+  // The others work on memory, with the top spilled
+ op_LIF:
+  SPILL();
+  sp ++;
+  storeDouble(s, sp-1, loadDouble(s, s[sp-1]));
+  FILL();
+  NEXT();
+ op_STF:
+  SPILL();
+  storeDouble(s, s[sp-2], loadDouble(s, sp-1));
+  sp -= 3;
+  FILL();
+  NEXT();
+ op_ADF: SPILL(); FLOAT_ARITH(s, sp, +); FILL(); NEXT();
+ op_SBF: SPILL(); FLOAT_ARITH(s, sp, -); FILL(); NEXT();
+ op_MLF: SPILL(); FLOAT_ARITH(s, sp, *); FILL(); NEXT();
+ op_DVF: SPILL(); FLOAT_ARITH(s, sp, /); FILL(); NEXT();
+ op_NEGF:
+  SPILL();
+  storeDouble(s, sp-1, - loadDouble(s, sp-1));
+  FILL();
+  NEXT();
+ op_EQF: SPILL(); FLOAT_COMPARE(s, sp, ==); FILL(); NEXT();
+ op_NEF: SPILL(); FLOAT_COMPARE(s, sp, !=); FILL(); NEXT();
+ op_GTF: SPILL(); FLOAT_COMPARE(s, sp, >); FILL(); NEXT();
+ op_LTF: SPILL(); FLOAT_COMPARE(s, sp, <); FILL(); NEXT();
+ op_GEF: SPILL(); FLOAT_COMPARE(s, sp, >=); FILL(); NEXT();
+ op_LEF: SPILL(); FLOAT_COMPARE(s, sp, <=); FILL(); NEXT();
+ op_CVIF:
+  SPILL();
+  widenInt(s, sp, code[ip].q);
+  sp ++;
+  FILL();
+  NEXT();
+ op_CVFI:
+  SPILL();
+  sp --;
+  tos = truncateDouble(loadDouble(s, sp));
+  NEXT();
+ op_RF:
+  SPILL();
+  sp += 2;
+  if (!readDoubleIO(vm, &s[sp-1]))
+    EXIT(PS_IO_ERROR, ip + 1);
+  FILL();
+  NEXT();
+ op_WRF:
+  SPILL();
+  writeDoubleIO(vm, &s[sp-1]);
+  sp -= 2;
+  FILL();
+  NEXT();
+ op_EFF:
+  SPILL();                        // the result may be in the top slot
+  value = s[bp+1];                // saved base, before the result covers it
+  moveFloatResult(s, bp, code[ip].q);
+  sp = bp + 1;                    // the two words of the result on top
+  ip = s[bp+2];                   // Saved return address
+  vm->b = bp = value;
+  leaveDisplay(vm, code[ip].p);
+  FILL();
+  NEXT();
+ op_MVB:
+  SPILL();
+  sp -= 2;
+  if (!moveBlock(vm, s[sp+1], s[sp+2], code[ip].q)) {
+    FILL();                       // EXIT spills the top again
+    EXIT(PS_STACK_OVERFLOW, ip + 1);
+  }
+  FILL();
+  NEXT();
+ op_FLB:
+  SPILL();
+  sp -= 2;
+  if (!fillBlock(vm, s[sp+1], s[sp+2], code[ip].q)) {
+    FILL();
+    EXIT(PS_STACK_OVERFLOW, ip + 1);
+  }
+  FILL();
+  NEXT();
+ op_PW:
+  value = tos;
+  sp --;
+  FILL();
+  if (!powerInt(&tos, value))
+    EXIT(PS_DIVIDE_BY_ZERO, ip + 1);
+  NEXT();
+ op_PWF:
+  value = tos;
+  sp --;
+  powerDouble(&s[sp-1], value);
+  FILL();
+  NEXT();
+ op_leave:
+  EXIT(vm->ps, ip);
+
+#undef EXIT
+#undef COMPARE_JUMP
+#undef ADDRESS
+#undef LOAD
+#undef PUSH
+#undef FILL
+#undef SPILL
+#undef NEXT
+#undef DISPATCH
+}
+
+/*
+ * Interpreter of the packed code (see packed.h), dispatching on the opcode
+ * byte through the same kind of handler table as runThreaded, and decoding
+ * the operands as it goes. The stack and frames are those of run(), with
+ * code addresses as return addresses. It is verified code as well, so the
+ * stack is only checked by CALL. It leaves to run() the same way, mapping
+ * its byte offset back to pc.
+ */
+static void runPacked(VM* vm) {
+  static const void* handlers[NUM_OF_OPCODES] = {
+    [OP_LA] = &&op_LA,   [OP_LV] = &&op_LV,   [OP_LC] = &&op_LC,
+    [OP_LI] = &&op_LI,   [OP_INT] = &&op_INT, [OP_DCT] = &&op_DCT,
+    [OP_J] = &&op_J,     [OP_FJ] = &&op_FJ,   [OP_HL] = &&op_HL,
+    [OP_ST] = &&op_ST,   [OP_CALL] = &&op_CALL,
+    [OP_EP] = &&op_EP,   [OP_EF] = &&op_EF,
+    [OP_RC] = &&op_RC,   [OP_RI] = &&op_RI,
+    [OP_WRC] = &&op_WRC, [OP_WRI] = &&op_WRI, [OP_WLN] = &&op_WLN,
+    [OP_AD] = &&op_AD,   [OP_SB] = &&op_SB,   [OP_ML] = &&op_ML,
+    [OP_DV] = &&op_DV,   [OP_NEG] = &&op_NEG, [OP_CV] = &&op_CV,
+    [OP_EQ] = &&op_EQ,   [OP_NE] = &&op_NE,   [OP_GT] = &&op_GT,
+    [OP_LT] = &&op_LT,   [OP_GE] = &&op_GE,   [OP_LE] = &&op_LE,
+    [OP_ADC] = &&op_ADC, [OP_LVAC] = &&op_LVAC,
+    [OP_MOV] = &&op_MOV, [OP_MOVC] = &&op_MOVC,
+    [OP_VVEQ] = &&op_VVEQ, [OP_VVNE] = &&op_VVNE, [OP_VVGT] = &&op_VVGT,
+    [OP_VVLT] = &&op_VVLT, [OP_VVGE] = &&op_VVGE, [OP_VVLE] = &&op_VVLE,
+    [OP_VCEQ] = &&op_VCEQ, [OP_VCNE] = &&op_VCNE, [OP_VCGT] = &&op_VCGT,
+    [OP_VCLT] = &&op_VCLT, [OP_VCGE] = &&op_VCGE, [OP_VCLE] = &&op_VCLE,
+    [OP_LCF] = &&op_LCF, [OP_LVF] = &&op_LVF, [OP_LIF] = &&op_LIF,
+    [OP_STF] = &&op_STF, [OP_ADF] = &&op_ADF, [OP_SBF] = &&op_SBF,
+    [OP_MLF] = &&op_MLF, [OP_DVF] = &&op_DVF, [OP_NEGF] = &&op_NEGF,
+    [OP_EQF] = &&op_EQF, [OP_NEF] = &&op_NEF, [OP_GTF] = &&op_GTF,
+    [OP_LTF] = &&op_LTF, [OP_GEF] = &&op_GEF, [OP_LEF] = &&op_LEF,
+    [OP_CVIF] = &&op_CVIF, [OP_CVFI] = &&op_CVFI,
+    [OP_RF] = &&op_RF,   [OP_WRF] = &&op_WRF, [OP_EFF] = &&op_EFF,
+    [OP_MVB] = &&op_MVB, [OP_FLB] = &&op_FLB,
+    [OP_PW] = &&op_PW,   [OP_PWF] = &&op_PWF,
+  };
+  // Every byte value, the ones without a handler leaving to run(). Filled
+  // on every entry: a static table would race between threads.
+  const void* dispatch[256];
+  const unsigned char* bytes;
+  const unsigned char* ip;
+  int* offsets;
+  WORD p, q, c;
+  Memory stack = vm->stack;
+  int i;
+
+  for (i = 0; i < 256; i ++) {
+    if ((i < NUM_OF_OPCODES) && (handlers[i] != NULL))
+      dispatch[i] = handlers[i];
+    else dispatch[i] = &&op_leave;
+  }
+  if (vm->packedCode == NULL)
+    vm->packedCode = packCode(vm->codeBlock);
+  bytes = vm->packedCode->bytes;
+  offsets = vm->packedCode->offsets;
+  ip = bytes + offsets[vm->pc];
+
+#define DISPATCH() goto *dispatch[*ip++]
+#define OPERAND() decodeOperand(&ip)
+#define TARGET() decodeTarget(&ip)
+#define EXIT(state)					\
+  do {							\
+    vm->ps = (state);					\
+    vm->pc = packedAddress(vm->packedCode, ip - bytes);		\
+    return;						\
+  } while (0)
+#define VARIABLE() (p = OPERAND(), stack[base(vm, p) + OPERAND()])
+  // Falls through to the next instruction or jumps
+#define COMPARE_JUMP(cmp, right)			\
+  do {							\
+    c = VARIABLE();					\
+    q = (right);					\
+    if (c cmp q) ip += 4;				\
+    else ip = bytes + TARGET();				\
+    DISPATCH();						\
+  } while (0)
+
+  DISPATCH();
+
+ op_LA:
+  p = OPERAND();
+  q = OPERAND();
+  vm->t ++;
+  stack[vm->t] = base(vm, p) + q;
+  DISPATCH();
+ op_LV:
+  c = VARIABLE();
+  vm->t ++;
+  stack[vm->t] = c;
+  DISPATCH();
+ op_LC:
+  vm->t ++;
+  stack[vm->t] = OPERAND();
+  DISPATCH();
+ op_LI:
+  stack[vm->t] = stack[stack[vm->t]];
+  DISPATCH();
+ op_INT:
+  vm->t += OPERAND();
+  DISPATCH();
+ op_DCT:
+  vm->t -= OPERAND();
+  DISPATCH();
+ op_J:
+  ip = bytes + TARGET();
+  DISPATCH();
+ op_FJ:
+  q = TARGET();
+  if (stack[vm->t] == FALSE)
+    ip = bytes + q;
+  vm->t --;
+  DISPATCH();
+ op_HL:
+  EXIT(PS_NORMAL_EXIT);
+ op_ST:
+  stack[stack[vm->t-1]] = stack[vm->t];
+  vm->t -= 2;
+  DISPATCH();
+ op_CALL:
+  p = OPERAND();
+  q = OPERAND();
+  c = TARGET();
+  if (!checkFrame(vm, vm->t, q))
+    EXIT(PS_STACK_OVERFLOW);
+  stack[vm->t+2] = vm->b;                 // Dynamic Link
+  stack[vm->t+3] = c;                 // Return Address
+  stack[vm->t+4] = base(vm, p);           // Static Link
+  vm->b = vm->t + 1;                      // Base & Result
+  enterDisplay(vm, p);
+  ip = bytes + offsets[q];
+  DISPATCH();
+ op_EP:
+  vm->t = vm->b - 1;                      // Previous top
+  c = stack[vm->b+2];                 // Saved return address
+  vm->b = stack[vm->b+1];                 // Saved base
+  ip = bytes + offsets[c] + 1;           // p of the CALL
+  leaveDisplay(vm, OPERAND());
+  ip = bytes + offsets[c + 1];
+  DISPATCH();
+ op_EF:
+  vm->t = vm->b;                          // return value is on the top of the stack
+  c = stack[vm->b+2];                 // Saved return address
+  vm->b = stack[vm->b+1];                 // saved base
+  ip = bytes + offsets[c] + 1;           // p of the CALL
+  leaveDisplay(vm, OPERAND());
+  ip = bytes + offsets[c + 1];
+  DISPATCH();
+ op_RC:
+  vm->t ++;
+  if (!readCharIO(vm, &stack[vm->t]))
+    EXIT(PS_IO_ERROR);
+  DISPATCH();
+ op_RI:
+  vm->t ++;
+  if (!readIntIO(vm, &stack[vm->t]))
+    EXIT(PS_IO_ERROR);
+  DISPATCH();
+ op_WRC:
+  writeCharIO(vm, stack[vm->t]);
+  vm->t --;
+  DISPATCH();
+ op_WRI:
+  writeIntIO(vm, stack[vm->t]);
+  vm->t --;
+  DISPATCH();
+ op_WLN:
+  writeLnIO(vm);
+  DISPATCH();
+ op_AD:
+  vm->t --;
+  stack[vm->t] += stack[vm->t+1];
+  DISPATCH();
+ op_SB:
+  vm->t --;
+  stack[vm->t] -= stack[vm->t+1];
+  DISPATCH();
+ op_ML:
+  vm->t --;
+  stack[vm->t] *= stack[vm->t+1];
+  DISPATCH();
+ op_DV:
+  vm->t --;
+  if (stack[vm->t+1] == 0)
+    EXIT(PS_DIVIDE_BY_ZERO);
+  stack[vm->t] /= stack[vm->t+1];
+  DISPATCH();
+ op_NEG:
+  stack[vm->t] = - stack[vm->t];
+  DISPATCH();
+ op_CV:
+  stack[vm->t+1] = stack[vm->t];
+  vm->t ++;
+  DISPATCH();
+ op_EQ:
+  vm->t --;
+  stack[vm->t] = (stack[vm->t] == stack[vm->t+1]) ? TRUE : FALSE;
+  DISPATCH();
+ op_NE:
+  vm->t --;
+  stack[vm->t] = (stack[vm->t] != stack[vm->t+1]) ? TRUE : FALSE;
+  DISPATCH();
+ op_GT:
+  vm->t --;
+  stack[vm->t] = (stack[vm->t] > stack[vm->t+1]) ? TRUE : FALSE;
+  DISPATCH();
+ op_LT:
+  vm->t --;
+  stack[vm->t] = (stack[vm->t] < stack[vm->t+1]) ? TRUE : FALSE;
+  DISPATCH();
+ op_GE:
+  vm->t --;
+  stack[vm->t] = (stack[vm->t] >= stack[vm->t+1]) ? TRUE : FALSE;
+  DISPATCH();
+ op_LE:
+  vm->t --;
+  stack[vm->t] = (stack[vm->t] <= stack[vm->t+1]) ? TRUE : FALSE;
+  DISPATCH();
+ op_ADC:
+  stack[vm->t] += OPERAND();
+  DISPATCH();
+ op_LVAC:
+  c = VARIABLE();
+  vm->t ++;
+  stack[vm->t] = c + OPERAND();
+  DISPATCH();
+ op_MOV:
+  p = OPERAND();
+  q = base(vm, p) + OPERAND();
+  stack[q] = VARIABLE();
+  DISPATCH();
+ op_MOVC:
+  p = OPERAND();
+  q = base(vm, p) + OPERAND();
+  stack[q] = OPERAND();
+  DISPATCH();
+ op_VVEQ: COMPARE_JUMP(==, VARIABLE());
+ op_VVNE: COMPARE_JUMP(!=, VARIABLE());
+ op_VVGT: COMPARE_JUMP(>, VARIABLE());
+ op_VVLT: COMPARE_JUMP(<, VARIABLE());
+ op_VVGE: COMPARE_JUMP(>=, VARIABLE());
+ op_VVLE: COMPARE_JUMP(<=, VARIABLE());
+ op_VCEQ: COMPARE_JUMP(==, OPERAND());
+ op_VCNE: COMPARE_JUMP(!=, OPERAND());
+ op_VCGT: COMPARE_JUMP(>, OPERAND());
+ op_VCLT: COMPARE_JUMP(<, OPERAND());
+ op_VCGE: COMPARE_JUMP(>=, OPERAND());
+ op_VCLE: COMPARE_JUMP(<=, OPERAND());
+ op_LCF:
+  p = OPERAND();
+  q = OPERAND();
+  vm->t += 2;
+  stack[vm->t-1] = p;
+  stack[vm->t] = q;
+  DISPATCH();
+ op_LVF:
+  p = OPERAND();
+  q = OPERAND();
+  vm->t += 2;
+  storeDouble(stack, vm->t-1, loadDouble(stack, base(vm, p) + q));
+  DISPATCH();
+ op_LIF:
+  vm->t ++;
+  storeDouble(stack, vm->t-1, loadDouble(stack, stack[vm->t-1]));
+  DISPATCH();
+ op_STF:
+  storeDouble(stack, stack[vm->t-2], loadDouble(stack, vm->t-1));
+  vm->t -= 3;
+  DISPATCH();
+ op_ADF: FLOAT_ARITH(stack, vm->t, +); DISPATCH();
+ op_SBF: FLOAT_ARITH(stack, vm->t, -); DISPATCH();
+ op_MLF: FLOAT_ARITH(stack, vm->t, *); DISPATCH();
+ op_DVF: FLOAT_ARITH(stack, vm->t, /); DISPATCH();
+ op_NEGF:
+  storeDouble(stack, vm->t-1, - loadDouble(stack, vm->t-1));
+  DISPATCH();
+ op_EQF: FLOAT_COMPARE(stack, vm->t, ==); DISPATCH();
+ op_NEF: FLOAT_COMPARE(stack, vm->t, !=); DISPATCH();
+ op_GTF: FLOAT_COMPARE(stack, vm->t, >); DISPATCH();
+ op_LTF: FLOAT_COMPARE(stack, vm->t, <); DISPATCH();
+ op_GEF: FLOAT_COMPARE(stack, vm->t, >=); DISPATCH();
+ op_LEF: FLOAT_COMPARE(stack, vm->t, <=); DISPATCH();
+ op_CVIF:
+  widenInt(stack, vm->t, OPERAND());
+  vm->t ++;
+  DISPATCH();
+ op_CVFI:
+  vm->t --;
+  stack[vm->t] = truncateDouble(loadDouble(stack, vm->t));
+  DISPATCH();
+ op_RF:
+  vm->t += 2;
+  if (!readDoubleIO(vm, &stack[vm->t-1]))
+    EXIT(PS_IO_ERROR);
+  DISPATCH();
+ op_WRF:
+  writeDoubleIO(vm, &stack[vm->t-1]);
+  vm->t -= 2;
+  DISPATCH();
+ op_EFF:
+  p = stack[vm->b+1];                 // saved base, before the result covers it
+  moveFloatResult(stack, vm->b, OPERAND());
+  vm->t = vm->b + 1;                      // the two words of the result on top
+  c = stack[vm->b+2];                 // Saved return address
+  vm->b = p;
+  ip = bytes + offsets[c] + 1;           // p of the CALL
+  leaveDisplay(vm, OPERAND());
+  ip = bytes + offsets[c + 1];
+  DISPATCH();
+ op_MVB:
+  vm->t -= 2;
+  if (!moveBlock(vm, stack[vm->t+1], stack[vm->t+2], OPERAND()))
+    EXIT(PS_STACK_OVERFLOW);
+  DISPATCH();
+ op_FLB:
+  vm->t -= 2;
+  if (!fillBlock(vm, stack[vm->t+1], stack[vm->t+2], OPERAND()))
+    EXIT(PS_STACK_OVERFLOW);
+  DISPATCH();
+ op_PW:
+  vm->t --;
+  if (!powerInt(&stack[vm->t], stack[vm->t+1]))
+    EXIT(PS_DIVIDE_BY_ZERO);
+  DISPATCH();
+ op_PWF:
+  vm->t --;
+  powerDouble(&stack[vm->t-1], stack[vm->t+1]);
+  DISPATCH();
+ op_leave:
+  // Back to the opcode byte, which run() executes from code[pc]
+  ip --;
+  EXIT(vm->ps);
+
+#undef COMPARE_JUMP
+#undef VARIABLE
+#undef EXIT
+#undef TARGET
+#undef OPERAND
+#undef DISPATCH
+}
+
+/*
+ * Register engine. It runs the register form of the code (see register.h),
+ * made when the code was loaded, through a handler table as runThreaded
+ * does, with f the base of the current frame. The frames are those of
+ * run() and their return addresses stack pcs, so control moves between the
+ * engine and run() at the entry of any block: the engine leaves on halt,
+ * on a runtime error and on the instructions it has no form for, which
+ * run() executes before entering it again. At a pc inside a block (after a
+ * snapshot, say) it returns at once and run() steps to the next entry.
+ */
+static void runRegister(VM* vm) {
+  static const void* handlers[NUM_OF_REG_OPCODES] = {
+    [RG_MOV] = &&rg_MOV,   [RG_ADD] = &&rg_ADD,   [RG_SUB] = &&rg_SUB,
+    [RG_MUL] = &&rg_MUL,   [RG_DIV] = &&rg_DIV,   [RG_PW] = &&rg_PW,
+    [RG_NEG] = &&rg_NEG,
+    [RG_EQ] = &&rg_EQ,     [RG_NE] = &&rg_NE,     [RG_GT] = &&rg_GT,
+    [RG_LT] = &&rg_LT,     [RG_GE] = &&rg_GE,     [RG_LE] = &&rg_LE,
+    [RG_J] = &&rg_J,       [RG_JF] = &&rg_JF,
+    [RG_JFEQ] = &&rg_JFEQ, [RG_JFNE] = &&rg_JFNE, [RG_JFGT] = &&rg_JFGT,
+    [RG_JFLT] = &&rg_JFLT, [RG_JFGE] = &&rg_JFGE, [RG_JFLE] = &&rg_JFLE,
+    [RG_LA] = &&rg_LA,     [RG_LDU] = &&rg_LDU,   [RG_STU] = &&rg_STU,
+    [RG_LI] = &&rg_LI,     [RG_ST] = &&rg_ST,
+    [RG_RI] = &&rg_RI,     [RG_RC] = &&rg_RC,
+    [RG_WRI] = &&rg_WRI,   [RG_WRC] = &&rg_WRC,   [RG_WLN] = &&rg_WLN,
+    [RG_CALL] = &&rg_CALL, [RG_EP] = &&rg_EP,     [RG_EF] = &&rg_EF,
+    [RG_HL] = &&rg_HL,     [RG_LEAVE] = &&rg_LEAVE,
+  };
+  RegisterCode* registerCode = vm->registerCode;
+  RegInstruction* start = registerCode->code;
+  RegInstruction* ip;
+  Instruction* code = vm->codeBlock->code;
+  Memory stack = vm->stack;
+  WORD* constants = registerCode->constants;
+  WORD* f = stack + vm->b;
+  Count dispatches = 0;
+  int entry = registerCode->entries[vm->pc];
+  WORD x;
+
+  if (entry < 0) return;
+  ip = start + entry;
+
+#define DISPATCH() do { dispatches ++; goto *handlers[ip->op]; } while (0)
+#define NEXT() do { ip ++; DISPATCH(); } while (0)
+#define RK(x) (((x) >= 0) ? f[x] : constants[~(x)])
+#define EXIT(state, next)			\
+  do {						\
+    vm->ps = (state);				\
+    vm->pc = (next);				\
+    vm->registerDispatches += dispatches;	\
+    return;					\
+  } while (0)
+  // Continues at the entry of the stack pc, or leaves it to run()
+#define CONTINUE(next)				\
+  do {						\
+    entry = registerCode->entries[next];	\
+    if (entry < 0) EXIT(PS_ACTIVE, next);	\
+    ip = start + entry;				\
+    DISPATCH();					\
+  } while (0)
+#define COMPARE(cmp)						\
+  do {								\
+    f[ip->a] = (RK(ip->b) cmp RK(ip->c)) ? TRUE : FALSE;	\
+    NEXT();							\
+  } while (0)
+#define COMPARE_JUMP(cmp)			\
+  do {						\
+    if (RK(ip->b) cmp RK(ip->c)) NEXT();	\
+    ip = start + ip->a;				\
+    DISPATCH();					\
+  } while (0)
+
+  DISPATCH();
+
+ rg_MOV:
+  f[ip->a] = RK(ip->b);
+  NEXT();
+ rg_ADD:
+  f[ip->a] = RK(ip->b) + RK(ip->c);
+  NEXT();
+ rg_SUB:
+  f[ip->a] = RK(ip->b) - RK(ip->c);
+  NEXT();
+ rg_MUL:
+  f[ip->a] = RK(ip->b) * RK(ip->c);
+  NEXT();
+ rg_DIV:
+  x = RK(ip->c);
+  if (x == 0)
+    EXIT(PS_DIVIDE_BY_ZERO, ip->pc + 1);
+  f[ip->a] = RK(ip->b) / x;
+  NEXT();
+ rg_PW:
+  x = RK(ip->b);
+  if (!powerInt(&x, RK(ip->c)))
+    EXIT(PS_DIVIDE_BY_ZERO, ip->pc + 1);
+  f[ip->a] = x;
+  NEXT();
+ rg_NEG:
+  f[ip->a] = - RK(ip->b);
+  NEXT();
+ rg_EQ:
+  COMPARE(==);
+ rg_NE:
+  COMPARE(!=);
+ rg_GT:
+  COMPARE(>);
+ rg_LT:
+  COMPARE(<);
+ rg_GE:
+  COMPARE(>=);
+ rg_LE:
+  COMPARE(<=);
+ rg_J:
+  ip = start + ip->a;
+  DISPATCH();
+ rg_JF:
+  if (RK(ip->b) != FALSE) NEXT();
+  ip = start + ip->a;
+  DISPATCH();
+ rg_JFEQ:
+  COMPARE_JUMP(==);
+ rg_JFNE:
+  COMPARE_JUMP(!=);
+ rg_JFGT:
+  COMPARE_JUMP(>);
+ rg_JFLT:
+  COMPARE_JUMP(<);
+ rg_JFGE:
+  COMPARE_JUMP(>=);
+ rg_JFLE:
+  COMPARE_JUMP(<=);
+ rg_LA:
+  f[ip->a] = base(vm, ip->b) + ip->c;
+  NEXT();
+ rg_LDU:
+  f[ip->a] = stack[base(vm, ip->b) + ip->c];
+  NEXT();
+ rg_STU:
+  stack[base(vm, ip->b) + ip->c] = RK(ip->a);
+  NEXT();
+ rg_LI:
+  f[ip->a] = stack[RK(ip->b)];
+  NEXT();
+ rg_ST:
+  stack[RK(ip->a)] = RK(ip->b);
+  NEXT();
+ rg_RI:
+  if (!readIntIO(vm, &f[ip->a]))
+    EXIT(PS_IO_ERROR, ip->pc + 1);
+  NEXT();
+ rg_RC:
+  if (!readCharIO(vm, &f[ip->a]))
+    EXIT(PS_IO_ERROR, ip->pc + 1);
+  NEXT();
+ rg_WRI:
+  writeIntIO(vm, RK(ip->a));
+  NEXT();
+ rg_WRC:
+  writeCharIO(vm, RK(ip->a));
+  NEXT();
+ rg_WLN:
+  writeLnIO(vm);
+  NEXT();
+ rg_CALL:
+  vm->t = vm->b + ip->a - 1;
+  if (!checkFrame(vm, vm->t, ip->c))
+    EXIT(PS_STACK_OVERFLOW, ip->pc + 1);
+  stack[vm->t+2] = vm->b;                 // Dynamic Link
+  stack[vm->t+3] = ip->pc;                // Return Address
+  stack[vm->t+4] = base(vm, ip->b);       // Static Link
+  vm->b = vm->t + 1;                      // Base & Result
+  enterDisplay(vm, ip->b);
+  f = stack + vm->b;
+  CONTINUE(ip->c);
+ rg_EP:
+  vm->t = vm->b - 1;                      // Previous top
+  x = stack[vm->b+2];                     // Saved return address
+  vm->b = stack[vm->b+1];                 // Saved base
+  leaveDisplay(vm, code[x].p);
+  f = stack + vm->b;
+  CONTINUE(x + 1);
+ rg_EF:
+  vm->t = vm->b;                          // return value is on the top of the stack
+  x = stack[vm->b+2];                     // Saved return address
+  vm->b = stack[vm->b+1];                 // saved base
+  leaveDisplay(vm, code[x].p);
+  f = stack + vm->b;
+  CONTINUE(x + 1);
+ rg_HL:
+  vm->t = vm->b + ip->a - 1;
+  EXIT(PS_NORMAL_EXIT, ip->pc + 1);
+ rg_LEAVE:
+  vm->t = vm->b + ip->a - 1;
+  EXIT(PS_ACTIVE, ip->pc);
+
+#undef COMPARE_JUMP
+#undef COMPARE
+#undef CONTINUE
+#undef EXIT
+#undef RK
+#undef NEXT
+#undef DISPATCH
+}
+
+// Why a program stopped, for its runtime error message; NULL if it did not fail
+char* runtimeMessage(int ps) {
+  switch (ps) {
+  case PS_DIVIDE_BY_ZERO: return "Divide by zero!";
+  case PS_STACK_OVERFLOW: return "Stack overflow!";
+  case PS_IO_ERROR: return "IO error!";
+  default: return NULL;
+  }
+}
+
+// Whether a program reading from f talks to someone: a terminal or a client
+static int interactive(FILE* f) {
+  struct stat info;
+
+  if (isatty(fileno(f))) return 1;
+  return (fstat(fileno(f), &info) == 0) && S_ISSOCK(info.st_mode);
+}
+
+int run(VM* vm) {
+  Instruction* code = vm->codeBlock->code;
+  Memory stack = vm->stack;
   int count = 0;
-  int number;
   char s[100];
 
-  WINDOW* win = initscr();
-  nonl();
-  cbreak();
-  noecho();
-  scrollok(win,TRUE);
-  
-  ps = PS_ACTIVE;
-  while (ps == PS_ACTIVE) {
-    if (debugMode) {
-      sprintInstruction(s,&(code[pc]));
-      wprintw(win, "%6d-%-4d:  %s\n",count++,pc,s);
+  // Curses is only needed to drive the interactive debugger
+  if (vm->debugMode) {
+    win = initscr();
+    vm->curses = 1;
+    nonl();
+    cbreak();
+    noecho();
+    scrollok(win,TRUE);
+  } else vm->flushBeforeRead = interactive(vm->inputStream);
+
+  vm->ps = PS_ACTIVE;
+  // The frame of the main program is checked like those of CALL
+  if ((vm->pc == 0) && !checkFrame(vm, vm->t, 0))
+    vm->ps = PS_STACK_OVERFLOW;
+  runningVM = vm;
+  if (sigsetjmp(vm->overflowJump, 1) != 0)
+    vm->ps = PS_STACK_OVERFLOW;
+  else vm->overflowArmed = 1;
+  while (vm->ps == PS_ACTIVE) {
+    // The debugger, the profiler and the trace need every instruction here
+    if ((vm->engine != ENGINE_SWITCH) && !vm->debugMode && (vm->profile == NULL)
+	&& (vm->trace == NULL)) {
+      if (vm->engine == ENGINE_THREADED)
+	runThreaded(vm);
+      else if (vm->engine == ENGINE_PACKED)
+	runPacked(vm);
+      else if (vm->engine == ENGINE_REGISTER) {
+	if (vm->registerCode != NULL)
+	  runRegister(vm);
+	else runThreaded(vm);
+      } else if ((vm->engine == ENGINE_CACHED) || !runNative(vm))
+	runCached(vm);
+      if (vm->ps != PS_ACTIVE) break;
+    }
+
+    if (vm->profile != NULL)
+      profileStep(vm->profile, code, vm->pc);
+    if (vm->trace != NULL)
+      traceStep(vm->trace, vm->pc, code[vm->pc].op, vm->t, vm->b, stack[vm->t]);
+
+    if (vm->debugMode) {
+      sprintInstruction(s,&(code[vm->pc]));
+      wprintw(win, "%6d-%-4d:  %s\n",count++,vm->pc,s);
     }
 
-    switch (code[pc].op) {
+    switch (code[vm->pc].op) {
     case OP_LA: 
-      t ++;
-      if (checkStack())
-	stack[t] = base(code[pc].p) + code[pc].q;
+      vm->t ++;
+      if (checkStack(vm))
+	stack[vm->t] = base(vm, code[vm->pc].p) + code[vm->pc].q;
       break;
     case OP_LV: 
-      t ++;
-      if (checkStack())
-	stack[t] = stack[base(code[pc].p) + code[pc].q];
+      vm->t ++;
+      if (checkStack(vm))
+	stack[vm->t] = stack[base(vm, code[vm->pc].p) + code[vm->pc].q];
       break;
     case OP_LC: 
-      t ++;
-      if (checkStack())
-	stack[t] = code[pc].q;
+      vm->t ++;
+      if (checkStack(vm))
+	stack[vm->t] = code[vm->pc].q;
       break;
     case OP_LI: 
-      stack[t] = stack[stack[t]];
+      stack[vm->t] = stack[stack[vm->t]];
       break;
     case OP_INT:
-      t += code[pc].q;
-      checkStack();
+      vm->t += code[vm->pc].q;
+      checkStack(vm);
       break;
     case OP_DCT: 
-      t -= code[pc].q;
-      checkStack();
+      vm->t -= code[vm->pc].q;
+      checkStack(vm);
       break;
     case OP_J: 
-      pc = code[pc].q - 1;
+      vm->pc = code[vm->pc].q - 1;
       break;
     case OP_FJ: 
-      if (stack[t] == FALSE) 
-	pc = code[pc].q - 1;
-      t --;
-      checkStack();
+      if (stack[vm->t] == FALSE) 
+	vm->pc = code[vm->pc].q - 1;
+      vm->t --;
+      checkStack(vm);
       break;
     case OP_HL: 
-      ps = PS_NORMAL_EXIT;
+      vm->ps = PS_NORMAL_EXIT;
       break;
     case OP_ST: 
-      stack[stack[t-1]] = stack[t];
-      t -= 2;
-      checkStack();
+      stack[stack[vm->t-1]] = stack[vm->t];
+      vm->t -= 2;
+      checkStack(vm);
       break;
     case OP_CALL: 
-      stack[t+2] = b;                 // Dynamic Link
-      stack[t+3] = pc;                // Return Address
-      stack[t+4] = base(code[pc].p);  // Static Link
-      b = t + 1;                      // Base & Result
-      pc = code[pc].q - 1;              
+      if (!checkFrame(vm, vm->t, code[vm->pc].q)) {
+	vm->ps = PS_STACK_OVERFLOW;
+	break;
+      }
+      stack[vm->t+2] = vm->b;                 // Dynamic Link
+      stack[vm->t+3] = vm->pc;                // Return Address
+      stack[vm->t+4] = base(vm, code[vm->pc].p);  // Static Link
+      vm->b = vm->t + 1;                      // Base & Result
+      enterDisplay(vm, code[vm->pc].p);
+      vm->pc = code[vm->pc].q - 1;              
       break;
     case OP_EP: 
-      t = b - 1;                      // Previous top
-      pc = stack[b+2];                // Saved return address
-      b = stack[b+1];                 // Saved base
+      vm->t = vm->b - 1;                      // Previous top
+      vm->pc = stack[vm->b+2];                // Saved return address
+      vm->b = stack[vm->b+1];                 // Saved base
+      leaveDisplay(vm, code[vm->pc].p);
       break;
     case OP_EF:
-      t = b;                          // return value is on the top of the stack
-      pc = stack[b+2];                // Saved return address
-      b = stack[b+1];                 // saved base
+      vm->t = vm->b;                          // return value is on the top of the stack
+      vm->pc = stack[vm->b+2];                // Saved return address
+      vm->b = stack[vm->b+1];                 // saved base
+      leaveDisplay(vm, code[vm->pc].p);
       break;
     case OP_RC: 
-      t ++;
-      echo();
-      wscanw(win,"%c",&number);
-      noecho();
-      stack[t] = number;
-      checkStack();
+      vm->t ++;
+      if (!readCharIO(vm, &stack[vm->t]))
+	vm->ps = PS_IO_ERROR;
+      checkStack(vm);
       break;
     case OP_RI:
-      t ++;
-      echo();
-      wscanw(win,"%d",&number);
-      noecho();
-      stack[t] = number;
-      checkStack();
+      vm->t ++;
+      if (!readIntIO(vm, &stack[vm->t]))
+	vm->ps = PS_IO_ERROR;
+      checkStack(vm);
       break;
     case OP_WRC: 
-      wprintw(win,"%c",stack[t]);
-      t --;
-      checkStack();
+      writeCharIO(vm, stack[vm->t]);
+      vm->t --;
+      checkStack(vm);
       break;     
     case OP_WRI: 
-      wprintw(win,"%d",stack[t]);
-      t --;
-      checkStack();
+      writeIntIO(vm, stack[vm->t]);
+      vm->t --;
+      checkStack(vm);
       break;
     case OP_WLN:
-      wprintw(win,"\n");
+      writeLnIO(vm);
       break;
     case OP_AD:
-      t --;
-      if (checkStack()) 
-	stack[t] += stack[t+1];
+      vm->t --;
+      if (checkStack(vm)) 
+	stack[vm->t] += stack[vm->t+1];
       break;
     case OP_SB:
-      t --;
-      if (checkStack()) 
-	stack[t] -= stack[t+1];
+      vm->t --;
+      if (checkStack(vm)) 
+	stack[vm->t] -= stack[vm->t+1];
       break;
     case OP_ML:
-      t --;
-      if (checkStack()) 
-	stack[t] *= stack[t+1];
+      vm->t --;
+      if (checkStack(vm)) 
+	stack[vm->t] *= stack[vm->t+1];
       break;
 
     case OP_DV: 
-      t --;
-      if (checkStack()) {
-	if (stack[t+1] == 0)
-	  ps = PS_DIVIDE_BY_ZERO;
-	else stack[t] /= stack[t+1];
+      vm->t --;
+      if (checkStack(vm)) {
+	if (stack[vm->t+1] == 0)
+	  vm->ps = PS_DIVIDE_BY_ZERO;
+	else stack[vm->t] /= stack[vm->t+1];
       }
       break;
     case OP_NEG:
-      stack[t] = - stack[t];
+      stack[vm->t] = - stack[vm->t];
       break;
     case OP_CV: 
-      stack[t+1] = stack[t];
-      t ++;
-      checkStack();
+      stack[vm->t+1] = stack[vm->t];
+      vm->t ++;
+      checkStack(vm);
       break;
     case OP_EQ:
-      t --;
-      if (stack[t] == stack[t+1]) 
-	stack[t] = TRUE;
-      else stack[t] = FALSE;
-      checkStack();
+      vm->t --;
+      if (stack[vm->t] == stack[vm->t+1]) 
+	stack[vm->t] = TRUE;
+      else stack[vm->t] = FALSE;
+      checkStack(vm);
       break;
     case OP_NE:
-      t --;
-      if (stack[t] != stack[t+1]) 
-	stack[t] = TRUE;
-      else stack[t] = FALSE;
-      checkStack();
+      vm->t --;
+      if (stack[vm->t] != stack[vm->t+1]) 
+	stack[vm->t] = TRUE;
+      else stack[vm->t] = FALSE;
+      checkStack(vm);
       break;
     case OP_GT:
-      t --;
-      if (stack[t] > stack[t+1]) 
-	stack[t] = TRUE;
-      else stack[t] = FALSE;
-      checkStack();
+      vm->t --;
+      if (stack[vm->t] > stack[vm->t+1]) 
+	stack[vm->t] = TRUE;
+      else stack[vm->t] = FALSE;
+      checkStack(vm);
       break;
     case OP_LT:
-      t --;
-      if (stack[t] < stack[t+1]) 
-	stack[t] = TRUE;
-      else stack[t] = FALSE;
-      checkStack();
+      vm->t --;
+      if (stack[vm->t] < stack[vm->t+1]) 
+	stack[vm->t] = TRUE;
+      else stack[vm->t] = FALSE;
+      checkStack(vm);
       break;
     case OP_GE:
-      t --;
-      if (stack[t] >= stack[t+1]) 
-	stack[t] = TRUE;
-      else stack[t] = FALSE;
-      checkStack();
+      vm->t --;
+      if (stack[vm->t] >= stack[vm->t+1]) 
+	stack[vm->t] = TRUE;
+      else stack[vm->t] = FALSE;
+      checkStack(vm);
       break;
     case OP_LE:
-      t --;
-      if (stack[t] <= stack[t+1]) 
-	stack[t] = TRUE;
-      else stack[t] = FALSE;
-      checkStack();
+      vm->t --;
+      if (stack[vm->t] <= stack[vm->t+1]) 
+	stack[vm->t] = TRUE;
+      else stack[vm->t] = FALSE;
+      checkStack(vm);
       break;
     case OP_BP:
-      // Just for debugging
-      debugMode = 1;
+      // Just for debugging. Break points only stop under the debugger,
+      // or to be checkpointed: the run resumes after the break point.
+      if (vm->curses)
+	vm->debugMode = 1;
+      else if (vm->snapshotFile != NULL) {
+	vm->pc ++;
+	if (saveSnapshot(vm, vm->snapshotFile) == SNAPSHOT_OK)
+	  vm->ps = PS_NORMAL_EXIT;
+	else vm->ps = PS_IO_ERROR;
+	vm->pc --;
+      }
+      break;
+
+    case OP_LCF:
+      vm->t += 2;
+      if (checkStack(vm)) {
+	stack[vm->t-1] = code[vm->pc].p;
+	stack[vm->t] = code[vm->pc].q;
+      }
+      break;
+    case OP_LVF:
+      vm->t += 2;
+      if (checkStack(vm))
+	storeDouble(stack, vm->t-1, loadDouble(stack, base(vm, code[vm->pc].p) + code[vm->pc].q));
+      break;
+    case OP_LIF:
+      vm->t ++;
+      if (checkStack(vm))
+	storeDouble(stack, vm->t-1, loadDouble(stack, stack[vm->t-1]));
+      break;
+    case OP_STF:
+      storeDouble(stack, stack[vm->t-2], loadDouble(stack, vm->t-1));
+      vm->t -= 3;
+      checkStack(vm);
+      break;
+    case OP_ADF: FLOAT_ARITH(stack, vm->t, +); break;
+    case OP_SBF: FLOAT_ARITH(stack, vm->t, -); break;
+    case OP_MLF: FLOAT_ARITH(stack, vm->t, *); break;
+    case OP_DVF: FLOAT_ARITH(stack, vm->t, /); break;
+    case OP_NEGF:
+      storeDouble(stack, vm->t-1, - loadDouble(stack, vm->t-1));
+      break;
+    case OP_EQF: FLOAT_COMPARE(stack, vm->t, ==); break;
+    case OP_NEF: FLOAT_COMPARE(stack, vm->t, !=); break;
+    case OP_GTF: FLOAT_COMPARE(stack, vm->t, >); break;
+    case OP_LTF: FLOAT_COMPARE(stack, vm->t, <); break;
+    case OP_GEF: FLOAT_COMPARE(stack, vm->t, >=); break;
+    case OP_LEF: FLOAT_COMPARE(stack, vm->t, <=); break;
+    case OP_CVIF:
+      if (vm->t + 1 < vm->stackSize)
+	widenInt(stack, vm->t, code[vm->pc].q);
+      vm->t ++;
+      checkStack(vm);
+      break;
+    case OP_CVFI:
+      vm->t --;
+      stack[vm->t] = truncateDouble(loadDouble(stack, vm->t));
+      break;
+    case OP_RF:
+      vm->t += 2;
+      if (checkStack(vm) && !readDoubleIO(vm, &stack[vm->t-1]))
+	vm->ps = PS_IO_ERROR;
+      break;
+    case OP_WRF:
+      writeDoubleIO(vm, &stack[vm->t-1]);
+      vm->t -= 2;
+      checkStack(vm);
+      break;
+    case OP_EFF: {
+      WORD dynamicLink = stack[vm->b+1];    // before the result covers it
+
+      moveFloatResult(stack, vm->b, code[vm->pc].q);
+      vm->t = vm->b + 1;                      // the two words of the result on top
+      vm->pc = stack[vm->b+2];                // Saved return address
+      vm->b = dynamicLink;
+      leaveDisplay(vm, code[vm->pc].p);
+      break;
+    }
+    case OP_MVB:
+      vm->t -= 2;
+      if (!moveBlock(vm, stack[vm->t+1], stack[vm->t+2], code[vm->pc].q))
+	vm->ps = PS_STACK_OVERFLOW;
+      break;
+    case OP_FLB:
+      vm->t -= 2;
+      if (!fillBlock(vm, stack[vm->t+1], stack[vm->t+2], code[vm->pc].q))
+	vm->ps = PS_STACK_OVERFLOW;
+      break;
+    case OP_PW:
+      vm->t --;
+      if (checkStack(vm) && !powerInt(&stack[vm->t], stack[vm->t+1]))
+	vm->ps = PS_DIVIDE_BY_ZERO;
+      break;
+    case OP_PWF:
+      vm->t --;
+      if (checkStack(vm))
+	powerDouble(&stack[vm->t-1], stack[vm->t+1]);
+      break;
+
+    case OP_ADC:
+      stack[vm->t] += code[vm->pc].q;
+      break;
+    case OP_LVAC:
+      vm->t ++;
+      if (checkStack(vm))
+	stack[vm->t] = stack[base(vm, code[vm->pc].p) + code[vm->pc].q] + code[vm->pc+1].q;
+      vm->pc ++;
+      break;
+    case OP_MOV:
+      stack[base(vm, code[vm->pc].p) + code[vm->pc].q] = stack[base(vm, code[vm->pc+1].p) + code[vm->pc+1].q];
+      vm->pc ++;
+      break;
+    case OP_MOVC:
+      stack[base(vm, code[vm->pc].p) + code[vm->pc].q] = code[vm->pc+1].q;
+      vm->pc ++;
+      break;
+    case OP_VVEQ: case OP_VVNE: case OP_VVGT:
+    case OP_VVLT: case OP_VVGE: case OP_VVLE:
+    case OP_VCEQ: case OP_VCNE: case OP_VCGT:
+    case OP_VCLT: case OP_VCGE: case OP_VCLE:
+      if (compareOperands(vm, &code[vm->pc]))
+	vm->pc += 2;
+      else vm->pc = code[vm->pc+2].q - 1;
       break;
     default: break;
     }
 
-    if (debugMode) {
+    if (vm->debugMode) {
       int command;
       int level, offset;
       int interactive = 1;
@@ -279,36 +2235,42 @@ int run(void) {
 	case 'A':
 	  wprintw(win,"\nEnter memory location (level, offset):");
 	  wscanw(win,"%d %d", &level, &offset);
-	  wprintw(win,"Absolute address = %d\n", base(level) + offset);
+	  wprintw(win,"Absolute address = %d\n", base(vm, level) + offset);
 	  interactive = 1;
 	  break;
 	case 'm':
 	case 'M':
 	  wprintw(win,"\nEnter memory location (level, offset):");
 	  wscanw(win,"%d %d", &level, &offset);
-	  wprintw(win,"Value = %d\n", stack[base(level) + offset]);
+	  wprintw(win,"Value = %d\n", stack[base(vm, level) + offset]);
 	  interactive = 1;
 	  break;
 	case 't':
 	case 'T':
-	  wprintw(win,"Top (%d) = %d\n", t, stack[t]);
+	  wprintw(win,"Top (%d) = %d\n", vm->t, stack[vm->t]);
 	  interactive = 1;
 	  break;
 	case 'c':
 	case 'C':
-	  debugMode = 0;
+	  vm->debugMode = 0;
 	  break;
 	case 'h':
 	case 'H':
-	  ps = PS_NORMAL_EXIT;
+	  vm->ps = PS_NORMAL_EXIT;
 	  break;
 	default: break;
 	}
       } while (interactive);
     }
-    pc ++;
+    vm->pc ++;
   }
-  wprintw(win,"\nPress any key to exit...");getch();
-  endwin();
-  return ps;
+  vm->overflowArmed = 0;
+  runningVM = NULL;
+  if (vm->curses) {
+    wprintw(win,"\nPress any key to exit...");getch();
+    endwin();
+    win = NULL;
+    vm->curses = 0;
+  } else fflush(vm->outputStream);
+  return vm->ps;
 }
@@ -7,7 +7,17 @@
 #ifndef __VM_H__
 #define __VM_H__
 
+#include <stdio.h>
+#include <setjmp.h>
+#include <signal.h>
+
 #include "instructions.h"
+#include "verifier.h"
+#include "packed.h"
+#include "register.h"
+#include "stack.h"
+#include "profile.h"
+#include "trace.h"
 
 #define PS_ACTIVE         0
 #define PS_INACTIVE       1
@@ -16,18 +26,107 @@
 #define PS_DIVIDE_BY_ZERO 4
 #define PS_STACK_OVERFLOW 5
 
+#define ENGINE_SWITCH     0
+#define ENGINE_THREADED   1
+#define ENGINE_CACHED     2
+#define ENGINE_NATIVE     3
+#define ENGINE_PACKED     4
+#define ENGINE_REGISTER   5
+
+#define IO_BUFFER_SIZE    65536
+
 typedef WORD* Memory;
 
-void printMemory(void);
-void printCodeBuffer(void);
+/*
+ * A virtual machine and the program loaded into it. VMs share nothing, so
+ * as many as wanted can run at once, each on its own thread. The options
+ * are set before initVM; the rest belongs to vm.c and jit.c.
+ */
+struct VM_ {
+  // Options
+  int stackSize;
+  int codeSize;
+  int debugMode;
+  int engine;
+  int fuseMode;
+  int hugePages;
+
+  // Registers. With shareExecutable the code and its tables belong to
+  // codeOwner instead of this VM.
+  CodeBlock* codeBlock;
+  struct VM_* codeOwner;
+  StackMemory* stackMemory;
+  Memory stack;
+  int t;
+  int b;
+  int pc;
+  int ps;
+
+  // Outcome of the last loadExecutable
+  LoadError loadError;
+  VerifyError verifyError;
+  int verifyErrorPc;
+  int fusedCount;
+  int eliminatedCount;
+
+  // Display registers: display[l] is the base of the innermost active frame
+  // of static level l, for l = 0..currentLevel. codeLevels[pc] is the static
+  // level of the procedure containing pc, found by the verifier.
+  // Without it (NULL) static links are resolved by walking the chain.
+  int* codeLevels;
+  WORD* display;
+  int displaySize;
+  int currentLevel;
+  // frameSizes[q] bounds the frame of the procedure entered at q (see
+  // verifier.c); it is checked on CALL, and verified code needs no other
+  // stack check.
+  int* frameSizes;
+
+  // Translations of the code for the engines, made on first use
+  const void** threadedCode;
+  const void** cachedCode;
+  PackedCode* packedCode;
+  RegisterCode* registerCode;
+  unsigned char* nativeCode;
+  size_t nativeSize;
+  void** nativeTable;
+
+  // Program I/O. Under the interactive debugger the program talks to the
+  // curses window instead of the two streams.
+  FILE* inputStream;
+  FILE* outputStream;
+  int flushBeforeRead;
+  int curses;
+
+  // When set, run() counts every instruction into it (see profile.h)
+  Profile* profile;
+  // Instructions run by the register engine, which has no profile
+  Count registerDispatches;
+  // When set, run() records every instruction into it (see trace.h)
+  Trace* trace;
+  // When set, the first break point writes a snapshot there and stops the
+  // program (see snapshot.h)
+  char* snapshotFile;
+
+  // Where a fault in the stack guards returns to (see stack.h)
+  sigjmp_buf overflowJump;
+  volatile sig_atomic_t overflowArmed;
+};
+
+typedef struct VM_ VM;
+
+void printMemory(VM* vm);
+void printCodeBuffer(VM* vm);
 
-void resetVM(void);
-void initVM(void);
-void cleanVM(void);
+void resetVM(VM* vm);
+void initVM(VM* vm);
+void cleanVM(VM* vm);
 
-int loadExecutable(FILE* f);
-int saveExecutable(FILE* f);
+int loadExecutable(VM* vm, FILE* f);
+int saveExecutable(VM* vm, FILE* f);
+void shareExecutable(VM* vm, VM* from);
 
-int run(void);
+int run(VM* vm);
+char* runtimeMessage(int ps);
 
 #endif